@@ -0,0 +1,462 @@
+/**
+ * bench_kernels.c - Protocol and Game Kernel Micro-Benchmarks
+ *
+ * Times the hot kernels one at a time: checksum and cipher, packet send and
+ * receive over a socketpair, snake movement, collision resolution and the
+ * full-map encode and decode used for snapshots. Game kernels run on
+ * synthetic arenas with 10 to 1000 players and several snake lengths.
+ *
+ * Each result is the median of --reps samples taken after a warmup sample;
+ * a sample repeats the kernel until it has run for at least SAMPLE_NS.
+ * Cycles are TSC (reference) cycles and are only shown on x86.
+ *
+ * Usage: ./bench_kernels [--grid N] [--reps N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "common.h"
+#include "proto.h"
+#include "game.h"
+
+#define SAMPLE_NS   5000000ULL    /* Minimum timed work per sample */
+#define MAX_RUNS    100000        /* Per sample */
+
+static const int k_player_counts[] = { 10, 50, 100, 250, 500, 1000 };
+static const int k_snake_lengths[] = { 4, 16, 64 };
+static const size_t k_buffer_sizes[] = { 64, 1024, 16384, 65536 };
+#define MAX_BUFFER_SIZE 65536
+
+static int g_reps = 9;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* ============================================================================
+ * Harness
+ * ============================================================================ */
+
+typedef struct {
+    void (*setup)(void *ctx);   /* Untimed, before every run (may be NULL) */
+    void (*run)(void *ctx);     /* The timed work */
+    void *ctx;
+    double ops;                 /* Operations in one run */
+    double bytes;               /* Bytes processed in one run, 0 if n/a */
+} Kernel;
+
+typedef struct {
+    double ns_per_op;
+    double cycles_per_op;
+    double mb_per_s;
+} KernelResult;
+
+static uint64_t g_timer_ns;      /* Cost of an empty timed region */
+static uint64_t g_timer_cycles;
+
+/* Smallest cost of timing nothing, taken off every run timed on its own */
+static void calibrate_timer(void) {
+    g_timer_ns = g_timer_cycles = UINT64_MAX;
+    for (int i = 0; i < 10000; i++) {
+        uint64_t c0 = now_cycles();
+        uint64_t t0 = now_ns();
+        uint64_t t1 = now_ns();
+        uint64_t c1 = now_cycles();
+        if (t1 - t0 < g_timer_ns) g_timer_ns = t1 - t0;
+        if (c1 - c0 < g_timer_cycles) g_timer_cycles = c1 - c0;
+    }
+}
+
+/* One sample: repeat until SAMPLE_NS of timed work, return ns and cycles per
+ * op. Kernels without setup are timed in batches, the others run by run. */
+static void sample(const Kernel *k, double *ns_op, double *cyc_op) {
+    uint64_t ns = 0, cycles = 0;
+    long runs = 0;
+    
+    if (!k->setup) {
+        for (long batch = 1; ns < SAMPLE_NS && runs < MAX_RUNS; batch *= 2) {
+            uint64_t c0 = now_cycles();
+            uint64_t t0 = now_ns();
+            for (long i = 0; i < batch; i++) {
+                k->run(k->ctx);
+            }
+            uint64_t t1 = now_ns();
+            uint64_t c1 = now_cycles();
+            ns += t1 - t0;
+            cycles += c1 - c0;
+            runs += batch;
+        }
+    } else {
+        while (ns < SAMPLE_NS && runs < MAX_RUNS) {
+            k->setup(k->ctx);
+            uint64_t c0 = now_cycles();
+            uint64_t t0 = now_ns();
+            k->run(k->ctx);
+            uint64_t t1 = now_ns();
+            uint64_t c1 = now_cycles();
+            ns += t1 - t0 > g_timer_ns ? t1 - t0 - g_timer_ns : 0;
+            cycles += c1 - c0 > g_timer_cycles ? c1 - c0 - g_timer_cycles : 0;
+            runs++;
+        }
+    }
+    
+    *ns_op = (double)ns / runs / k->ops;
+    *cyc_op = (double)cycles / runs / k->ops;
+}
+
+static KernelResult measure(const Kernel *k) {
+    double ns[64], cyc[64];
+    int reps = g_reps < 64 ? g_reps : 64;
+    
+    sample(k, &ns[0], &cyc[0]);     /* Warmup: caches, branch predictors, page faults */
+    for (int i = 0; i < reps; i++) {
+        sample(k, &ns[i], &cyc[i]);
+    }
+    qsort(ns, reps, sizeof(double), cmp_double);
+    qsort(cyc, reps, sizeof(double), cmp_double);
+    
+    KernelResult r;
+    r.ns_per_op = ns[reps / 2];
+    r.cycles_per_op = cyc[reps / 2];
+    r.mb_per_s = k->bytes > 0 ? k->bytes / k->ops / r.ns_per_op * 1e9 / (1 << 20) : 0;
+    return r;
+}
+
+static void report(const char *kernel, const char *params, const KernelResult *r) {
+    printf("%-20s %-22s %12.1f", kernel, params, r->ns_per_op);
+#ifdef HAVE_TSC
+    printf(" %12.1f", r->cycles_per_op);
+#else
+    printf(" %12s", "-");
+#endif
+    if (r->mb_per_s > 0) {
+        printf(" %10.1f\n", r->mb_per_s);
+    } else {
+        printf(" %10s\n", "-");
+    }
+}
+
+/* ============================================================================
+ * Protocol Kernels
+ * ============================================================================ */
+
+typedef struct {
+    unsigned char *buf;
+    size_t len;
+    int fds[2];
+    uint32_t sink;
+} ProtoCtx;
+
+static void run_checksum(void *p) {
+    ProtoCtx *c = p;
+    c->sink += calculate_checksum(c->buf, c->len);
+}
+
+static void run_cipher(void *p) {
+    ProtoCtx *c = p;
+    xor_cipher(c->buf, c->len);
+}
+
+/* One packet out of fds[0] and back in on fds[1] */
+static void run_send_recv(void *p) {
+    ProtoCtx *c = p;
+    uint16_t opcode;
+    void *payload = NULL;
+    uint32_t len;
+    if (send_packet(c->fds[0], OP_CHAT_SEND, c->buf, c->len) < 0 ||
+        recv_packet(c->fds[1], &opcode, &payload, &len) < 0) {
+        fprintf(stderr, "socketpair round trip failed\n");
+        exit(1);
+    }
+    c->sink += len;
+    free(payload);
+}
+
+static void bench_proto(void) {
+    unsigned char *buf = malloc(MAX_BUFFER_SIZE);
+    if (!buf) return;
+    for (size_t i = 0; i < MAX_BUFFER_SIZE; i++) {
+        buf[i] = (unsigned char)(i * 31 + 7);
+    }
+    
+    ProtoCtx ctx = { .buf = buf };
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ctx.fds) < 0) {
+        perror("socketpair");
+        free(buf);
+        return;
+    }
+    int sndbuf = 1 << 20;
+    setsockopt(ctx.fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    
+    for (size_t i = 0; i < sizeof(k_buffer_sizes) / sizeof(k_buffer_sizes[0]); i++) {
+        char params[32];
+        ctx.len = k_buffer_sizes[i];
+        snprintf(params, sizeof(params), "%zu B", ctx.len);
+        
+        Kernel k = { NULL, run_checksum, &ctx, 1, (double)ctx.len };
+        KernelResult r = measure(&k);
+        report("calculate_checksum", params, &r);
+        
+        k.run = run_cipher;
+        r = measure(&k);
+        report("xor_cipher", params, &r);
+        
+        k.run = run_send_recv;
+        r = measure(&k);
+        report("send+recv_packet", params, &r);
+    }
+    
+    close(ctx.fds[0]);
+    close(ctx.fds[1]);
+    free(buf);
+}
+
+/* ============================================================================
+ * Game Kernels
+ * ============================================================================ */
+
+typedef struct {
+    void *arena;
+    int players;
+    int path_len;
+    int *head_at;       /* Path index of each snake's head */
+    unsigned char *rle;
+    MapCell *cells;
+    size_t rle_len;
+    uint64_t sink;
+} GameCtx;
+
+/*
+ * Cell i of a cycle through the interior: along the top row, serpentine down
+ * over the remaining columns, then back up the first column. Snakes spaced
+ * along it and all steered along it never meet, so the kernels can run on the
+ * same arena for as long as needed.
+ */
+static Position path_cell(int i) {
+    int w = g_cfg.grid_size - 2;
+    int h = (g_cfg.grid_size - 2) & ~1;
+    int x, y;
+    
+    if (i < w) {
+        x = i;
+        y = 0;
+    } else if (i < w + (h - 1) * (w - 1)) {
+        int k = i - w;
+        y = 1 + k / (w - 1);
+        x = (y % 2) ? w - 1 - k % (w - 1) : 1 + k % (w - 1);
+    } else {
+        x = 0;
+        y = h - 1 - (i - w - (h - 1) * (w - 1));
+    }
+    Position p = { (int16_t)(1 + x), (int16_t)(1 + y) };
+    return p;
+}
+
+static uint8_t step_dir(Position from, Position to) {
+    if (to.x > from.x) return DIR_RIGHT;
+    if (to.x < from.x) return DIR_LEFT;
+    return to.y > from.y ? DIR_DOWN : DIR_UP;
+}
+
+/* Arena with `players` snakes of `length` spread evenly along the path, none
+ * of them spawn-protected; false if they do not fit */
+static bool arena_create(GameCtx *g, int grid, int players, int length) {
+    GameConfig cfg = {
+        .grid_size = grid,
+        .max_players = players,
+        .max_snake_len = length + 1,     /* No growth: spacing stays fixed */
+        .max_delta_cells = MAX_DELTA_CELLS
+    };
+    g->path_len = (grid - 2) * ((grid - 2) & ~1);
+    if (players * (length + 1) > g->path_len) return false;
+    
+    GameState layout;
+    memset(&layout, 0, sizeof(layout));
+    size_t size = state_layout(&layout, &cfg);
+    g->head_at = malloc(players * sizeof(int));
+    Position *body = malloc(length * sizeof(Position));
+    if (!g->head_at || !body || posix_memalign(&g->arena, 64, size) != 0) {
+        free(body);
+        return false;
+    }
+    memset(g->arena, 0, size);
+    memcpy(g->arena, &layout, sizeof(layout));
+    g_state = g->arena;
+    state_bind();
+    
+    srand(1);
+    game_init();
+    
+    int spacing = g->path_len / players;
+    for (int p = 0; p < players; p++) {
+        for (int i = 0; i < length; i++) {
+            body[i] = path_cell(p * spacing + i);
+        }
+        Player *pl = &g_players[slot_alloc()];
+        pl->id = g_state->next_player_id++;
+        snprintf(pl->name, MAX_NAME_LEN, "bench_%04d", p % 10000);
+        place_snake(pl, body, length,
+                    length > 1 ? step_dir(body[length - 2], body[length - 1]) : DIR_RIGHT);
+        g_snakes[p].spawn_protection = 0;
+        g->head_at[p] = p * spacing + length - 1;
+    }
+    free(body);
+    g->players = players;
+    return true;
+}
+
+static void arena_free(GameCtx *g) {
+    free(g->arena);
+    free(g->head_at);
+}
+
+/* Point every snake at the next path cell, and consume the dirty list as
+ * the publisher would */
+static void steer(void *p) {
+    GameCtx *g = p;
+    for (int i = 0; i < g->players; i++) {
+        Position head = path_cell(g->head_at[i]);
+        Position next = path_cell((g->head_at[i] + 1) % g->path_len);
+        g_snakes[i].pending_dir = step_dir(head, next);
+    }
+    for (int i = 0; i < g_state->dirty_count; i++) {
+        g_grid[g_dirty[i]].dirty = false;
+    }
+    g_state->dirty_count = 0;
+}
+
+static void advance_all(GameCtx *g) {
+    for (int i = 0; i < g->players; i++) {
+        move_snake(&g_players[i]);
+        g->head_at[i] = (g->head_at[i] + 1) % g->path_len;
+    }
+}
+
+/* Steer and step every snake so the collision pass has new heads to resolve */
+static void steer_and_move(void *p) {
+    steer(p);
+    advance_all(p);
+}
+
+static void run_move(void *p) {
+    advance_all(p);
+}
+
+static void run_collide(void *p) {
+    (void)p;
+    check_collisions();
+}
+
+static void run_rle_encode(void *p) {
+    GameCtx *g = p;
+    size_t cells = (size_t)g_cfg.grid_size * g_cfg.grid_size;
+    g->rle_len = map_rle_encode(g_map, cells, g->rle);
+    g->sink += g->rle_len;
+}
+
+static void run_rle_decode(void *p) {
+    GameCtx *g = p;
+    size_t cells = (size_t)g_cfg.grid_size * g_cfg.grid_size;
+    g->sink += map_rle_decode(g->rle, g->rle_len, g->cells, cells);
+}
+
+static void bench_game(int grid) {
+    size_t cells = (size_t)grid * grid;
+    unsigned char *rle = malloc(MAP_RLE_MAX_BYTES(cells));
+    MapCell *decoded = malloc(cells * sizeof(MapCell));
+    if (!rle || !decoded) return;
+    
+    g_game_quiet = true;
+    for (size_t li = 0; li < sizeof(k_snake_lengths) / sizeof(k_snake_lengths[0]); li++) {
+        for (size_t pi = 0; pi < sizeof(k_player_counts) / sizeof(k_player_counts[0]); pi++) {
+            int players = k_player_counts[pi], length = k_snake_lengths[li];
+            GameCtx g;
+            memset(&g, 0, sizeof(g));
+            g.rle = rle;
+            g.cells = decoded;
+            if (!arena_create(&g, grid, players, length)) {
+                arena_free(&g);
+                continue;
+            }
+            
+            char params[32];
+            snprintf(params, sizeof(params), "%d x len %d", players, length);
+            
+            Kernel k = { steer, run_move, &g, players, 0 };
+            KernelResult r = measure(&k);
+            report("move_snake", params, &r);
+            
+            k = (Kernel){ steer_and_move, run_collide, &g, players, 0 };
+            r = measure(&k);
+            report("check_collisions", params, &r);
+            
+            k = (Kernel){ NULL, run_rle_encode, &g, 1, (double)(cells * sizeof(MapCell)) };
+            r = measure(&k);
+            report("map_rle_encode", params, &r);
+            
+            k.run = run_rle_decode;
+            r = measure(&k);
+            report("map_rle_decode", params, &r);
+            
+            arena_free(&g);
+        }
+    }
+    
+    free(rle);
+    free(decoded);
+}
+
+/* ============================================================================
+ * Main
+ * ============================================================================ */
+
+int main(int argc, char *argv[]) {
+    int grid = MAX_GRID_SIZE;
+    
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--grid") == 0) {
+            grid = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--reps") == 0) {
+            g_reps = atoi(argv[i + 1]);
+        }
+    }
+    if (grid < MIN_GRID_SIZE || grid > MAX_GRID_SIZE || g_reps < 1 || g_reps > 64) {
+        fprintf(stderr, "Usage: %s [--grid %d-%d] [--reps 1-64]\n",
+                argv[0], MIN_GRID_SIZE, MAX_GRID_SIZE);
+        return 1;
+    }
+    
+    printf("Kernels: median of %d samples of >= %llu ms, %s checksum kernel, %dx%d grid\n\n",
+           g_reps, (unsigned long long)(SAMPLE_NS / 1000000), proto_kernel_name(), grid, grid);
+    printf("%-20s %-22s %12s %12s %10s\n", "kernel", "case", "ns/op", "cycles/op", "MB/s");
+    
+    calibrate_timer();
+    bench_proto();
+    bench_game(grid);
+    return 0;
+}
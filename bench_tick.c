@@ -0,0 +1,192 @@
+/**
+ * bench_tick.c - Game Tick Benchmark
+ *
+ * Times game_tick() on synthetic arenas for a range of player counts and tick
+ * thread counts, and checks that every threaded run ends in exactly the same
+ * state as the serial one.
+ *
+ * Usage: ./bench_tick [--grid N] [--ticks N] [--threads MAX]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "game.h"
+
+static const int k_player_counts[] = { 10, 50, 100, 250, 500, 1000 };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Input generator, independent of rand() so game logic sees the same
+ * sequence in every run */
+static uint32_t xorshift(uint32_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Fresh arena with `players` snakes, bound as the current one */
+static void *arena_create(const GameConfig *cfg, int players) {
+    GameState layout;
+    memset(&layout, 0, sizeof(layout));
+    size_t size = state_layout(&layout, cfg);
+    
+    void *mem;
+    if (posix_memalign(&mem, 64, size) != 0) return NULL;
+    memset(mem, 0, size);
+    memcpy(mem, &layout, sizeof(layout));
+    g_state = mem;
+    state_bind();
+    
+    srand(1);
+    game_init();
+    for (int p = 0; p < players; p++) {
+        Player *pl = &g_players[slot_alloc()];
+        pl->id = g_state->next_player_id++;
+        snprintf(pl->name, MAX_NAME_LEN, "bench_%04d", p % 10000);
+        
+        int x, y;
+        find_spawn_pos(&x, &y);
+        init_snake(pl, x, y);
+    }
+    return mem;
+}
+
+typedef struct {
+    double avg_us;
+    double p99_us;
+    uint64_t hash;
+} RunResult;
+
+static int run(const GameConfig *cfg, int players, int threads, int ticks, RunResult *out) {
+    void *mem = arena_create(cfg, players);
+    if (!mem) return -1;
+    if (game_threads_start(threads) < 0 || game_threads() != threads) {
+        free(mem);
+        return -1;
+    }
+    
+    uint64_t *samples = malloc(ticks * sizeof(uint64_t));
+    uint32_t seed = 12345;
+    uint64_t hash = 14695981039346656037ULL;
+    uint64_t total = 0;
+    
+    for (int t = 0; t < ticks; t++) {
+        /* Each snake turns now and then */
+        for (int p = 0; p < players; p++) {
+            if (xorshift(&seed) % 4 == 0) {
+                g_snakes[p].pending_dir = xorshift(&seed) % 4;
+            }
+        }
+        if (t % 30 == 0 && g_state->food_count < MAX_FOOD / 2) {
+            spawn_food();
+        }
+        
+        uint64_t start = now_ns();
+        game_tick();
+        samples[t] = now_ns() - start;
+        total += samples[t];
+        
+        /* Stand in for the publisher: record and consume the dirty list */
+        hash = fnv(hash, g_dirty, g_state->dirty_count * sizeof(uint16_t));
+        for (int i = 0; i < g_state->dirty_count; i++) {
+            g_grid[g_dirty[i]].dirty = false;
+        }
+        g_state->dirty_count = 0;
+    }
+    game_threads_stop();
+    
+    size_t cells = (size_t)cfg->grid_size * cfg->grid_size;
+    hash = fnv(hash, g_map, cells * sizeof(MapCell));
+    hash = fnv(hash, g_grid, cells * sizeof(GridCell));
+    hash = fnv(hash, g_snakes, cfg->max_players * sizeof(Snake));
+    hash = fnv(hash, g_players, cfg->max_players * sizeof(Player));
+    hash = fnv(hash, g_bodies, (size_t)cfg->max_players * cfg->max_snake_len * sizeof(Position));
+    hash = fnv(hash, g_state->foods, sizeof(g_state->foods));
+    hash = fnv(hash, g_free_cells, g_state->free_cell_count * sizeof(uint16_t));
+    hash = fnv(hash, g_clear_blocks, g_state->clear_count * sizeof(uint16_t));
+    
+    qsort(samples, ticks, sizeof(uint64_t), cmp_u64);
+    out->avg_us = total / 1000.0 / ticks;
+    out->p99_us = samples[(size_t)ticks * 99 / 100] / 1000.0;
+    out->hash = hash;
+    
+    free(samples);
+    free(mem);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    GameConfig cfg = {
+        .grid_size = 200,
+        .max_players = MAX_PLAYERS_LIMIT,
+        .max_snake_len = DEFAULT_MAX_SNAKE_LEN,
+        .max_delta_cells = MAX_DELTA_CELLS
+    };
+    int ticks = 2000;
+    int max_threads = 4;
+    
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--grid") == 0) {
+            cfg.grid_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--ticks") == 0) {
+            ticks = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            max_threads = atoi(argv[i + 1]);
+        }
+    }
+    if (cfg.grid_size < MIN_GRID_SIZE || cfg.grid_size > MAX_GRID_SIZE || ticks < 1 ||
+        max_threads < 1 || max_threads > MAX_TICK_THREADS) {
+        fprintf(stderr, "Usage: %s [--grid %d-%d] [--ticks N] [--threads 1-%d]\n",
+                argv[0], MIN_GRID_SIZE, MAX_GRID_SIZE, MAX_TICK_THREADS);
+        return 1;
+    }
+    
+    g_game_quiet = true;
+    printf("game_tick: %dx%d grid, %d ticks per run\n\n", cfg.grid_size, cfg.grid_size, ticks);
+    printf("%8s %8s %10s %10s %8s  %s\n", "players", "threads", "avg_us", "p99_us", "speedup", "state");
+    
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(k_player_counts) / sizeof(k_player_counts[0]); i++) {
+        int players = k_player_counts[i];
+        RunResult serial = { 0 };
+        
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            RunResult r;
+            if (run(&cfg, players, threads, ticks, &r) < 0) {
+                fprintf(stderr, "run with %d threads failed\n", threads);
+                return 1;
+            }
+            if (threads == 1) serial = r;
+            
+            bool same = r.hash == serial.hash;
+            failed |= !same;
+            printf("%8d %8d %10.2f %10.2f %7.2fx  %s\n", players, threads, r.avg_us,
+                   r.p99_us, serial.avg_us / r.avg_us,
+                   threads == 1 ? "reference" : same ? "identical" : "MISMATCH");
+        }
+    }
+    
+    return failed;
+}
@@ -0,0 +1,141 @@
+/**
+ * bot.c - Server-Side Bots
+ *
+ * Bots are ordinary players with no connection behind them: the game loop
+ * adds and removes them and sets their pending_dir before each tick. All
+ * bots of an arena steer by one distance field, a breadth-first search from
+ * every food cell over the free cells, computed once per tick; each bot then
+ * just looks at the cells next to its head. The cost is O(cells + bots) a
+ * tick however many bots there are.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+#define BOT_UNREACHABLE  0xFFFF
+
+/* Scratch space for the distance field, grown to the largest arena seen */
+static uint16_t *g_bot_dist;      /* Steps to the nearest food, per cell */
+static uint16_t *g_bot_queue;
+static size_t g_bot_cells;
+
+static const int k_dx[4] = { 0, 0, -1, 1 };   /* DIR_UP, DIR_DOWN, DIR_LEFT, DIR_RIGHT */
+static const int k_dy[4] = { -1, 1, 0, 0 };
+static const uint8_t k_opposite[4] = { DIR_DOWN, DIR_UP, DIR_RIGHT, DIR_LEFT };
+
+/* A head can go there this tick: no wall and no snake */
+static bool cell_open(int idx) {
+    return g_grid[idx].snakes == 0 && g_map[idx] != CELL_WALL;
+}
+
+static int cell_step(int idx, int dir) {
+    return idx + k_dy[dir] * g_cfg.grid_size + k_dx[dir];
+}
+
+/* Multi-source BFS from the food. Walls ring the map, so the neighbours of
+ * an open cell are always on it. */
+static bool build_distance_field(void) {
+    size_t cells = (size_t)g_cfg.grid_size * g_cfg.grid_size;
+    if (cells > g_bot_cells) {
+        uint16_t *dist = realloc(g_bot_dist, cells * sizeof(uint16_t));
+        if (dist) g_bot_dist = dist;
+        uint16_t *queue = realloc(g_bot_queue, cells * sizeof(uint16_t));
+        if (queue) g_bot_queue = queue;
+        if (!dist || !queue) return false;
+        g_bot_cells = cells;
+    }
+    
+    memset(g_bot_dist, 0xFF, cells * sizeof(uint16_t));
+    int head = 0, tail = 0;
+    for (int i = 0; i < MAX_FOOD; i++) {
+        if (!g_state->foods[i].active) continue;
+        int idx = g_state->foods[i].pos.y * g_cfg.grid_size + g_state->foods[i].pos.x;
+        if (g_bot_dist[idx] == 0) continue;
+        g_bot_dist[idx] = 0;
+        g_bot_queue[tail++] = idx;
+    }
+    
+    while (head < tail) {
+        int idx = g_bot_queue[head++];
+        uint16_t next = g_bot_dist[idx] + 1;
+        for (int d = 0; d < 4; d++) {
+            int n = cell_step(idx, d);
+            if (g_bot_dist[n] != BOT_UNREACHABLE || !cell_open(n)) continue;
+            g_bot_dist[n] = next;
+            g_bot_queue[tail++] = n;
+        }
+    }
+    return true;
+}
+
+/* Lowest score wins: distance to food, dead ends last, then going straight
+ * over turning (the side a bot prefers alternates by slot) */
+static void steer_bot(int slot) {
+    Snake *s = &g_snakes[slot];
+    int n = g_cfg.grid_size;
+    
+    /* Spawn protection lets a snake run onto the wall: nothing to steer by */
+    if (s->head.x <= 0 || s->head.x >= n - 1 || s->head.y <= 0 || s->head.y >= n - 1) return;
+    int head = s->head.y * n + s->head.x;
+    uint32_t best_score = UINT32_MAX;
+    int best = -1;
+    
+    for (int d = 0; d < 4; d++) {
+        if (d == k_opposite[s->direction]) continue;
+        int idx = cell_step(head, d);
+        if (!cell_open(idx)) continue;
+        
+        int exits = 0;
+        for (int e = 0; e < 4; e++) {
+            exits += cell_open(cell_step(idx, e));
+        }
+        uint32_t score = g_bot_dist[idx] + (exits == 0 ? 0x20000u : 0);
+        score = score * 4 + (d == s->direction ? 0 : 1 + ((slot + d) & 1));
+        if (score < best_score) {
+            best_score = score;
+            best = d;
+        }
+    }
+    
+    /* Boxed in: keep going and take what comes */
+    if (best >= 0) {
+        __atomic_store_n(&s->pending_dir, (uint8_t)best, __ATOMIC_RELAXED);
+    }
+}
+
+/* Set the next move of the live bots among `slots` */
+void bots_steer(const uint16_t *slots, int count) {
+    if (count == 0 || !build_distance_field()) return;
+    
+    for (int i = 0; i < count; i++) {
+        if (g_snakes[slots[i]].alive) steer_bot(slots[i]);
+    }
+}
+
+/* Take a free slot for a new bot and spawn it. Returns the slot, or -1 if
+ * the arena is full. */
+int bot_add(void) {
+    int slot = slot_alloc();
+    if (slot < 0) return -1;
+    
+    Player *p = &g_players[slot];
+    memset(p, 0, sizeof(Player));
+    p->id = g_state->next_player_id++;
+    snprintf(p->name, MAX_NAME_LEN, "bot_%u", p->id);
+    p->color = (slot % NUM_COLORS) + 1;
+    p->is_ai = true;
+    p->is_bot = true;
+    
+    int spawn_x, spawn_y;
+    find_spawn_pos(&spawn_x, &spawn_y);
+    init_snake(p, spawn_x, spawn_y);
+    return slot;
+}
+
+void bot_remove(int slot) {
+    kill_snake(&g_players[slot]);
+    slot_free(slot);
+}
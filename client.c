@@ -5,30 +5,36 @@
  * - ncurses UI with game board and chat window
  * - Customizable key bindings
  * - Real-time chat
- * - Stress test mode (100 AI clients)
  * 
  * Threads:
  * - Main thread: ncurses rendering, keyboard input
  * - Receiver thread: receive packets from server
  * - Heartbeat thread: keep-alive
+ *
+ * With --replay FILE it plays back a server recording instead, offline.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
+#include <poll.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <ncurses.h>
 #include <errno.h>
+#include <zlib.h>
 
 #include "common.h"
 #include "proto.h"
+#include "game.h"
+#include "replay.h"
 
 /* ============================================================================
  * Global State
@@ -41,11 +47,70 @@ static uint32_t g_my_id = 0;
 static int g_my_slot = -1;
 static char g_my_name[MAX_NAME_LEN] = "Player";
 static uint8_t g_my_color = 1;
+static int g_my_arena = 0;
+static uint8_t g_compression = COMPRESS_ZLIB;   /* Methods offered at login */
+static int g_spectate = -1;   /* Arena watched with --spectate, -1 to play */
 
-/* Map state (received from server) */
-static MapUpdate g_map_state;
+/* Replay playback (--replay FILE) */
+static Replay *g_replay = NULL;
+static int g_replay_speed = 1;       /* Ticks per GAME_TICK_MS */
+static int g_replay_paused = 0;
+
+/* UDP channel, opened when the server answers OP_UDP_REQUEST */
+static int g_want_udp = 1;
+static int g_udp_fd = -1;
+static volatile int g_udp_active = 0;   /* Frames arrive over UDP: so do moves */
+static UdpInput g_udp_input;            /* Next OP_UDP_INPUT */
+static pthread_mutex_t g_udp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t g_udp_thread;
+
+/* One scoreboard slot: identity from OP_PLAYER_JOIN, score from map frames */
+typedef struct {
+    bool active;
+    uint32_t id;
+    uint8_t color;
+    char name[MAX_NAME_LEN];
+    int32_t score;
+    uint8_t alive;
+} RosterEntry;
+
+/* Map state (received from server, sized from the login response) */
+static int g_grid_w = 0;
+static int g_grid_h = 0;
+static int g_max_players = 0;
+static uint32_t g_map_tick = 0;
+static MapCell *g_map_cells = NULL;   /* g_grid_w * g_grid_h, row-major */
+static RosterEntry *g_roster = NULL;  /* Scoreboard, indexed by slot */
+static int g_have_map = 0;        /* Set once a full snapshot arrived */
+static int g_resync_pending = 0;  /* Snapshot requested, ignore deltas */
 static pthread_mutex_t g_map_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Interest management (big arenas): only the region of the last
+ * OP_VIEW_DELTA is current, the rest is summed up by the minimap */
+static int g_region_x = 0, g_region_y = 0, g_region_w = 0, g_region_h = 0;
+static int g_region_head_x = -1, g_region_head_y = -1;   /* Centre of the region */
+static uint8_t *g_minimap = NULL;     /* g_minimap_cols * g_minimap_rows */
+static int g_minimap_cols = 0;
+static int g_minimap_rows = 0;
+static uint32_t g_minimap_tick = 0;   /* 0 until the first OP_MINIMAP */
+
+/* Client-side prediction: my snake is drawn one tick ahead of the map with
+ * the newest move applied, so a key shows at once. Each tick the head is
+ * found again in the authoritative map and the prediction rebuilt on it.
+ * All under g_map_lock. */
+static int g_want_predict = 1;
+static Position g_pred_head = { -1, -1 };   /* Authoritative head, x < 0 if unknown */
+static int g_pred_dir = -1;          /* Direction it came in with, -1 if unknown */
+static int g_pred_cells = 0;         /* My cells on the map */
+static int g_pred_gained = 0;        /* Cells that became mine this tick */
+static Position g_pred_gain;         /* The last of them */
+static Position *g_pred_trail = NULL;   /* Past heads, newest at g_pred_trail_pos */
+static int g_pred_trail_len = 0;
+static int g_pred_trail_pos = 0;
+static int g_pred_want = -1;         /* Newest move of this life, -1 for none */
+static uint32_t g_pred_want_seq = 0;    /* Its input_seq */
+static InputAck g_input_ack;         /* Newest move a tick applied, and that tick */
+
 /* Chat state */
 static ChatRecv g_chat_messages[MAX_CHAT_HISTORY];
 static int g_chat_count = 0;
@@ -59,19 +124,29 @@ static int g_chat_input_len = 0;
 /* Key bindings */
 static int g_keys[4] = { KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT };
 
+/* Part of the arena on screen; follows my snake when the arena is bigger */
+#define VIEW_SIZE 50
+static int g_view_w = 0;
+static int g_view_h = 0;
+static int g_view_x = 0;
+static int g_view_y = 0;
+static int g_chat_lines = 0;
+
+/* Renderer: the map copy being drawn, and what each view cell shows now */
+static MapCell *g_frame = NULL;        /* g_grid_w * g_grid_h */
+static chtype g_drawn[VIEW_SIZE * VIEW_SIZE];
+static uint32_t g_drawn_tick = 0;
+static int g_drawn_slot = -1;
+static int g_drawn_head = -1;          /* Predicted cells in the last frame */
+static int g_drawn_tail = -1;
+
 /* ncurses windows */
 static WINDOW *g_game_win = NULL;
 static WINDOW *g_chat_win = NULL;
 static WINDOW *g_status_win = NULL;
 static WINDOW *g_input_win = NULL;
 static WINDOW *g_score_win = NULL;
-
-/* Stress test mode */
-static int g_stress_mode = 0;
-static long g_total_rtt = 0;
-static long g_total_requests = 0;
-static long g_successful_connections = 0;
-static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static WINDOW *g_minimap_win = NULL;   /* Only if the arena does not fit the view */
 
 /* ============================================================================
  * Utility
@@ -81,6 +156,150 @@ static void msleep(int ms) {
     usleep(ms * 1000);
 }
 
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Buffers for a g_grid_w x g_grid_h arena of g_max_players */
+static int alloc_map(void) {
+    g_map_cells = calloc((size_t)g_grid_w * g_grid_h, sizeof(MapCell));
+    g_frame = calloc((size_t)g_grid_w * g_grid_h, sizeof(MapCell));
+    g_roster = calloc(g_max_players, sizeof(RosterEntry));
+    g_minimap_cols = (g_grid_w + VIEW_TILE - 1) / VIEW_TILE;
+    g_minimap_rows = (g_grid_h + VIEW_TILE - 1) / VIEW_TILE;
+    g_minimap = calloc((size_t)g_minimap_cols * g_minimap_rows, 1);
+    g_pred_trail = calloc((size_t)g_grid_w * g_grid_h, sizeof(Position));
+    if (!g_map_cells || !g_frame || !g_roster || !g_minimap || !g_pred_trail) {
+        perror("calloc");
+        return -1;
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * Client-Side Prediction
+ *
+ * The server stays authoritative: moves go out as before, and the map is only
+ * ever what the server sent. The prediction is an overlay on it, one cell for
+ * the head and one for the tail, stepped with the server's own snake_turn()
+ * and snake_step(). Every move is numbered, and the server acks the newest
+ * one a tick applied with the first map tick showing it (OP_INPUT_ACK over
+ * TCP, UdpFrameHeader over UDP). Reconciling is then rebuilding the
+ * prediction on each authoritative tick: acked moves are already in the map
+ * and are dropped, the newest unacked one is applied on top. A move pending
+ * when the snake respawned is acked too, as the server drops it.
+ * ============================================================================ */
+
+/* Caller must hold g_map_lock */
+static void predict_reset(void) {
+    g_pred_head.x = g_pred_head.y = -1;
+    g_pred_dir = -1;
+    g_pred_trail_len = 0;
+    g_pred_gained = 0;
+    g_pred_cells = 0;
+    if (g_my_slot < 0) return;
+    
+    MapCell mine = CELL_SNAKE_BASE + g_my_slot;
+    for (size_t i = 0; i < (size_t)g_grid_w * g_grid_h; i++) {
+        g_pred_cells += g_map_cells[i] == mine;
+    }
+}
+
+/* Set a map cell from a delta, keeping count of my cells. Caller must hold
+ * g_map_lock. */
+static void set_cell(int x, int y, MapCell cell) {
+    MapCell *c = &g_map_cells[y * g_grid_w + x];
+    if (g_my_slot >= 0) {
+        MapCell mine = CELL_SNAKE_BASE + g_my_slot;
+        if (*c == mine && cell != mine) {
+            g_pred_cells--;
+        } else if (*c != mine && cell == mine) {
+            g_pred_cells++;
+            g_pred_gained++;
+            g_pred_gain.x = x;
+            g_pred_gain.y = y;
+        }
+    }
+    *c = cell;
+}
+
+/* Take an ack, and drop the pending move once the map shows it. Caller
+ * must hold g_map_lock. */
+static void predict_ack(const InputAck *ack) {
+    if (ack && ack->input_seq > g_input_ack.input_seq) {
+        g_input_ack = *ack;
+    }
+    if (g_pred_want >= 0 && g_pred_want_seq <= g_input_ack.input_seq &&
+        g_map_tick >= g_input_ack.tick) {
+        g_pred_want = -1;
+    }
+}
+
+/* A tick was applied: find my head again. A moving snake gains exactly one
+ * cell a tick, its new head; anything else is a death, a respawn or a head
+ * running into the cell its tail just left, and the head is lost until the
+ * next plain move. Caller must hold g_map_lock. */
+static void predict_tick(void) {
+    int gained = g_pred_gained;
+    g_pred_gained = 0;
+    predict_ack(NULL);
+    if (g_my_slot < 0) return;
+    
+    if (gained != 1 || g_pred_cells == 0) {
+        g_pred_head.x = g_pred_head.y = -1;
+        g_pred_dir = -1;
+        g_pred_trail_len = 0;
+        return;
+    }
+    
+    int dx = g_pred_gain.x - g_pred_head.x, dy = g_pred_gain.y - g_pred_head.y;
+    if (g_pred_head.x < 0 || abs(dx) + abs(dy) != 1) {
+        g_pred_dir = -1;
+        g_pred_trail_len = 0;
+    } else {
+        g_pred_dir = dx < 0 ? DIR_LEFT : dx > 0 ? DIR_RIGHT : dy < 0 ? DIR_UP : DIR_DOWN;
+    }
+    
+    int cap = g_grid_w * g_grid_h;
+    g_pred_trail_pos = (g_pred_trail_pos + 1) % cap;
+    g_pred_trail[g_pred_trail_pos] = g_pred_gain;
+    if (g_pred_trail_len < cap) g_pred_trail_len++;
+    g_pred_head = g_pred_gain;
+}
+
+/* A move was sent. Caller must hold g_map_lock. */
+static void predict_move(uint8_t direction, uint32_t input_seq) {
+    g_pred_want = direction;
+    g_pred_want_seq = input_seq;
+}
+
+/* Where my snake will be next tick: the map cell its head enters and the
+ * one its tail leaves (-1 if it grows or the end is not known). Returns -1
+ * when there is nothing to predict, or the head would hit something -- what
+ * happens then is the server's call. Caller must hold g_map_lock. */
+static int predict_next(int *tail) {
+    *tail = -1;
+    if (!g_want_predict || g_my_slot < 0 || g_pred_dir < 0) return -1;
+    
+    uint8_t dir = g_pred_want >= 0 ? snake_turn(g_pred_dir, g_pred_want) : g_pred_dir;
+    Position next = snake_step(g_pred_head, dir);
+    if (next.x < 0 || next.x >= g_grid_w || next.y < 0 || next.y >= g_grid_h) return -1;
+    
+    int idx = next.y * g_grid_w + next.x;
+    if (g_map_cells[idx] == CELL_FOOD) return idx;
+    if (g_map_cells[idx] != CELL_EMPTY) return -1;
+    
+    if (g_pred_cells > 0 && g_pred_trail_len >= g_pred_cells) {
+        int cap = g_grid_w * g_grid_h;
+        Position end = g_pred_trail[(g_pred_trail_pos - (g_pred_cells - 1) + cap) % cap];
+        int end_idx = end.y * g_grid_w + end.x;
+        if (g_map_cells[end_idx] == CELL_SNAKE_BASE + g_my_slot) *tail = end_idx;
+    }
+    return idx;
+}
+
 /* ============================================================================
  * Network
  * ============================================================================ */
@@ -110,6 +329,10 @@ static int connect_to_server(const char *host, int port) {
         return -1;
     }
     
+    /* Moves are a few bytes each: send them as they happen */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
     return fd;
 }
 
@@ -118,41 +341,102 @@ static int do_login(int fd, const char *name, bool is_ai) {
     memset(&req, 0, sizeof(req));
     strncpy(req.name, name, MAX_NAME_LEN - 1);
     req.is_ai = is_ai;
+    req.compression = g_compression;
+    req.view_size = VIEW_SIZE;
     
-    if (send_packet(fd, OP_LOGIN_REQ, &req, sizeof(req)) < 0) {
+    /* Spectators get the whole arena: they scroll over it themselves */
+    SpectateRequest spec = {
+        .arena = g_spectate,
+        .compression = g_compression
+    };
+    if ((g_spectate >= 0 ? send_packet(fd, OP_SPECTATE, &spec, sizeof(spec)) :
+                           send_packet(fd, OP_LOGIN_REQ, &req, sizeof(req))) < 0) {
         return -1;
     }
     
     uint16_t opcode;
-    void *payload = NULL;
+    unsigned char payload[256];
     uint32_t len;
     
-    if (recv_packet(fd, &opcode, &payload, &len) < 0) {
+    if (recv_packet_into(fd, &opcode, payload, sizeof(payload), &len) < 0) {
         return -1;
     }
     
     if (opcode == OP_ERROR) {
-        fprintf(stderr, "Login error: %s\n", (char *)payload);
-        free(payload);
+        fprintf(stderr, "Login error: %.*s\n", (int)len, (char *)payload);
         return -1;
     }
     
-    if (opcode != OP_LOGIN_RESP || len < sizeof(LoginResponse)) {
-        free(payload);
+    /* `arena` is optional: single-arena servers may leave it out */
+    if (opcode != OP_LOGIN_RESP || len < offsetof(LoginResponse, arena)) {
         return -1;
     }
     
     LoginResponse *resp = (LoginResponse *)payload;
+    if (resp->grid_width < MIN_GRID_SIZE || resp->grid_width > MAX_GRID_SIZE ||
+        resp->grid_height < MIN_GRID_SIZE || resp->grid_height > MAX_GRID_SIZE ||
+        resp->max_players == 0 || resp->max_players > MAX_PLAYERS_LIMIT) {
+        fprintf(stderr, "Unsupported arena %ux%u, %u players\n",
+                resp->grid_width, resp->grid_height, resp->max_players);
+        return -1;
+    }
+    
     g_my_id = resp->player_id;
     g_my_color = resp->color;
+    g_my_arena = len > offsetof(LoginResponse, arena) ? resp->arena : 0;
+    g_grid_w = resp->grid_width;
+    g_grid_h = resp->grid_height;
+    g_max_players = resp->max_players;
     
-    free(payload);
-    return 0;
+    return alloc_map();
+}
+
+/* Number a new move and keep it for the next OP_UDP_INPUTs. Moves sent over
+ * TCP are numbered too, so the server sees one sequence whichever way they
+ * go. Caller must hold g_udp_lock. */
+static uint32_t push_input(uint8_t direction) {
+    memmove(&g_udp_input.inputs[1], &g_udp_input.inputs[0], UDP_INPUT_REDUNDANCY - 1);
+    g_udp_input.inputs[0] = direction;
+    return ++g_udp_input.input_seq;
+}
+
+/* Send an OP_UDP_INPUT carrying `direction` as a new move (or none if it is
+ * negative) along with the last few moves and the newest map tick we hold.
+ * Returns the input_seq sent. */
+static uint32_t send_udp_input(int direction, uint32_t ack_tick) {
+    unsigned char frame[sizeof(PacketHeader) + sizeof(UdpInput)];
+    
+    pthread_mutex_lock(&g_udp_lock);
+    if (direction >= 0) {
+        push_input(direction);
+    }
+    if (ack_tick > g_udp_input.ack_tick) {
+        g_udp_input.ack_tick = ack_tick;
+    }
+    size_t n = encode_packet(frame, OP_UDP_INPUT, &g_udp_input, sizeof(g_udp_input));
+    uint32_t input_seq = g_udp_input.input_seq;
+    pthread_mutex_unlock(&g_udp_lock);
+    
+    send(g_udp_fd, frame, n, MSG_DONTWAIT);
+    return input_seq;
 }
 
 static void send_move(uint8_t direction) {
-    MoveCommand cmd = { .direction = direction };
-    send_packet(g_socket_fd, OP_MOVE, &cmd, sizeof(cmd));
+    uint32_t input_seq;
+    if (g_udp_active) {
+        input_seq = send_udp_input(direction, 0);
+    } else {
+        pthread_mutex_lock(&g_udp_lock);
+        input_seq = push_input(direction);
+        pthread_mutex_unlock(&g_udp_lock);
+        
+        MoveCommand cmd = { .direction = direction, .input_seq = input_seq };
+        send_packet(g_socket_fd, OP_MOVE, &cmd, sizeof(cmd));
+    }
+    
+    pthread_mutex_lock(&g_map_lock);
+    predict_move(direction, input_seq);
+    pthread_mutex_unlock(&g_map_lock);
 }
 
 static void send_chat(const char *text) {
@@ -162,73 +446,377 @@ static void send_chat(const char *text) {
     send_packet(g_socket_fd, OP_CHAT_SEND, &chat, sizeof(chat));
 }
 
+/* ============================================================================
+ * Map State
+ * ============================================================================ */
+
+/* Caller must hold g_map_lock */
+static void apply_player_join(const PlayerJoin *ev) {
+    if (ev->slot >= g_max_players) return;
+    
+    RosterEntry *e = &g_roster[ev->slot];
+    e->active = true;
+    e->id = ev->player_id;
+    e->color = ev->color;
+    memcpy(e->name, ev->name, MAX_NAME_LEN);
+    e->name[MAX_NAME_LEN - 1] = '\0';
+    
+    if (ev->player_id == g_my_id && g_my_slot != ev->slot) {
+        g_my_slot = ev->slot;
+        predict_reset();
+    }
+}
+
+/* Caller must hold g_map_lock */
+static void apply_player_leave(const PlayerLeave *ev) {
+    if (ev->slot >= g_max_players || g_roster[ev->slot].id != ev->player_id) return;
+    memset(&g_roster[ev->slot], 0, sizeof(RosterEntry));
+}
+
+/* Caller must hold g_map_lock */
+static void apply_player_changes(const PlayerChange *players, int count) {
+    for (int i = 0; i < count; i++) {
+        int slot = players[i].slot;
+        if (slot >= g_max_players) continue;
+        g_roster[slot].score = players[i].score;
+        g_roster[slot].alive = players[i].alive;
+    }
+}
+
+/* Replace the map and scoreboard with an OP_MAP_UPDATE payload; the roster
+ * is cleared and refilled by the OP_PLAYER_JOINs that follow. Returns 0 if
+ * it is malformed (the map is then unusable until the next snapshot).
+ * Caller must hold g_map_lock. */
+static int apply_map_update(const void *payload, uint32_t len) {
+    const MapUpdateHeader *hdr = (const MapUpdateHeader *)payload;
+    if (len < sizeof(MapUpdateHeader) ||
+        hdr->width != g_grid_w || hdr->height != g_grid_h) return 0;
+    
+    const unsigned char *rle = (const unsigned char *)(hdr + 1);
+    uint32_t avail = len - sizeof(MapUpdateHeader);
+    if (hdr->map_bytes > avail ||
+        avail - hdr->map_bytes < hdr->player_count * sizeof(PlayerChange)) return 0;
+    
+    if (map_rle_decode(rle, hdr->map_bytes, g_map_cells,
+                       (size_t)g_grid_w * g_grid_h) < 0) return 0;
+    
+    memset(g_roster, 0, g_max_players * sizeof(RosterEntry));
+    g_my_slot = -1;
+    predict_reset();
+    apply_player_changes((const PlayerChange *)(rle + hdr->map_bytes), hdr->player_count);
+    
+    g_map_tick = hdr->tick;
+    return 1;
+}
+
+/* Apply an OP_MAP_DELTA payload on top of the map. Returns 0 if the delta
+ * does not follow the tick we hold (or is malformed) and a snapshot is needed.
+ * Caller must hold g_map_lock. */
+static int apply_map_delta(const void *payload, uint32_t len) {
+    if (!g_have_map || g_resync_pending || len < sizeof(MapDeltaHeader)) return 0;
+    
+    const MapDeltaHeader *hdr = (const MapDeltaHeader *)payload;
+    uint32_t expected = sizeof(MapDeltaHeader) +
+                        hdr->cell_count * sizeof(CellChange) +
+                        hdr->player_count * sizeof(PlayerChange);
+    if (len < expected) return 0;
+    if (hdr->tick <= g_map_tick) return 1;   /* Already had it over UDP */
+    if (hdr->base_tick != g_map_tick) return 0;
+    
+    const CellChange *cells = (const CellChange *)(hdr + 1);
+    for (int i = 0; i < hdr->cell_count; i++) {
+        if (cells[i].x < g_grid_w && cells[i].y < g_grid_h) {
+            set_cell(cells[i].x, cells[i].y, cells[i].cell);
+        }
+    }
+    
+    apply_player_changes((const PlayerChange *)(cells + hdr->cell_count), hdr->player_count);
+    
+    g_map_tick = hdr->tick;
+    predict_tick();
+    return 1;
+}
+
+/* Apply an OP_VIEW_DELTA payload: clear what left the region, then set the
+ * cells. Returns 0 like apply_map_delta() when a fresh start is needed.
+ * Caller must hold g_map_lock. */
+static int apply_view_delta(const void *payload, uint32_t len) {
+    if (len < sizeof(ViewDeltaHeader)) return 0;
+    
+    const ViewDeltaHeader *hdr = (const ViewDeltaHeader *)payload;
+    uint32_t expected = sizeof(ViewDeltaHeader) +
+                        hdr->cell_count * sizeof(CellChange) +
+                        hdr->player_count * sizeof(PlayerChange);
+    if (len < expected || hdr->x + hdr->w > g_grid_w || hdr->y + hdr->h > g_grid_h) return 0;
+    
+    if (hdr->base_tick == 0) {
+        /* Starting over: the roster and minimap follow */
+        memset(g_map_cells, 0, (size_t)g_grid_w * g_grid_h * sizeof(MapCell));
+        memset(g_roster, 0, g_max_players * sizeof(RosterEntry));
+        g_my_slot = -1;
+        predict_reset();
+        g_have_map = 1;
+        g_resync_pending = 0;
+    } else {
+        if (!g_have_map || g_resync_pending) return 0;
+        if (hdr->tick <= g_map_tick) return 1;
+        if (hdr->base_tick != g_map_tick) return 0;
+        
+        for (int y = g_region_y; y < g_region_y + g_region_h; y++) {
+            for (int x = g_region_x; x < g_region_x + g_region_w; x++) {
+                if (x < hdr->x || x >= hdr->x + hdr->w || y < hdr->y || y >= hdr->y + hdr->h) {
+                    set_cell(x, y, CELL_EMPTY);
+                }
+            }
+        }
+    }
+    g_region_x = hdr->x;
+    g_region_y = hdr->y;
+    g_region_w = hdr->w;
+    g_region_h = hdr->h;
+    g_region_head_x = hdr->head_x;
+    g_region_head_y = hdr->head_y;
+    
+    const CellChange *cells = (const CellChange *)(hdr + 1);
+    for (int i = 0; i < hdr->cell_count; i++) {
+        if (cells[i].x < g_grid_w && cells[i].y < g_grid_h) {
+            set_cell(cells[i].x, cells[i].y, cells[i].cell);
+        }
+    }
+    
+    apply_player_changes((const PlayerChange *)(cells + hdr->cell_count), hdr->player_count);
+    
+    g_map_tick = hdr->tick;
+    predict_tick();
+    return 1;
+}
+
+/* Caller must hold g_map_lock */
+static void apply_minimap(const void *payload, uint32_t len) {
+    const MinimapHeader *hdr = (const MinimapHeader *)payload;
+    if (len < sizeof(MinimapHeader) ||
+        hdr->cols != g_minimap_cols || hdr->rows != g_minimap_rows) return;
+    
+    size_t tiles = (size_t)hdr->cols * hdr->rows;
+    if (len < sizeof(*hdr) + tiles + hdr->player_count * sizeof(PlayerChange)) return;
+    
+    const uint8_t *data = (const uint8_t *)(hdr + 1);
+    memcpy(g_minimap, data, tiles);
+    apply_player_changes((const PlayerChange *)(data + tiles), hdr->player_count);
+    g_minimap_tick = hdr->tick;
+}
+
 /* ============================================================================
  * Receiver Thread
  * ============================================================================ */
 
-static void *receiver_thread(void *arg) {
-    (void)arg;
+/* Caller must hold g_chat_lock */
+static void push_chat_message(const ChatRecv *msg) {
+    if (g_chat_count < MAX_CHAT_HISTORY) {
+        memcpy(&g_chat_messages[g_chat_count], msg, sizeof(ChatRecv));
+        g_chat_count++;
+    } else {
+        memmove(&g_chat_messages[0], &g_chat_messages[1], 
+                sizeof(ChatRecv) * (MAX_CHAT_HISTORY - 1));
+        memcpy(&g_chat_messages[MAX_CHAT_HISTORY - 1], msg, sizeof(ChatRecv));
+    }
+}
+
+/* Caller must hold g_chat_lock */
+static void apply_chat_batch(const unsigned char *payload, uint32_t len) {
+    const ChatBatchHeader *hdr = (const ChatBatchHeader *)payload;
+    const ChatRecv *msgs = (const ChatRecv *)(hdr + 1);
+    
+    if (hdr->missed) {
+        ChatRecv gap;
+        memset(&gap, 0, sizeof(gap));
+        strcpy(gap.sender_name, "SYSTEM");
+        snprintf(gap.text, sizeof(gap.text), "(%u messages missed)", hdr->missed);
+        push_chat_message(&gap);
+    }
     
-    while (g_running && g_connected) {
-        uint16_t opcode;
-        void *payload = NULL;
-        uint32_t len;
+    int count = hdr->count;
+    if ((len - sizeof(*hdr)) / sizeof(ChatRecv) < (uint32_t)count) {
+        count = (len - sizeof(*hdr)) / sizeof(ChatRecv);
+    }
+    for (int i = 0; i < count; i++) {
+        ChatRecv msg = msgs[i];
+        msg.sender_name[MAX_NAME_LEN - 1] = '\0';
+        msg.text[MAX_CHAT_LEN - 1] = '\0';
+        push_chat_message(&msg);
+    }
+}
+
+static void handle_compressed(const unsigned char *payload, uint32_t len);
+static void open_udp_channel(const UdpOffer *offer);
+
+/* Dispatch one packet from the server. `nested` is set for packets that came
+ * out of an OP_COMPRESSED, which may not nest further. */
+static void handle_packet(uint16_t opcode, unsigned char *payload, uint32_t len, int nested) {
+    switch (opcode) {
+        case OP_MAP_UPDATE: {
+            pthread_mutex_lock(&g_map_lock);
+            g_have_map = apply_map_update(payload, len);
+            g_resync_pending = 0;
+            pthread_mutex_unlock(&g_map_lock);
+            break;
+        }
         
-        if (recv_packet(g_socket_fd, &opcode, &payload, &len) < 0) {
-            g_connected = 0;
+        case OP_PLAYER_JOIN: {
+            if (len >= sizeof(PlayerJoin)) {
+                pthread_mutex_lock(&g_map_lock);
+                apply_player_join((const PlayerJoin *)payload);
+                pthread_mutex_unlock(&g_map_lock);
+            }
             break;
         }
         
-        switch (opcode) {
-            case OP_MAP_UPDATE: {
-                if (len >= sizeof(MapUpdate)) {
-                    pthread_mutex_lock(&g_map_lock);
-                    memcpy(&g_map_state, payload, sizeof(MapUpdate));
-                    
-                    /* Find my slot by name */
-                    for (int i = 0; i < MAX_PLAYERS; i++) {
-                        if (g_map_state.active[i] && 
-                            strncmp(g_map_state.names[i], g_my_name, MAX_NAME_LEN) == 0) {
-                            g_my_slot = i;
-                            break;
-                        }
-                    }
-                    pthread_mutex_unlock(&g_map_lock);
-                }
-                break;
+        case OP_PLAYER_LEAVE: {
+            if (len >= sizeof(PlayerLeave)) {
+                pthread_mutex_lock(&g_map_lock);
+                apply_player_leave((const PlayerLeave *)payload);
+                pthread_mutex_unlock(&g_map_lock);
             }
-            
-            case OP_CHAT_RECV: {
-                if (len >= sizeof(ChatRecv)) {
-                    pthread_mutex_lock(&g_chat_lock);
-                    if (g_chat_count < MAX_CHAT_HISTORY) {
-                        memcpy(&g_chat_messages[g_chat_count], payload, sizeof(ChatRecv));
-                        g_chat_count++;
-                    } else {
-                        memmove(&g_chat_messages[0], &g_chat_messages[1], 
-                                sizeof(ChatRecv) * (MAX_CHAT_HISTORY - 1));
-                        memcpy(&g_chat_messages[MAX_CHAT_HISTORY - 1], payload, sizeof(ChatRecv));
-                    }
-                    pthread_mutex_unlock(&g_chat_lock);
-                }
-                break;
+            break;
+        }
+        
+        case OP_COMPRESSED: {
+            if (!nested) {
+                handle_compressed(payload, len);
             }
-            
-            case OP_PLAYER_DIE: {
-                /* Could show death message */
-                break;
+            break;
+        }
+        
+        case OP_MAP_DELTA: {
+            pthread_mutex_lock(&g_map_lock);
+            int applied = apply_map_delta(payload, len);
+            int need_resync = !applied && !g_resync_pending;
+            if (need_resync) {
+                g_resync_pending = 1;
             }
+            pthread_mutex_unlock(&g_map_lock);
             
-            case OP_HEARTBEAT_ACK: {
-                /* Connection is alive */
-                break;
+            if (need_resync) {
+                send_packet(g_socket_fd, OP_MAP_RESYNC, NULL, 0);
+            }
+            break;
+        }
+        
+        case OP_VIEW_DELTA: {
+            pthread_mutex_lock(&g_map_lock);
+            int applied = apply_view_delta(payload, len);
+            int need_resync = !applied && !g_resync_pending;
+            if (need_resync) {
+                g_resync_pending = 1;
             }
+            pthread_mutex_unlock(&g_map_lock);
             
-            default:
-                break;
+            if (need_resync) {
+                send_packet(g_socket_fd, OP_MAP_RESYNC, NULL, 0);
+            }
+            break;
+        }
+        
+        case OP_MINIMAP: {
+            pthread_mutex_lock(&g_map_lock);
+            apply_minimap(payload, len);
+            pthread_mutex_unlock(&g_map_lock);
+            break;
+        }
+        
+        case OP_INPUT_ACK: {
+            if (len >= sizeof(InputAck)) {
+                pthread_mutex_lock(&g_map_lock);
+                predict_ack((const InputAck *)payload);
+                pthread_mutex_unlock(&g_map_lock);
+            }
+            break;
+        }
+        
+        case OP_CHAT_RECV: {
+            if (len >= sizeof(ChatRecv)) {
+                pthread_mutex_lock(&g_chat_lock);
+                push_chat_message((const ChatRecv *)payload);
+                pthread_mutex_unlock(&g_chat_lock);
+            }
+            break;
+        }
+        
+        case OP_CHAT_BATCH: {
+            if (len >= sizeof(ChatBatchHeader)) {
+                pthread_mutex_lock(&g_chat_lock);
+                apply_chat_batch(payload, len);
+                pthread_mutex_unlock(&g_chat_lock);
+            }
+            break;
+        }
+        
+        case OP_PLAYER_DIE: {
+            /* Could show death message */
+            break;
+        }
+        
+        case OP_HEARTBEAT_ACK: {
+            /* Connection is alive */
+            break;
+        }
+        
+        case OP_UDP_OFFER: {
+            if (!nested && len >= sizeof(UdpOffer)) {
+                open_udp_channel((const UdpOffer *)payload);
+            }
+            break;
         }
         
-        if (payload) free(payload);
+        default:
+            break;
+    }
+}
+
+/* Inflate an OP_COMPRESSED payload and dispatch the packets inside */
+static void handle_compressed(const unsigned char *payload, uint32_t len) {
+    static unsigned char raw[MAX_INFLATED_SIZE];
+    
+    if (len < sizeof(CompressedHeader)) return;
+    const CompressedHeader *hdr = (const CompressedHeader *)payload;
+    uLongf raw_len = sizeof(raw);
+    if (hdr->raw_len > sizeof(raw) ||
+        uncompress(raw, &raw_len, payload + sizeof(CompressedHeader),
+                   len - sizeof(CompressedHeader)) != Z_OK ||
+        raw_len != hdr->raw_len) {
+        return;
+    }
+    
+    size_t off = 0;
+    while (off < raw_len) {
+        uint16_t opcode;
+        unsigned char *inner = NULL;
+        uint32_t inner_len;
+        int used = decode_packet(raw + off, raw_len - off, &opcode, &inner, &inner_len);
+        if (used <= 0) break;
+        off += used;
+        handle_packet(opcode, inner, inner_len, 1);
+    }
+}
+
+static void *receiver_thread(void *arg) {
+    (void)arg;
+    
+    static unsigned char recv_buf[READER_BUF_SIZE];
+    PacketReader reader;
+    reader_init(&reader, recv_buf, sizeof(recv_buf));
+    
+    while (g_running && g_connected) {
+        uint16_t opcode;
+        unsigned char *payload = NULL;
+        uint32_t len;
+        
+        if (reader_next(g_socket_fd, &reader, &opcode, &payload, &len, -1) < 0) {
+            g_connected = 0;
+            break;
+        }
+        
+        handle_packet(opcode, payload, len, 0);
     }
     
     return NULL;
@@ -251,6 +839,124 @@ static void *heartbeat_thread(void *arg) {
     return NULL;
 }
 
+/* ============================================================================
+ * UDP Channel
+ * ============================================================================ */
+
+/* Apply the delta frames in an OP_UDP_FRAME in order. A frame we already hold
+ * is skipped whole, roster events included; at a gap the rest is dropped, as
+ * the next datagram starts from our ack again. Caller must hold g_map_lock. */
+static void apply_udp_frame(unsigned char *data, uint32_t len) {
+    struct {
+        uint16_t opcode;
+        unsigned char *payload;
+        uint32_t len;
+    } events[UDP_FRAME_MAX / sizeof(PacketHeader)];
+    int count = 0;
+    
+    if (!g_have_map || g_resync_pending) return;
+    
+    uint32_t off = 0;
+    while (off < len) {
+        uint16_t opcode;
+        unsigned char *payload = NULL;
+        uint32_t plen;
+        int used = decode_packet(data + off, len - off, &opcode, &payload, &plen);
+        if (used <= 0) return;
+        off += used;
+        
+        if (opcode != OP_MAP_DELTA) {
+            if (count < (int)(sizeof(events) / sizeof(events[0]))) {
+                events[count].opcode = opcode;
+                events[count].payload = payload;
+                events[count].len = plen;
+                count++;
+            }
+            continue;
+        }
+        
+        if (plen < sizeof(MapDeltaHeader)) return;
+        const MapDeltaHeader *hdr = (const MapDeltaHeader *)payload;
+        if (hdr->tick <= g_map_tick) {
+            count = 0;
+            continue;
+        }
+        if (hdr->base_tick != g_map_tick) return;
+        
+        for (int i = 0; i < count; i++) {
+            if (events[i].opcode == OP_PLAYER_JOIN && events[i].len >= sizeof(PlayerJoin)) {
+                apply_player_join((const PlayerJoin *)events[i].payload);
+            } else if (events[i].opcode == OP_PLAYER_LEAVE &&
+                       events[i].len >= sizeof(PlayerLeave)) {
+                apply_player_leave((const PlayerLeave *)events[i].payload);
+            }
+        }
+        count = 0;
+        if (!apply_map_delta(payload, plen)) return;
+    }
+}
+
+/* Receives OP_UDP_FRAMEs and acks each one. Until the first arrives the
+ * hello is repeated, in case it was lost. */
+static void *udp_thread(void *arg) {
+    (void)arg;
+    unsigned char buf[sizeof(PacketHeader) + UDP_FRAME_MAX];
+    
+    while (g_running && g_connected) {
+        struct pollfd pfd = { .fd = g_udp_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 250) <= 0) {
+            if (!g_udp_active) send_udp_input(-1, 0);
+            continue;
+        }
+        
+        ssize_t n = recv(g_udp_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        uint16_t opcode;
+        unsigned char *payload = NULL;
+        uint32_t len;
+        if (n <= 0 || decode_packet(buf, n, &opcode, &payload, &len) != n ||
+            opcode != OP_UDP_FRAME || len < sizeof(UdpFrameHeader)) continue;
+        
+        const UdpFrameHeader *fh = (const UdpFrameHeader *)payload;
+        pthread_mutex_lock(&g_map_lock);
+        predict_ack(&fh->ack);
+        apply_udp_frame(payload + sizeof(UdpFrameHeader), len - sizeof(UdpFrameHeader));
+        uint32_t ack = g_have_map && !g_resync_pending ? g_map_tick : 0;
+        pthread_mutex_unlock(&g_map_lock);
+        
+        g_udp_active = 1;
+        send_udp_input(-1, ack);
+    }
+    
+    return NULL;
+}
+
+/* Connect a UDP socket to the offered port on the server's address and start
+ * receiving. Called from the receiver thread. */
+static void open_udp_channel(const UdpOffer *offer) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    if (g_udp_fd >= 0 ||
+        getpeername(g_socket_fd, (struct sockaddr *)&addr, &addr_len) < 0) return;
+    addr.sin_port = htons(offer->port);
+    
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return;
+    }
+    
+    g_udp_input.conn = offer->conn;
+    g_udp_input.token = offer->token;
+    g_udp_fd = fd;
+    if (pthread_create(&g_udp_thread, NULL, udp_thread, NULL) != 0) {
+        close(fd);
+        g_udp_fd = -1;
+        return;
+    }
+    send_udp_input(-1, 0);
+}
+
 /* ============================================================================
  * ncurses UI
  * ============================================================================ */
@@ -283,19 +989,40 @@ static void init_ui(void) {
         init_colors();
     }
     
-    int game_h = GRID_SIZE + 2;
-    int game_w = GRID_SIZE + 2;
+    g_view_w = g_grid_w < VIEW_SIZE ? g_grid_w : VIEW_SIZE;
+    g_view_h = g_grid_h < VIEW_SIZE ? g_grid_h : VIEW_SIZE;
+    
+    int game_w = g_view_w + 2;
     int chat_w = 35;
     int score_h = 15;
+    int game_h = g_view_h + 2;
+    int map_h = 0;
+    if (g_view_w < g_grid_w || g_view_h < g_grid_h) {
+        map_h = (g_minimap_rows + 1) / 2 + 2;   /* Two tile rows per line */
+    }
+    if (game_h < score_h + map_h + 12) game_h = score_h + map_h + 12;   /* Room for the chat */
+    g_chat_lines = game_h - score_h - map_h - 7;
     
-    /* Game window (left) */
-    g_game_win = newwin(game_h, game_w, 0, 0);
+    /* Game window (left); its frame is drawn once, the map by draw_game() */
+    g_game_win = newwin(g_view_h + 2, game_w, 0, 0);
+    box(g_game_win, 0, 0);
+    wattron(g_game_win, COLOR_PAIR(1) | A_BOLD);
+    mvwprintw(g_game_win, 0, 2, " Snake Game ");
+    wattroff(g_game_win, COLOR_PAIR(1) | A_BOLD);
+    for (int i = 0; i < g_view_w * g_view_h; i++) {
+        g_drawn[i] = ' ';
+    }
     
     /* Score window (top right) */
     g_score_win = newwin(score_h, chat_w, 0, game_w + 1);
     
+    /* Minimap (right, under the scores) */
+    if (map_h > 0) {
+        g_minimap_win = newwin(map_h, chat_w, score_h, game_w + 1);
+    }
+    
     /* Chat window (middle right) */
-    g_chat_win = newwin(game_h - score_h - 5, chat_w, score_h, game_w + 1);
+    g_chat_win = newwin(game_h - score_h - map_h - 5, chat_w, score_h + map_h, game_w + 1);
     
     /* Status window (bottom) */
     g_status_win = newwin(2, game_w + chat_w + 1, game_h, 0);
@@ -312,54 +1039,105 @@ static void shutdown_ui(void) {
     if (g_status_win) delwin(g_status_win);
     if (g_input_win) delwin(g_input_win);
     if (g_score_win) delwin(g_score_win);
+    if (g_minimap_win) delwin(g_minimap_win);
     endwin();
 }
 
-static void draw_game(void) {
-    werase(g_game_win);
-    box(g_game_win, 0, 0);
+/* Centre the view on my snake in g_frame, clamped to the arena. With only a
+ * region of the arena known, on the head the region is built around. */
+static void update_view(int my_slot, int head_x, int head_y) {
+    int cx = head_x, cy = head_y;
     
-    wattron(g_game_win, COLOR_PAIR(1) | A_BOLD);
-    mvwprintw(g_game_win, 0, 2, " Snake Game ");
-    wattroff(g_game_win, COLOR_PAIR(1) | A_BOLD);
+    if (cx < 0) {
+        if (my_slot < 0) return;
+        
+        MapCell mine = CELL_SNAKE_BASE + my_slot;
+        long sum_x = 0, sum_y = 0, count = 0;
+        for (int y = 0; y < g_grid_h; y++) {
+            for (int x = 0; x < g_grid_w; x++) {
+                if (g_frame[y * g_grid_w + x] == mine) {
+                    sum_x += x;
+                    sum_y += y;
+                    count++;
+                }
+            }
+        }
+        if (count == 0) return;   /* Respawning: keep the old view */
+        cx = sum_x / count;
+        cy = sum_y / count;
+    }
     
+    int vx = cx - g_view_w / 2;
+    int vy = cy - g_view_h / 2;
+    if (vx > g_grid_w - g_view_w) vx = g_grid_w - g_view_w;
+    if (vy > g_grid_h - g_view_h) vy = g_grid_h - g_view_h;
+    g_view_x = vx < 0 ? 0 : vx;
+    g_view_y = vy < 0 ? 0 : vy;
+}
+
+/* Character and attributes for one map cell */
+static chtype cell_glyph(MapCell cell, int my_slot) {
+    if (cell == CELL_WALL) return '#' | COLOR_PAIR(9);
+    if (cell == CELL_FOOD) return '@' | COLOR_PAIR(8) | A_BOLD;
+    if (cell >= CELL_SNAKE_BASE) {
+        int player_idx = cell - CELL_SNAKE_BASE;
+        chtype glyph = 'O' | COLOR_PAIR((player_idx % NUM_COLORS) + 1);
+        /* Bold for my snake */
+        return player_idx == my_slot ? glyph | A_BOLD : glyph;
+    }
+    return ' ';
+}
+
+/* Repaint the view cells that changed since the last frame, one
+ * mvwaddchnstr() per run of changed cells. The map is copied out first so
+ * the receiver is held up for a memcpy, not for the drawing. */
+static void draw_game(void) {
     pthread_mutex_lock(&g_map_lock);
+    uint32_t tick = g_map_tick;
+    int my_slot = g_my_slot;
+    int head_x = g_region_head_x, head_y = g_region_head_y;
+    int tail;
+    int head = predict_next(&tail);
+    bool changed = tick != g_drawn_tick || my_slot != g_drawn_slot ||
+                   head != g_drawn_head || tail != g_drawn_tail;
+    if (changed) {
+        memcpy(g_frame, g_map_cells, (size_t)g_grid_w * g_grid_h * sizeof(MapCell));
+    }
+    pthread_mutex_unlock(&g_map_lock);
     
-    for (int y = 0; y < GRID_SIZE; y++) {
-        for (int x = 0; x < GRID_SIZE; x++) {
-            uint8_t cell = g_map_state.map[y][x];
-            int screen_y = y + 1;
-            int screen_x = x + 1;
-            
-            if (cell == CELL_WALL) {
-                wattron(g_game_win, COLOR_PAIR(9));
-                mvwaddch(g_game_win, screen_y, screen_x, '#');
-                wattroff(g_game_win, COLOR_PAIR(9));
-            }
-            else if (cell == CELL_FOOD) {
-                wattron(g_game_win, COLOR_PAIR(8) | A_BOLD);
-                mvwaddch(g_game_win, screen_y, screen_x, '@');
-                wattroff(g_game_win, COLOR_PAIR(8) | A_BOLD);
+    if (!changed) return;
+    g_drawn_tick = tick;
+    g_drawn_slot = my_slot;
+    g_drawn_head = head;
+    g_drawn_tail = tail;
+    if (head >= 0) {
+        if (tail >= 0) g_frame[tail] = CELL_EMPTY;
+        g_frame[head] = CELL_SNAKE_BASE + my_slot;
+    }
+    
+    if (g_view_w < g_grid_w || g_view_h < g_grid_h) {
+        update_view(my_slot, head_x, head_y);
+    }
+    
+    chtype run[VIEW_SIZE];
+    for (int y = 0; y < g_view_h; y++) {
+        const MapCell *row = g_frame + (g_view_y + y) * g_grid_w + g_view_x;
+        chtype *drawn = g_drawn + y * g_view_w;
+        int run_len = 0;
+        
+        for (int x = 0; x <= g_view_w; x++) {
+            chtype glyph = x < g_view_w ? cell_glyph(row[x], my_slot) : 0;
+            if (x < g_view_w && glyph != drawn[x]) {
+                run[run_len++] = drawn[x] = glyph;
+                continue;
             }
-            else if (cell >= CELL_SNAKE_BASE) {
-                int player_idx = cell - CELL_SNAKE_BASE;
-                int color = (player_idx % NUM_COLORS) + 1;
-                
-                /* Bold for my snake */
-                if (player_idx == g_my_slot) {
-                    wattron(g_game_win, A_BOLD);
-                }
-                
-                wattron(g_game_win, COLOR_PAIR(color));
-                mvwaddch(g_game_win, screen_y, screen_x, 'O');
-                wattroff(g_game_win, COLOR_PAIR(color));
-                wattroff(g_game_win, A_BOLD);
+            if (run_len > 0) {
+                mvwaddchnstr(g_game_win, y + 1, x - run_len + 1, run, run_len);
+                run_len = 0;
             }
         }
     }
     
-    pthread_mutex_unlock(&g_map_lock);
-    
     wrefresh(g_game_win);
 }
 
@@ -374,10 +1152,10 @@ static void draw_scores(void) {
     pthread_mutex_lock(&g_map_lock);
     
     int row = 1;
-    for (int i = 0; i < MAX_PLAYERS && row < 13; i++) {
-        if (g_map_state.active[i]) {
+    for (int i = 0; i < g_max_players && row < 13; i++) {
+        if (g_roster[i].active) {
             int color = (i % NUM_COLORS) + 1;
-            char status = g_map_state.alive[i] ? 'O' : '.';  /* O=alive, .=respawning */
+            char status = g_roster[i].alive ? 'O' : '.';  /* O=alive, .=respawning */
             
             if (i == g_my_slot) {
                 wattron(g_score_win, A_BOLD);
@@ -385,7 +1163,7 @@ static void draw_scores(void) {
             
             wattron(g_score_win, COLOR_PAIR(color));
             mvwprintw(g_score_win, row, 2, "%c %-12.12s %5d",
-                     status, g_map_state.names[i], g_map_state.scores[i]);
+                     status, g_roster[i].name, g_roster[i].score);
             wattroff(g_score_win, COLOR_PAIR(color));
             wattroff(g_score_win, A_BOLD);
             
@@ -393,13 +1171,53 @@ static void draw_scores(void) {
         }
     }
     
-    mvwprintw(g_score_win, row + 1, 2, "Tick: %u", g_map_state.tick);
+    mvwprintw(g_score_win, row + 1, 2, "Tick: %u  Arena: %d", g_map_tick, g_my_arena);
     
     pthread_mutex_unlock(&g_map_lock);
     
     wrefresh(g_score_win);
 }
 
+/* One character per two minimap tiles (stacked), shaded by how many snake
+ * segments they hold; '@' is the middle of my view */
+static void draw_minimap(void) {
+    static uint32_t drawn_tick = 0;
+    static int drawn_x = -1, drawn_y = -1;
+    
+    if (!g_minimap_win) return;
+    int my_x = (g_view_x + g_view_w / 2) / VIEW_TILE;
+    int my_y = (g_view_y + g_view_h / 2) / VIEW_TILE / 2;
+    
+    pthread_mutex_lock(&g_map_lock);
+    if (g_minimap_tick == drawn_tick && my_x == drawn_x && my_y == drawn_y) {
+        pthread_mutex_unlock(&g_map_lock);
+        return;
+    }
+    drawn_tick = g_minimap_tick;
+    drawn_x = my_x;
+    drawn_y = my_y;
+    
+    werase(g_minimap_win);
+    box(g_minimap_win, 0, 0);
+    wattron(g_minimap_win, COLOR_PAIR(1) | A_BOLD);
+    mvwprintw(g_minimap_win, 0, 2, " Map ");
+    wattroff(g_minimap_win, COLOR_PAIR(1) | A_BOLD);
+    
+    for (int r = 0; r < (g_minimap_rows + 1) / 2; r++) {
+        const uint8_t *top = g_minimap + 2 * r * g_minimap_cols;
+        const uint8_t *bottom = 2 * r + 1 < g_minimap_rows ? top + g_minimap_cols : NULL;
+        for (int c = 0; c < g_minimap_cols; c++) {
+            int n = top[c] + (bottom ? bottom[c] : 0);
+            chtype glyph = n == 0 ? ' ' : n < 4 ? '.' : n < 16 ? ':' : '#';
+            if (c == my_x && r == my_y) glyph = '@' | COLOR_PAIR(g_my_color) | A_BOLD;
+            mvwaddch(g_minimap_win, r + 1, c + 1, glyph);
+        }
+    }
+    pthread_mutex_unlock(&g_map_lock);
+    
+    wrefresh(g_minimap_win);
+}
+
 static void draw_chat(void) {
     werase(g_chat_win);
     box(g_chat_win, 0, 0);
@@ -410,7 +1228,7 @@ static void draw_chat(void) {
     
     pthread_mutex_lock(&g_chat_lock);
     
-    int max_lines = GRID_SIZE - 15 - 7;
+    int max_lines = g_chat_lines;
     int start = g_chat_count > max_lines ? g_chat_count - max_lines : 0;
     int row = 1;
     
@@ -440,12 +1258,25 @@ static void draw_status(void) {
         wattron(g_status_win, COLOR_PAIR(4));
         mvwprintw(g_status_win, 0, 2, "[CHAT MODE] Type message, Enter=Send, Esc=Cancel");
         wattroff(g_status_win, COLOR_PAIR(4));
+    } else if (g_replay) {
+        mvwprintw(g_status_win, 0, 2, "Controls: Space=Pause | Left/Right=Seek | "
+                  "Up/Down=Speed | Tab=Follow | Q=Quit");
     } else {
-        mvwprintw(g_status_win, 0, 2, "Controls: Arrow keys=Move | Tab=Chat | Q=Quit");
+        mvwprintw(g_status_win, 0, 2, g_spectate >= 0 ? "Controls: Arrow keys=Scroll | Q=Quit" :
+                  "Controls: Arrow keys=Move | Tab=Chat | Q=Quit");
     }
     
-    mvwprintw(g_status_win, 1, 2, "Player: %s | Connected: %s", 
-             g_my_name, g_connected ? "YES" : "NO");
+    if (g_replay) {
+        mvwprintw(g_status_win, 1, 2, "Replay | Tick %llu of %llu | x%d%s",
+                  (unsigned long long)replay_tick(g_replay),
+                  (unsigned long long)replay_last_tick(g_replay), g_replay_speed,
+                  g_replay_paused ? " | PAUSED" : "");
+    } else if (g_spectate >= 0) {
+        mvwprintw(g_status_win, 1, 2, "Spectating | Connected: %s", g_connected ? "YES" : "NO");
+    } else {
+        mvwprintw(g_status_win, 1, 2, "Player: %s | Connected: %s%s",
+                  g_my_name, g_connected ? "YES" : "NO", g_udp_active ? " (UDP)" : "");
+    }
     
     wrefresh(g_status_win);
 }
@@ -462,6 +1293,150 @@ static void draw_input(void) {
     wrefresh(g_input_win);
 }
 
+/* Spectators move the view themselves, by half a tile */
+static void scroll_view(int dx, int dy) {
+    int vx = g_view_x + dx * VIEW_TILE / 2;
+    int vy = g_view_y + dy * VIEW_TILE / 2;
+    if (vx > g_grid_w - g_view_w) vx = g_grid_w - g_view_w;
+    if (vy > g_grid_h - g_view_h) vy = g_grid_h - g_view_h;
+    g_view_x = vx < 0 ? 0 : vx;
+    g_view_y = vy < 0 ? 0 : vy;
+    g_drawn_tick = 0;   /* Repaint without waiting for the next frame */
+}
+
+/* ============================================================================
+ * Replay Playback
+ * ============================================================================ */
+
+/* Copy the replayed tick into the map and scoreboard the UI draws from,
+ * tallying the minimap the server would otherwise send */
+static void replay_show(void) {
+    const MapCell *map = replay_map(g_replay);
+    
+    pthread_mutex_lock(&g_map_lock);
+    memcpy(g_map_cells, map, (size_t)g_grid_w * g_grid_h * sizeof(MapCell));
+    for (int i = 0; i < g_max_players; i++) {
+        bool alive;
+        const Player *pl = replay_player(g_replay, i, &alive);
+        RosterEntry *e = &g_roster[i];
+        e->active = pl != NULL;
+        if (!pl) continue;
+        e->id = pl->id;
+        e->color = pl->color;
+        memcpy(e->name, pl->name, MAX_NAME_LEN);
+        e->score = pl->score;
+        e->alive = alive;
+    }
+    if (g_view_w < g_grid_w || g_view_h < g_grid_h) {
+        memset(g_minimap, 0, (size_t)g_minimap_cols * g_minimap_rows);
+        for (int y = 0; y < g_grid_h; y++) {
+            for (int x = 0; x < g_grid_w; x++) {
+                if (map[y * g_grid_w + x] < CELL_SNAKE_BASE) continue;
+                uint8_t *n = &g_minimap[(y / VIEW_TILE) * g_minimap_cols + x / VIEW_TILE];
+                if (*n < 255) (*n)++;
+            }
+        }
+        g_minimap_tick = (uint32_t)replay_tick(g_replay);
+    }
+    g_map_tick = (uint32_t)replay_tick(g_replay);
+    pthread_mutex_unlock(&g_map_lock);
+}
+
+/* Follow the next player on the scoreboard, or none after the last */
+static void replay_follow_next(void) {
+    int slot = g_my_slot + 1;
+    while (slot < g_max_players && !g_roster[slot].active) slot++;
+    g_my_slot = slot < g_max_players ? slot : -1;
+    g_my_color = g_my_slot >= 0 ? g_roster[g_my_slot].color : 1;
+}
+
+static void replay_seek_by(long ticks) {
+    long target = (long)replay_tick(g_replay) + ticks;
+    replay_seek(g_replay, target < 0 ? 0 : (uint64_t)target);
+    replay_show();
+}
+
+/* --replay: play a recording at GAME_TICK_MS per tick (times the speed).
+ * With `verify`, re-simulate the whole file against its keyframes instead. */
+static int run_replay(const char *path, bool verify) {
+    g_replay = replay_open(path);
+    if (!g_replay) return 1;
+    
+    const GameConfig *cfg = replay_config(g_replay);
+    printf("Replay %s: %dx%d arena, %d players, ticks %llu-%llu\n", path, cfg->grid_size,
+           cfg->grid_size, cfg->max_players,
+           (unsigned long long)replay_first_tick(g_replay),
+           (unsigned long long)replay_last_tick(g_replay));
+    
+    if (verify) {
+        int checked;
+        int bad = replay_verify(g_replay, &checked);
+        if (bad < 0) {
+            fprintf(stderr, "Damaged keyframe at tick %llu\n",
+                    (unsigned long long)replay_tick(g_replay));
+        } else {
+            printf("%d keyframes checked, %d differ\n", checked, bad);
+        }
+        replay_close(g_replay);
+        return bad != 0;
+    }
+    
+    g_grid_w = g_grid_h = cfg->grid_size;
+    g_max_players = cfg->max_players;
+    if (alloc_map() < 0) return 1;
+    
+    g_connected = 1;
+    init_ui();
+    replay_show();
+    
+    uint64_t next_step = now_ms();
+    while (g_running) {
+        int ch = getch();
+        if (ch == ' ') {
+            g_replay_paused = !g_replay_paused;
+            next_step = now_ms();
+        } else if (ch == KEY_LEFT) {
+            replay_seek_by(-REPLAY_KEYFRAME_INTERVAL);
+        } else if (ch == KEY_RIGHT) {
+            replay_seek_by(REPLAY_KEYFRAME_INTERVAL);
+        } else if (ch == KEY_UP && g_replay_speed < 16) {
+            g_replay_speed *= 2;
+        } else if (ch == KEY_DOWN && g_replay_speed > 1) {
+            g_replay_speed /= 2;
+        } else if (ch == '\t') {
+            replay_follow_next();
+        } else if (ch == 'q' || ch == 'Q') {
+            g_running = 0;
+        }
+        
+        /* Catch up on the ticks due since the last frame */
+        uint64_t now = now_ms();
+        int stepped = 0;
+        while (!g_replay_paused && now >= next_step) {
+            if (replay_step(g_replay) <= 0) {
+                g_replay_paused = 1;
+                break;
+            }
+            next_step += GAME_TICK_MS / g_replay_speed;
+            stepped++;
+        }
+        if (stepped > 0) replay_show();
+        
+        draw_game();
+        draw_scores();
+        draw_minimap();
+        draw_chat();
+        draw_status();
+        draw_input();
+        
+        msleep(16);
+    }
+    
+    shutdown_ui();
+    replay_close(g_replay);
+    return 0;
+}
+
 /* ============================================================================
  * Key Binding Setup
  * ============================================================================ */
@@ -513,129 +1488,6 @@ static void signal_handler(int sig) {
     g_running = 0;
 }
 
-/* ============================================================================
- * Stress Test Mode
- * ============================================================================ */
-
-static void *stress_client_thread(void *arg) {
-    int thread_id = (int)(intptr_t)arg;
-    
-    int sock = connect_to_server("127.0.0.1", SERVER_PORT);
-    if (sock < 0) {
-        return NULL;
-    }
-    
-    pthread_mutex_lock(&g_stats_lock);
-    g_successful_connections++;
-    pthread_mutex_unlock(&g_stats_lock);
-    
-    /* Login as AI */
-    char name[MAX_NAME_LEN];
-    snprintf(name, sizeof(name), "AI_%03d", thread_id);
-    
-    LoginRequest req;
-    memset(&req, 0, sizeof(req));
-    strncpy(req.name, name, MAX_NAME_LEN - 1);
-    req.is_ai = true;
-    
-    if (send_packet(sock, OP_LOGIN_REQ, &req, sizeof(req)) < 0) {
-        close(sock);
-        return NULL;
-    }
-    
-    uint16_t opcode;
-    void *payload = NULL;
-    uint32_t len;
-    
-    if (recv_packet(sock, &opcode, &payload, &len) < 0) {
-        close(sock);
-        return NULL;
-    }
-    free(payload);
-    
-    /* Send random moves for a while */
-    uint8_t dirs[] = { DIR_UP, DIR_DOWN, DIR_LEFT, DIR_RIGHT };
-    struct timeval start, end;
-    
-    for (int i = 0; i < 50 && g_running; i++) {
-        MoveCommand cmd = { .direction = dirs[rand() % 4] };
-        
-        gettimeofday(&start, NULL);
-        
-        if (send_packet(sock, OP_MOVE, &cmd, sizeof(cmd)) < 0) {
-            break;
-        }
-        
-        /* Wait for map update */
-        payload = NULL;
-        if (recv_packet_timeout(sock, &opcode, &payload, &len, 500) < 0) {
-            if (payload) free(payload);
-            break;
-        }
-        
-        gettimeofday(&end, NULL);
-        
-        long rtt = (end.tv_sec - start.tv_sec) * 1000000 + 
-                   (end.tv_usec - start.tv_usec);
-        
-        pthread_mutex_lock(&g_stats_lock);
-        g_total_rtt += rtt;
-        g_total_requests++;
-        pthread_mutex_unlock(&g_stats_lock);
-        
-        if (payload) free(payload);
-        
-        msleep(100);
-    }
-    
-    close(sock);
-    return NULL;
-}
-
-static void run_stress_test(int num_clients) {
-    printf("========================================\n");
-    printf("  Stress Test - %d Concurrent Clients\n", num_clients);
-    printf("========================================\n");
-    
-    struct timeval start_time, end_time;
-    gettimeofday(&start_time, NULL);
-    
-    pthread_t *threads = malloc(sizeof(pthread_t) * num_clients);
-    
-    for (int i = 0; i < num_clients; i++) {
-        pthread_create(&threads[i], NULL, stress_client_thread, (void *)(intptr_t)i);
-        msleep(20);
-    }
-    
-    for (int i = 0; i < num_clients; i++) {
-        pthread_join(threads[i], NULL);
-    }
-    
-    free(threads);
-    
-    gettimeofday(&end_time, NULL);
-    
-    double elapsed = (end_time.tv_sec - start_time.tv_sec) +
-                    (end_time.tv_usec - start_time.tv_usec) / 1000000.0;
-    
-    printf("\n========================================\n");
-    printf("  Stress Test Results\n");
-    printf("========================================\n");
-    printf("  Clients:      %d\n", num_clients);
-    printf("  Connected:    %ld\n", g_successful_connections);
-    printf("  Requests:     %ld\n", g_total_requests);
-    printf("  Time:         %.2f sec\n", elapsed);
-    
-    if (g_total_requests > 0) {
-        printf("  Avg Latency:  %ld us (%.2f ms)\n",
-               g_total_rtt / g_total_requests,
-               (double)(g_total_rtt / g_total_requests) / 1000.0);
-        printf("  Throughput:   %.2f req/sec\n",
-               (double)g_total_requests / elapsed);
-    }
-    printf("========================================\n");
-}
-
 /* ============================================================================
  * Main
  * ============================================================================ */
@@ -646,14 +1498,20 @@ static void print_usage(const char *prog) {
     printf("  -h HOST     Server hostname (default: 127.0.0.1)\n");
     printf("  -p PORT     Server port (default: %d)\n", SERVER_PORT);
     printf("  -n NAME     Player name (default: Player)\n");
-    printf("  -s [N]      Stress test with N clients (default: 100)\n");
+    printf("  --no-compress  Do not ask for compressed snapshots\n");
+    printf("  --no-udp    Keep moves and map frames on TCP\n");
+    printf("  --no-predict   Draw my snake only where the server has it\n");
+    printf("  --spectate [ARENA]  Watch an arena (default 0) without playing\n");
+    printf("  --replay FILE    Play back a recording made with ./server --record\n");
+    printf("  --verify    With --replay: check the file re-simulates exactly\n");
     printf("  --help      Show this help\n");
 }
 
 int main(int argc, char *argv[]) {
     char *host = "127.0.0.1";
     int port = SERVER_PORT;
-    int stress_clients = 100;
+    const char *replay_path = NULL;
+    bool verify = false;
     
     /* Parse arguments */
     for (int i = 1; i < argc; i++) {
@@ -663,11 +1521,19 @@ int main(int argc, char *argv[]) {
             port = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
             strncpy(g_my_name, argv[++i], MAX_NAME_LEN - 1);
-        } else if (strcmp(argv[i], "-s") == 0) {
-            g_stress_mode = 1;
-            if (i + 1 < argc && argv[i + 1][0] != '-') {
-                stress_clients = atoi(argv[++i]);
-            }
+        } else if (strcmp(argv[i], "--no-compress") == 0) {
+            g_compression = COMPRESS_NONE;
+        } else if (strcmp(argv[i], "--no-udp") == 0) {
+            g_want_udp = 0;
+        } else if (strcmp(argv[i], "--no-predict") == 0) {
+            g_want_predict = 0;
+        } else if (strcmp(argv[i], "--spectate") == 0) {
+            g_spectate = (i + 1 < argc && argv[i + 1][0] != '-') ? atoi(argv[++i]) : 0;
+            g_want_udp = 0;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
         } else if (strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             return 0;
@@ -681,14 +1547,14 @@ int main(int argc, char *argv[]) {
     
     srand(time(NULL));
     
-    /* Stress test mode */
-    if (g_stress_mode) {
-        run_stress_test(stress_clients);
-        return 0;
+    if (replay_path) {
+        return run_replay(replay_path, verify);
     }
     
-    /* Interactive mode - setup key bindings */
-    setup_key_bindings();
+    /* Setup key bindings */
+    if (g_spectate < 0) {
+        setup_key_bindings();
+    }
     
     /* Connect to server */
     printf("\nConnecting to %s:%d...\n", host, port);
@@ -697,7 +1563,11 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    printf("Connected! Logging in as '%s'...\n", g_my_name);
+    if (g_spectate >= 0) {
+        printf("Connected! Spectating arena %d...\n", g_spectate);
+    } else {
+        printf("Connected! Logging in as '%s'...\n", g_my_name);
+    }
     if (do_login(g_socket_fd, g_my_name, false) < 0) {
         close(g_socket_fd);
         return 1;
@@ -712,6 +1582,9 @@ int main(int argc, char *argv[]) {
     pthread_t recv_thread, hb_thread;
     pthread_create(&recv_thread, NULL, receiver_thread, NULL);
     pthread_create(&hb_thread, NULL, heartbeat_thread, NULL);
+    if (g_want_udp) {
+        send_packet(g_socket_fd, OP_UDP_REQUEST, NULL, 0);
+    }
     
     /* Initialize ncurses */
     init_ui();
@@ -741,6 +1614,18 @@ int main(int argc, char *argv[]) {
                 g_chat_input[g_chat_input_len++] = ch;
                 g_chat_input[g_chat_input_len] = '\0';
             }
+        } else if (g_spectate >= 0) {
+            if (ch == KEY_UP) {
+                scroll_view(0, -1);
+            } else if (ch == KEY_DOWN) {
+                scroll_view(0, 1);
+            } else if (ch == KEY_LEFT) {
+                scroll_view(-1, 0);
+            } else if (ch == KEY_RIGHT) {
+                scroll_view(1, 0);
+            } else if (ch == 'q' || ch == 'Q') {
+                g_running = 0;
+            }
         } else {
             /* Game mode */
             if (ch == g_keys[0] || ch == KEY_UP) {
@@ -761,6 +1646,7 @@ int main(int argc, char *argv[]) {
         /* Draw UI */
         draw_game();
         draw_scores();
+        draw_minimap();
         draw_chat();
         draw_status();
         draw_input();
@@ -776,6 +1662,10 @@ int main(int argc, char *argv[]) {
     
     pthread_join(recv_thread, NULL);
     pthread_join(hb_thread, NULL);
+    if (g_udp_fd >= 0) {
+        pthread_join(g_udp_thread, NULL);
+        close(g_udp_fd);
+    }
     
     close(g_socket_fd);
     
@@ -16,17 +16,28 @@
  * Game Constants
  * ============================================================================ */
 
-#define GRID_SIZE        50
-#define MAX_PLAYERS      100
-#define MAX_SNAKE_LEN    200
+/* Arena defaults; the server can override them at startup (see GameConfig) */
+#define DEFAULT_GRID_SIZE     50
+#define DEFAULT_MAX_PLAYERS   100
+#define DEFAULT_MAX_SNAKE_LEN 200
+
+#define MIN_GRID_SIZE    16
+#define MAX_GRID_SIZE    255    /* CellChange coordinates are 8-bit */
+#define MAX_PLAYERS_LIMIT 1024
+#define MIN_SNAKE_LEN    4
+#define MAX_SNAKE_LEN_LIMIT 4096
+
 #define MAX_FOOD         20
 #define MAX_NAME_LEN     16
 #define MAX_CHAT_LEN     128
 #define MAX_CHAT_HISTORY 50
 
 #define SERVER_PORT      8888
+#define RELAY_PORT       8889   /* ./server --relay listens here by default */
 #define GAME_TICK_MS     100
-#define NUM_WORKERS      4
+#define MAX_WORKERS      64
+#define MAX_ARENAS       64     /* Independent games hosted by one server */
+#define MAX_TICK_THREADS 16
 
 #define RESPAWN_TICKS    30   /* 3 seconds */
 #define PROTECTION_TICKS 30   /* 3 seconds invincibility */
@@ -38,7 +49,9 @@
 #define CELL_EMPTY       0
 #define CELL_WALL        1
 #define CELL_FOOD        2
-#define CELL_SNAKE_BASE  10
+#define CELL_SNAKE_BASE  10   /* + player slot */
+
+typedef uint16_t MapCell;
 
 /* ============================================================================
  * Directions
@@ -66,20 +79,68 @@
 #define OP_ERROR         0x00FF
 #define OP_HEARTBEAT     0x0010
 #define OP_HEARTBEAT_ACK 0x0011
+#define OP_MAP_DELTA     0x0012
+#define OP_MAP_RESYNC    0x0013
+#define OP_COMPRESSED    0x0014
+#define OP_CHAT_BATCH    0x0015
+#define OP_UDP_REQUEST   0x0016
+#define OP_UDP_OFFER     0x0017
+#define OP_UDP_INPUT     0x0018
+#define OP_UDP_FRAME     0x0019
+#define OP_VIEW_DELTA    0x001A
+#define OP_MINIMAP       0x001B
+#define OP_SPECTATE      0x001C
+#define OP_INPUT_ACK     0x001D
 
 /* ============================================================================
  * Protocol Constants
  * ============================================================================ */
 
 #define XOR_KEY          0x5A
-#define MAX_PAYLOAD_SIZE 65536
+#define MAX_PAYLOAD_SIZE (256 * 1024)
+
+/* Compression methods, negotiated at login (LoginRequest lists the accepted
+ * ones as a bitmask, LoginResponse names the one in use) */
+#define COMPRESS_NONE    0x00
+#define COMPRESS_ZLIB    0x01
+#define MAX_INFLATED_SIZE (512 * 1024)   /* Largest OP_COMPRESSED content */
+
+#define MAP_DELTA_HISTORY 32   /* ticks of deltas kept for lagging clients */
+
+/* Optional UDP channel (OP_UDP_*), set up after login over TCP */
+#define UDP_FRAME_MAX        1200  /* Datagram payload cap, under common path MTUs */
+#define UDP_INPUT_REDUNDANCY 4     /* Moves repeated in every OP_UDP_INPUT */
+#define INPUT_QUEUE_LEN      8     /* UDP moves a slot holds for the coming ticks */
+/* Interest management: on arenas bigger than DEFAULT_GRID_SIZE, a client that
+ * gives its view size at login only gets the VIEW_TILE x VIEW_TILE tiles
+ * around its snake, plus an OP_MINIMAP of the whole arena now and then */
+#define VIEW_TILE        8
+#define MIN_VIEW_SIZE    16
+#define MAX_VIEW_SIZE    64
+#define MINIMAP_INTERVAL 10          /* Ticks between OP_MINIMAPs */
+
+/* Spectators (OP_SPECTATE) hold no player slot. A relay subscribes with
+ * SPECTATE_FEED and gets a snapshot every RELAY_SNAPSHOT_INTERVAL ticks
+ * besides the deltas, so it can bring its own viewers in. */
+#define SPECTATE_FEED           0x01
+#define RELAY_SNAPSHOT_INTERVAL 10
+
+#define MAX_DELTA_CELLS   512  /* more changes than this -> full snapshot */
+                               /* (raised to 4 per player on big arenas) */
 
 /* ============================================================================
  * Shared Memory
  * ============================================================================ */
 
-#define SHM_KEY_FILE     "/tmp"
-#define SHM_KEY_ID       0x5E
+/* POSIX shared memory objects, named SHM_NAME_PREFIX + the port + the id in
+ * hex (e.g. "/snake-8888-5e"), so they show up in /dev/shm and servers on
+ * different ports keep apart */
+#define SHM_NAME_PREFIX  "/snake-"
+#define SHM_KEY_ID       0x5E   /* First arena */
+#define SHM_METRICS_ID   0x5F   /* ServerMetrics segment, read by --stats */
+#define SHM_ARENA_ID     0x80   /* + arena index, for the arenas after the first */
+#define SHM_RELAY_ID     0x5C   /* A relay's arena, so one can run beside a server */
+#define SHM_RELAY_METRICS_ID 0x5D
 
 /* ============================================================================
  * Data Structures
@@ -90,13 +151,22 @@ typedef struct {
     int16_t y;
 } Position;
 
+/*
+ * Per-slot state read by the tick loops, one dense array of 16-byte entries
+ * (four slots per cache line). The player's identity is kept apart in
+ * Player, and the body ring (max_snake_len positions per slot) in its own
+ * array, since its size is only known at startup.
+ */
 typedef struct {
-    Position body[MAX_SNAKE_LEN];
-    int length;
-    int head_idx;
+    Position head;            /* Copy of the ring's head segment */
+    uint16_t length;
+    uint16_t head_idx;
     uint8_t direction;
-    uint8_t pending_dir;
+    uint8_t pending_dir;      /* Set by workers without the lock (atomic) */
+    bool active;              /* Slot is taken */
     bool alive;
+    uint8_t spawn_protection;
+    uint8_t respawn_timer;
 } Snake;
 
 typedef struct {
@@ -104,11 +174,23 @@ typedef struct {
     char name[MAX_NAME_LEN];
     int score;
     uint8_t color;
-    bool active;
     bool is_ai;
-    int spawn_protection;
-    int respawn_timer;
-    Snake snake;
+    bool is_bot;              /* Hosted by the game loop, no connection */
+    
+    /* Input acknowledgement: a worker stores pending_dir, then its move's
+     * number in pending_seq (release); the tick consuming it publishes the
+     * number and the tick it first shows in, for the client's prediction */
+    uint32_t pending_seq;
+    uint32_t applied_seq;     /* Written after applied_tick (release) */
+    uint32_t applied_tick;
+    
+    /* UDP moves not applied yet, oldest first, so that one recovered from a
+     * later datagram still gets its own tick. The worker appends (head, with
+     * release), the game loop takes one per tick (tail). */
+    uint32_t queue_seq[INPUT_QUEUE_LEN];
+    uint8_t queue_dir[INPUT_QUEUE_LEN];
+    uint32_t queue_head;
+    uint32_t queue_tail;
 } Player;
 
 typedef struct {
@@ -123,6 +205,32 @@ typedef struct {
     uint64_t timestamp;
 } ChatMessage;
 
+/* Chat ring slot. `seq` is 2 * (n + 1) once message n is in place and odd
+ * while a writer is filling it, so readers can copy it without a lock and
+ * detect torn or overwritten entries. */
+typedef struct {
+    volatile uint64_t seq;
+    ChatMessage msg;
+} ChatSlot;
+
+/* Occupancy grid cell, kept in step with snakes and food by the game logic */
+typedef struct {
+    uint16_t snakes;      /* Live snake segments covering this cell */
+    uint16_t owner;       /* Player slot of the top segment (if snakes > 0) */
+    uint8_t food;         /* Index into foods[] + 1, or 0 */
+    bool dirty;           /* Queued on the dirty list */
+    uint16_t free_pos;    /* Index on the free-cell list, or NO_INDEX */
+} GridCell;
+
+/* 5x5 block of the spawn tiling: its snake cells and place on the clear list */
+typedef struct {
+    uint16_t snake_cells;
+    uint16_t clear_pos;   /* Index on the clear-block list, or NO_INDEX */
+} SpawnBlock;
+
+#define NO_INDEX         0xFFFF
+#define SPAWN_BLOCK      5
+
 /* Packet Header (8 bytes) */
 typedef struct __attribute__((packed)) {
     uint32_t length;
@@ -134,6 +242,9 @@ typedef struct __attribute__((packed)) {
 typedef struct __attribute__((packed)) {
     char name[MAX_NAME_LEN];
     bool is_ai;
+    uint8_t compression;    /* Accepted COMPRESS_* methods (optional) */
+    uint8_t view_size;      /* Side of the client's view in cells, 0 for the
+                             * whole arena (optional) */
 } LoginRequest;
 
 /* Login Response */
@@ -142,22 +253,139 @@ typedef struct __attribute__((packed)) {
     uint8_t color;
     uint16_t grid_width;
     uint16_t grid_height;
+    uint16_t max_players;
+    uint8_t compression;    /* COMPRESS_* method the server will use */
+    uint8_t arena;          /* Arena the player was placed in */
 } LoginResponse;
 
+/* Spectate Request - watch an arena without joining it. Answered with an
+ * OP_LOGIN_RESP whose player_id is 0; the map frames and chat then come as
+ * for a player, and moves and chat sent are ignored. */
+typedef struct __attribute__((packed)) {
+    uint8_t arena;          /* Ignored by relays, which carry one arena */
+    uint8_t compression;    /* Accepted COMPRESS_* methods */
+    uint8_t flags;          /* SPECTATE_* */
+} SpectateRequest;
+
 /* Move Command */
 typedef struct __attribute__((packed)) {
     uint8_t direction;
+    uint32_t input_seq;     /* Numbers the client's moves from 1 (optional: older
+                             * clients send the direction alone) */
 } MoveCommand;
 
-/* Map Update */
+/* Input Ack (server -> client over TCP, when it changed): the newest move
+ * number a tick applied -- or dropped, on respawn -- and the first map tick
+ * showing it. Over UDP the same pair rides in every UdpFrameHeader. */
+typedef struct __attribute__((packed)) {
+    uint32_t input_seq;
+    uint32_t tick;
+} InputAck;
+
+/*
+ * Map Update (followed by map_bytes of run-length coded map, row-major, then
+ * player_count PlayerChange entries, one per active player). A snapshot
+ * replaces the whole roster: it is followed by one OP_PLAYER_JOIN per active
+ * player.
+ *
+ * Run-length tokens:
+ *   0x00-0x7F  (t + 1) empty cells
+ *   0x80-0xBF  (t - 0x80 + 1) cells of the 16-bit big-endian value that follows
+ *   0xC0-0xFF  one cell of value (t - 0xC0)
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t tick;
+    uint16_t width;
+    uint16_t height;
+    uint32_t map_bytes;
+    uint16_t player_count;
+} MapUpdateHeader;
+
+#define MAP_RLE_MAX_BYTES(cells) (3 * (size_t)(cells))   /* worst case */
+
+/* Map Delta - one changed cell */
+typedef struct __attribute__((packed)) {
+    uint8_t x;
+    uint8_t y;
+    MapCell cell;
+} CellChange;
+
+/* Map Update / Map Delta - one scoreboard entry (active players only) */
+typedef struct __attribute__((packed)) {
+    uint16_t slot;
+    uint8_t alive;
+    int32_t score;
+} PlayerChange;
+
+/* Map Delta (followed by cell_count CellChange, then player_count PlayerChange) */
+typedef struct __attribute__((packed)) {
+    uint32_t tick;        /* Tick this delta produces */
+    uint32_t base_tick;   /* Tick the delta applies on top of */
+    uint16_t cell_count;
+    uint16_t player_count;
+} MapDeltaHeader;
+
+/*
+ * View Delta (followed by cell_count CellChange, then player_count
+ * PlayerChange). OP_MAP_DELTA for an interest-managed client: only cells in
+ * the region [x, x + w) x [y, y + h) are kept current, the tiles within half
+ * a view of the tile holding the client's head. When the region moves,
+ * the client clears the cells that left it; those entering it are sent
+ * unless empty. The scoreboard part holds only the client's own entry.
+ * base_tick 0 starts over: the client clears its map and roster, and the
+ * OP_PLAYER_JOINs and OP_MINIMAP that follow fill them again.
+ */
 typedef struct __attribute__((packed)) {
     uint32_t tick;
-    uint8_t map[GRID_SIZE][GRID_SIZE];
-    int32_t scores[MAX_PLAYERS];
-    uint8_t alive[MAX_PLAYERS];
-    uint8_t active[MAX_PLAYERS];
-    char names[MAX_PLAYERS][MAX_NAME_LEN];
-} MapUpdate;
+    uint32_t base_tick;
+    uint8_t x;
+    uint8_t y;
+    uint8_t w;
+    uint8_t h;
+    uint8_t head_x;       /* Where the region is centred, for the client's view */
+    uint8_t head_y;
+    uint16_t cell_count;
+    uint16_t player_count;
+} ViewDeltaHeader;
+
+/* Minimap (followed by cols * rows bytes, row-major, then player_count
+ * PlayerChange). Each byte counts the snake segments in one VIEW_TILE tile,
+ * saturating at 255. The scoreboard part holds the entries that changed since
+ * the previous OP_MINIMAP, or all of them after a view reset. */
+typedef struct __attribute__((packed)) {
+    uint32_t tick;
+    uint8_t cols;
+    uint8_t rows;
+    uint16_t player_count;
+} MinimapHeader;
+
+/* Player Join - a slot gets a player (also sent for the roster after every
+ * snapshot) */
+typedef struct __attribute__((packed)) {
+    uint16_t slot;
+    uint32_t player_id;
+    uint8_t color;
+    char name[MAX_NAME_LEN];
+} PlayerJoin;
+
+/* Player Leave - a slot becomes free */
+typedef struct __attribute__((packed)) {
+    uint16_t slot;
+    uint32_t player_id;
+} PlayerLeave;
+
+/* Compressed (followed by the compressed stream, which inflates to raw_len
+ * bytes of one or more complete packets) */
+typedef struct __attribute__((packed)) {
+    uint32_t raw_len;
+} CompressedHeader;
+
+#define MAP_UPDATE_MAX_PAYLOAD(grid, players) (sizeof(MapUpdateHeader) + \
+                               MAP_RLE_MAX_BYTES((grid) * (grid)) + \
+                               (size_t)(players) * sizeof(PlayerChange))
+#define MAP_DELTA_MAX_PAYLOAD(cells, players) (sizeof(MapDeltaHeader) + \
+                               (size_t)(cells) * sizeof(CellChange) + \
+                               (size_t)(players) * sizeof(PlayerChange))
 
 /* Chat Send */
 typedef struct __attribute__((packed)) {
@@ -171,38 +399,239 @@ typedef struct __attribute__((packed)) {
     char text[MAX_CHAT_LEN];
 } ChatRecv;
 
+/* Chat Batch (followed by count ChatRecv, oldest first). `missed` counts the
+ * messages before them the client fell too far behind to receive. */
+typedef struct __attribute__((packed)) {
+    uint16_t count;
+    uint16_t missed;
+} ChatBatchHeader;
+
+/*
+ * UDP channel. A logged-in client sends OP_UDP_REQUEST over TCP and gets an
+ * OP_UDP_OFFER back: the UDP port of the worker serving it and the
+ * credentials for its datagrams. Once an OP_UDP_INPUT gets through, moves go
+ * over UDP and map deltas come back as OP_UDP_FRAME datagrams. Snapshots,
+ * chat and everything else stay on TCP.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t port;
+    uint32_t conn;
+    uint32_t token;
+} UdpOffer;
+
+/* UDP Input (client -> server), sent on every move and every OP_UDP_FRAME.
+ * Holds the last UDP_INPUT_REDUNDANCY moves, so one that is lost arrives
+ * with the next datagram; the server queues those it has not seen, oldest
+ * first, and applies them one per tick. */
+typedef struct __attribute__((packed)) {
+    uint32_t conn;          /* From the offer */
+    uint32_t token;
+    uint32_t ack_tick;      /* Newest map tick applied, 0 if none */
+    uint32_t input_seq;     /* Number of the move in inputs[0], 0 if none yet */
+    uint8_t inputs[UDP_INPUT_REDUNDANCY];   /* DIR_*, newest first */
+} UdpInput;
+
+/* UDP Frame (followed by the delta frames -- roster events, then
+ * OP_MAP_DELTA -- for every tick after the client's ack_tick). Latest wins:
+ * a lost datagram is made up by the next one. */
+typedef struct __attribute__((packed)) {
+    InputAck ack;
+} UdpFrameHeader;
+
 /* ============================================================================
  * Shared Game State (in Shared Memory for IPC)
  * ============================================================================ */
 
+/* Arena configuration, fixed for the lifetime of the shared segment */
+typedef struct {
+    int grid_size;
+    int max_players;
+    int max_snake_len;
+    int max_delta_cells;
+} GameConfig;
+
+/*
+ * Pre-encoded frames (header + checksummed, ciphered payload) published by the
+ * game loop once per tick. Workers copy them out without taking the lock:
+ * `tick` is zeroed while a frame is being rewritten, so a copy is valid only if
+ * `tick` reads the same before and after.
+ */
+#define SNAPSHOT_BUFFERS     3
+
+/* OP_MAP_UPDATE plus roster OP_PLAYER_JOINs for one tick. `data` holds the
+ * plain packets (len bytes), then on a relay the same wrapped in
+ * OP_COMPRESSED as its upstream sent them (zlen bytes, else 0: workers
+ * compress snapshots themselves, when a client asks for one) */
+typedef struct {
+    volatile uint64_t tick;
+    uint32_t len;
+    uint32_t zlen;
+    uint8_t data[];
+} SnapshotFrame;
+
+/* Roster events (OP_PLAYER_LEAVE / OP_PLAYER_JOIN) then OP_MAP_DELTA for one
+ * tick */
+typedef struct {
+    volatile uint64_t tick;
+    bool overflow;        /* Too many changes: clients must take a snapshot */
+    uint32_t len;
+    uint8_t data[];
+} MapDeltaFrame;
+
+/* Power-of-two histogram: bucket i counts values in [2^i, 2^(i+1)), bucket 0
+ * also counts 0, and the last bucket everything above */
+#define HIST_BUCKETS 32
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+/* Lock usage counters, updated by the holder while it has the lock */
+typedef struct {
+    uint64_t acquisitions;
+    uint64_t contended;       /* Acquisitions that had to wait */
+    uint64_t wait_ns;         /* Total time spent waiting */
+    uint64_t hold_ns;         /* Total time held */
+    uint64_t max_hold_ns;
+    Histogram wait_hist;      /* Contended acquisitions only */
+    Histogram hold_hist;
+} LockStats;
+
+/* Process-shared mutex with its usage counters */
 typedef struct {
-    /* Synchronization - MUST be first for proper alignment */
-    pthread_mutex_t lock;
+    pthread_mutex_t mutex;
+    uint64_t acquired_ns;     /* When the current holder got it */
+    LockStats stats;
+} ShmLock;
+
+/*
+ * GameState heads the shared segment. The arrays sized by GameConfig follow
+ * it in the same segment and are found through the *_off byte offsets, so
+ * every process can locate them wherever the segment is mapped.
+ *
+ * A server started with --takeover attaches to the segments of the running
+ * one, so their layout is versioned: bump STATE_VERSION whenever GameState,
+ * anything it points to or the meaning of a field changes.
+ */
+#define STATE_MAGIC      0x534E5354   /* "SNST" */
+#define STATE_VERSION    3
+
+typedef struct {
+    uint32_t magic;           /* STATE_MAGIC once initialized */
+    uint32_t version;         /* STATE_VERSION of the server that created it */
+    uint32_t header_size;     /* sizeof(GameState) of that server */
+    
+    /* Synchronization */
+    ShmLock lock;             /* Players, snakes, grid, map and food */
     pthread_mutexattr_t lock_attr;
     
-    /* Map */
-    uint8_t map[GRID_SIZE][GRID_SIZE];
+    GameConfig cfg;
+    size_t shm_size;
+    
+    /* Runtime-sized arrays */
+    size_t map_off;        /* MapCell[grid * grid] */
+    size_t grid_off;       /* GridCell[grid * grid], occupancy for collisions */
+    size_t dirty_off;      /* uint16_t[grid * grid], map cells changed this tick */
+    size_t free_cells_off; /* uint16_t[grid * grid], empty interior cells */
+    size_t blocks_off;     /* SpawnBlock[spawn_side * spawn_side] */
+    size_t clear_off;      /* uint16_t[spawn_side * spawn_side], blocks with no snake on them */
+    size_t snakes_off;     /* Snake[max_players] */
+    size_t players_off;    /* Player[max_players] */
+    size_t bodies_off;     /* Position[max_players * max_snake_len] */
+    size_t active_off;     /* uint16_t[max_players], taken slots in ascending order */
+    size_t free_off;       /* uint16_t[max_players], stack of free slots */
+    size_t snapshots_off;  /* SNAPSHOT_BUFFERS frames of snapshot_stride bytes */
+    size_t deltas_off;     /* MAP_DELTA_HISTORY frames of delta_stride bytes */
+    size_t snapshot_stride;
+    size_t delta_stride;
+    
+    int dirty_count;
+    int free_cell_count;
+    int spawn_side;           /* The spawn tiling is spawn_side x spawn_side blocks */
+    int clear_count;
     
     /* Players */
-    Player players[MAX_PLAYERS];
-    int player_count;
+    int player_count;         /* Entries on the active list */
+    int free_count;           /* Entries on the free-slot stack */
     uint32_t next_player_id;
     
     /* Food */
     Food foods[MAX_FOOD];
     int food_count;
     
-    /* Chat history (circular buffer) */
-    ChatMessage chat_history[MAX_CHAT_HISTORY];
-    uint64_t chat_count;  /* Total messages ever (for sync) */
+    uint32_t rng;             /* Spawn randomness (xorshift), replayed from keyframes */
+    
+    /* Chat history (lock-free ring): a writer takes ticket n from chat_count
+     * and publishes the message in chat_ring[n % MAX_CHAT_HISTORY] */
+    ChatSlot chat_ring[MAX_CHAT_HISTORY];
+    uint64_t chat_count;  /* Total messages ever (atomic) */
     
-    /* Game tick */
+    /* Game tick, and that of the newest snapshot frame: the same on a game
+     * server, while a relay's snapshots may trail its deltas */
     uint64_t tick;
+    uint64_t snapshot_tick;
+    
+    /* Open connections per worker (atomic, for balancing and stats; only
+     * counted in the first arena) */
+    int worker_clients[MAX_WORKERS];
     
     /* Server running flag */
     volatile int running;
 } GameState;
 
+/*
+ * ServerMetrics fills its own segment so that `./server --stats` can read it
+ * without going near the state lock. Each field has a single writer (the game
+ * loop, or the worker owning the WorkerMetrics slot); readers just copy it.
+ */
+#define METRICS_MAGIC    0x534E4D34   /* "SNM4" */
+#define METRIC_OPCODES   32           /* Opcodes past the table count as 0 */
+
+typedef struct {
+    uint64_t accepts;
+    uint64_t disconnects;
+    uint64_t bytes_in;
+    uint64_t packets_in;
+    uint64_t bytes_out;       /* Queued for sending, whole packets */
+    uint64_t packets_out;
+    uint64_t frames_skipped;  /* Map updates held back from slow clients */
+    int spectators;           /* Connections watching without a slot */
+    uint64_t ops_in[METRIC_OPCODES];
+    uint64_t ops_out[METRIC_OPCODES];
+    Histogram send_queue;     /* Bytes pending per client, sampled every pass */
+    Histogram update_ns;      /* One update_clients() pass */
+} WorkerMetrics;
+
+/* One game loop process, ticking its share of the arenas */
+typedef struct {
+    uint64_t ticks;           /* Passes over its arenas */
+    uint64_t overruns;
+} GameLoopMetrics;
+
+typedef struct {
+    int players;              /* Taken slots as of the last tick */
+    int bots;                 /* Of them hosted by the game loop (--bots) */
+    uint64_t ticks;
+    Histogram tick_ns;        /* Tick and frame publishing, under the lock */
+    LockStats state_lock;     /* Copy of the arena's lock.stats, refreshed per tick */
+    Histogram bot_ns;         /* Bot steering pass, under the lock */
+} ArenaMetrics;
+
+typedef struct {
+    uint32_t magic;
+    int num_workers;
+    int num_loops;
+    int num_arenas;
+    uint64_t start_time;      /* Unix time the server started */
+    
+    GameLoopMetrics loops[MAX_ARENAS];
+    ArenaMetrics arenas[MAX_ARENAS];
+    WorkerMetrics workers[MAX_WORKERS];
+} ServerMetrics;
+
 #define NUM_COLORS 7
 
 #endif /* COMMON_H */
@@ -0,0 +1,963 @@
+/**
+ * game.c - Game Simulation
+ *
+ * Runs on whichever arena is bound (g_state plus the array pointers set by
+ * state_bind). Callers hold g_state->lock: the game loop for the tick,
+ * workers for logins and logouts.
+ */
+
+#include "game.h"
+#include "proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* ============================================================================
+ * Global Variables
+ * ============================================================================ */
+
+GameState *g_state = NULL;
+GameConfig g_cfg;
+MapCell *g_map;
+GridCell *g_grid;
+uint16_t *g_dirty;
+uint16_t *g_free_cells;
+SpawnBlock *g_blocks;
+uint16_t *g_clear_blocks;
+Snake *g_snakes;
+Player *g_players;
+Position *g_bodies;
+uint16_t *g_active;
+uint16_t *g_free_slots;
+
+bool g_game_quiet = false;
+
+/* ============================================================================
+ * Utility Functions
+ * ============================================================================ */
+
+uint64_t get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* ============================================================================
+ * Shared Memory Layout
+ * ============================================================================ */
+
+#define SHM_ALIGN 64
+
+#define JOIN_FRAME_SIZE   (sizeof(PacketHeader) + sizeof(PlayerJoin))
+#define LEAVE_FRAME_SIZE  (sizeof(PacketHeader) + sizeof(PlayerLeave))
+
+/* Largest encoded frames for a configuration: the snapshot carries the roster,
+ * a delta up to one leave and one join per slot */
+size_t snapshot_frame_cap(const GameConfig *cfg) {
+    return sizeof(PacketHeader) + MAP_UPDATE_MAX_PAYLOAD(cfg->grid_size, cfg->max_players) +
+           cfg->max_players * JOIN_FRAME_SIZE;
+}
+
+size_t delta_frame_cap(const GameConfig *cfg) {
+    return sizeof(PacketHeader) + MAP_DELTA_MAX_PAYLOAD(cfg->max_delta_cells, cfg->max_players) +
+           cfg->max_players * (JOIN_FRAME_SIZE + LEAVE_FRAME_SIZE);
+}
+
+static size_t shm_align(size_t n) {
+    return (n + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+/* Lay out the runtime-sized arrays for `cfg` behind the GameState header.
+ * Fills in st->cfg and the offsets and returns the total segment size. */
+size_t state_layout(GameState *st, const GameConfig *cfg) {
+    size_t cells = (size_t)cfg->grid_size * cfg->grid_size;
+    size_t off = shm_align(sizeof(GameState));
+    
+    st->cfg = *cfg;
+    /* Plain snapshot packets, then their compressed form (never larger) */
+    st->snapshot_stride = shm_align(sizeof(SnapshotFrame) + 2 * snapshot_frame_cap(cfg));
+    st->delta_stride = shm_align(sizeof(MapDeltaFrame) + delta_frame_cap(cfg));
+    
+    st->map_off = off;       off += shm_align(cells * sizeof(MapCell));
+    st->grid_off = off;      off += shm_align(cells * sizeof(GridCell));
+    st->dirty_off = off;     off += shm_align(cells * sizeof(uint16_t));
+    /* Block centres fall on 5, 10, ... up to n - 6, as for the old random pick */
+    st->spawn_side = (cfg->grid_size - 6) / SPAWN_BLOCK;
+    size_t blocks = (size_t)st->spawn_side * st->spawn_side;
+    st->free_cells_off = off; off += shm_align(cells * sizeof(uint16_t));
+    st->blocks_off = off;    off += shm_align(blocks * sizeof(SpawnBlock));
+    st->clear_off = off;     off += shm_align(blocks * sizeof(uint16_t));
+    st->snakes_off = off;    off += shm_align(cfg->max_players * sizeof(Snake));
+    st->players_off = off;   off += shm_align(cfg->max_players * sizeof(Player));
+    st->bodies_off = off;    off += shm_align((size_t)cfg->max_players * cfg->max_snake_len *
+                                              sizeof(Position));
+    st->active_off = off;    off += shm_align(cfg->max_players * sizeof(uint16_t));
+    st->free_off = off;      off += shm_align(cfg->max_players * sizeof(uint16_t));
+    st->snapshots_off = off; off += SNAPSHOT_BUFFERS * st->snapshot_stride;
+    st->deltas_off = off;    off += MAP_DELTA_HISTORY * st->delta_stride;
+    
+    st->shm_size = off;
+    return off;
+}
+
+/* Point this process's array pointers into the attached segment */
+void state_bind(void) {
+    uint8_t *base = (uint8_t *)g_state;
+    
+    g_cfg = g_state->cfg;
+    g_map = (MapCell *)(base + g_state->map_off);
+    g_grid = (GridCell *)(base + g_state->grid_off);
+    g_dirty = (uint16_t *)(base + g_state->dirty_off);
+    g_free_cells = (uint16_t *)(base + g_state->free_cells_off);
+    g_blocks = (SpawnBlock *)(base + g_state->blocks_off);
+    g_clear_blocks = (uint16_t *)(base + g_state->clear_off);
+    g_snakes = (Snake *)(base + g_state->snakes_off);
+    g_players = (Player *)(base + g_state->players_off);
+    g_bodies = (Position *)(base + g_state->bodies_off);
+    g_active = (uint16_t *)(base + g_state->active_off);
+    g_free_slots = (uint16_t *)(base + g_state->free_off);
+}
+
+SnapshotFrame *snapshot_slot(uint64_t tick) {
+    return (SnapshotFrame *)((uint8_t *)g_state + g_state->snapshots_off +
+                             (tick % SNAPSHOT_BUFFERS) * g_state->snapshot_stride);
+}
+
+MapDeltaFrame *delta_slot(uint64_t tick) {
+    return (MapDeltaFrame *)((uint8_t *)g_state + g_state->deltas_off +
+                             (tick % MAP_DELTA_HISTORY) * g_state->delta_stride);
+}
+
+/* ============================================================================
+ * Occupancy Grid / Incremental Map
+ * ============================================================================ */
+
+/*
+ * g_grid counts the live snake segments on every cell and records which food
+ * sits there, so collision and food checks are one lookup per head. The counts
+ * are updated as heads advance, tails retract, snakes grow and die; dead and
+ * inactive snakes are never on the grid.
+ *
+ * g_map is derived from the grid cell by cell as it changes, and every cell
+ * that changes is queued on g_dirty for the next delta (or on a band's
+ * DirtyLog during a parallel tick, see below).
+ *
+ * The spawn index follows the same map changes. g_free_cells lists the empty
+ * interior cells, and each GridCell knows its place on it. The interior is
+ * also tiled with 5x5 blocks: each counts its snake cells, and the blocks at
+ * zero are on g_clear_blocks. Both lists are unordered (swap-remove), so a
+ * spawn picks a random entry in O(1).
+ */
+
+/* Map changes made by one tick thread while it marks its band, tagged with
+ * the serial number of the mark that made them */
+typedef struct {
+    uint32_t seq;
+    uint16_t idx;
+    MapCell old;          /* Map value before and after */
+    MapCell value;
+    bool queued;          /* First change to the cell: goes onto g_dirty */
+} DirtyEvent;
+
+typedef struct {
+    DirtyEvent *events;
+    int count;
+    uint32_t seq;         /* Serial number of the mark being applied */
+    int unmoved_from;     /* Slots from here on have not moved yet */
+} DirtyLog;
+
+static int cell_index(int x, int y) {
+    return y * g_cfg.grid_size + x;
+}
+
+static int player_slot(const Player *player) {
+    return (int)(player - g_players);
+}
+
+static Snake *player_snake(const Player *player) {
+    return &g_snakes[player_slot(player)];
+}
+
+static Position *snake_body(const Player *player) {
+    return g_bodies + (size_t)player_slot(player) * g_cfg.max_snake_len;
+}
+
+/* Ring index of the i-th segment counting back from the head */
+static int snake_seg_idx(const Snake *s, int i) {
+    return (s->head_idx - i + g_cfg.max_snake_len) % g_cfg.max_snake_len;
+}
+
+static void free_cell_add(int idx) {
+    g_grid[idx].free_pos = g_state->free_cell_count;
+    g_free_cells[g_state->free_cell_count++] = idx;
+}
+
+static void free_cell_remove(int idx) {
+    int pos = g_grid[idx].free_pos;
+    int last = g_free_cells[--g_state->free_cell_count];
+    g_free_cells[pos] = last;
+    g_grid[last].free_pos = pos;
+    g_grid[idx].free_pos = NO_INDEX;
+}
+
+static void clear_block_add(int b) {
+    g_blocks[b].clear_pos = g_state->clear_count;
+    g_clear_blocks[g_state->clear_count++] = b;
+}
+
+static void clear_block_remove(int b) {
+    int pos = g_blocks[b].clear_pos;
+    int last = g_clear_blocks[--g_state->clear_count];
+    g_clear_blocks[pos] = last;
+    g_blocks[last].clear_pos = pos;
+    g_blocks[b].clear_pos = NO_INDEX;
+}
+
+/* Spawn block holding interior cell `idx`, or -1 outside the tiling */
+static int spawn_block(int idx) {
+    int x = idx % g_cfg.grid_size - 3, y = idx / g_cfg.grid_size - 3;
+    int side = g_state->spawn_side;
+    if (x < 0 || y < 0 || x >= side * SPAWN_BLOCK || y >= side * SPAWN_BLOCK) return -1;
+    return (y / SPAWN_BLOCK) * side + x / SPAWN_BLOCK;
+}
+
+/* Keep the free-cell list and spawn blocks in step with a map cell change */
+static void spawn_index_update(int idx, MapCell old, MapCell value) {
+    if (old == CELL_EMPTY) {
+        free_cell_remove(idx);
+    } else if (value == CELL_EMPTY) {
+        free_cell_add(idx);
+    }
+    
+    bool was_snake = old >= CELL_SNAKE_BASE, is_snake = value >= CELL_SNAKE_BASE;
+    int b = was_snake != is_snake ? spawn_block(idx) : -1;
+    if (b < 0) return;
+    
+    SpawnBlock *block = &g_blocks[b];
+    if (is_snake) {
+        if (block->snake_cells++ == 0) clear_block_remove(b);
+    } else if (--block->snake_cells == 0) {
+        clear_block_add(b);
+    }
+}
+
+/* Repaint one interior map cell from the grid, queueing it if it changed */
+static void map_refresh_cell(int x, int y, DirtyLog *log) {
+    int n = g_cfg.grid_size;
+    if (x <= 0 || x >= n - 1 || y <= 0 || y >= n - 1) return;
+    
+    int idx = cell_index(x, y);
+    GridCell *cell = &g_grid[idx];
+    MapCell value = cell->snakes ? CELL_SNAKE_BASE + cell->owner :
+                    cell->food   ? CELL_FOOD : CELL_EMPTY;
+    
+    MapCell old = g_map[idx];
+    if (old == value) return;
+    g_map[idx] = value;
+    
+    bool queued = !cell->dirty;
+    cell->dirty = true;
+    if (log) {
+        /* The index is shared across bands: it is updated at the merge */
+        DirtyEvent *ev = &log->events[log->count++];
+        ev->seq = log->seq;
+        ev->idx = idx;
+        ev->old = old;
+        ev->value = value;
+        ev->queued = queued;
+    } else {
+        if (queued) g_dirty[g_state->dirty_count++] = idx;
+        spawn_index_update(idx, old, value);
+    }
+}
+
+/* The top segment left a still-occupied cell: find a live snake still on it.
+ * Only reachable when snakes overlap, which spawn protection allows. Snakes
+ * from slot `unmoved_from` on are taken as they were before this tick's move
+ * (their head has advanced in the ring, but not on the grid). */
+static void grid_find_owner(int x, int y, int unmoved_from) {
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        const Snake *s = &g_snakes[p];
+        if (!s->alive) continue;
+        
+        const Position *body = snake_body(&g_players[p]);
+        int first = p >= unmoved_from ? 1 : 0;
+        for (int i = first; i < s->length + first; i++) {
+            Position pos = body[snake_seg_idx(s, i)];
+            if (pos.x == x && pos.y == y) {
+                g_grid[cell_index(x, y)].owner = p;
+                return;
+            }
+        }
+    }
+}
+
+static void grid_mark_logged(Position pos, int slot, int delta, DirtyLog *log) {
+    int n = g_cfg.grid_size;
+    if (pos.x < 0 || pos.x >= n || pos.y < 0 || pos.y >= n) return;
+    
+    GridCell *cell = &g_grid[cell_index(pos.x, pos.y)];
+    cell->snakes += delta;
+    if (delta > 0) {
+        cell->owner = slot;
+    } else if (cell->snakes > 0 && cell->owner == slot) {
+        grid_find_owner(pos.x, pos.y, log ? log->unmoved_from : g_cfg.max_players);
+    }
+    map_refresh_cell(pos.x, pos.y, log);
+}
+
+static void grid_mark(Position pos, int slot, int delta) {
+    grid_mark_logged(pos, slot, delta, NULL);
+}
+
+static void grid_set_food(Position pos, uint8_t food) {
+    g_grid[cell_index(pos.x, pos.y)].food = food;
+    map_refresh_cell(pos.x, pos.y, NULL);
+}
+
+static void grid_add_snake(const Player *player) {
+    const Snake *s = player_snake(player);
+    const Position *body = snake_body(player);
+    for (int i = 0; i < s->length; i++) {
+        grid_mark(body[snake_seg_idx(s, i)], player_slot(player), 1);
+    }
+}
+
+static void grid_remove_snake(const Player *player) {
+    const Snake *s = player_snake(player);
+    const Position *body = snake_body(player);
+    for (int i = 0; i < s->length; i++) {
+        grid_mark(body[snake_seg_idx(s, i)], player_slot(player), -1);
+    }
+}
+
+/* Kill a snake and take its body off the grid */
+void kill_snake(Player *player) {
+    Snake *s = player_snake(player);
+    if (!s->alive) return;
+    s->alive = false;
+    grid_remove_snake(player);
+}
+
+/* ============================================================================
+ * Game Initialization
+ * ============================================================================ */
+
+static void init_map(void) {
+    int n = g_cfg.grid_size;
+    
+    for (int i = 0; i < n * n; i++) {
+        g_map[i] = CELL_EMPTY;
+    }
+    for (int x = 0; x < n; x++) {
+        g_map[cell_index(x, 0)] = CELL_WALL;
+        g_map[cell_index(x, n - 1)] = CELL_WALL;
+    }
+    for (int y = 0; y < n; y++) {
+        g_map[cell_index(0, y)] = CELL_WALL;
+        g_map[cell_index(n - 1, y)] = CELL_WALL;
+    }
+    
+    /* Every interior cell and every block starts out free */
+    g_state->free_cell_count = 0;
+    for (int i = 0; i < n * n; i++) {
+        g_grid[i].free_pos = NO_INDEX;
+        if (g_map[i] == CELL_EMPTY) free_cell_add(i);
+    }
+    g_state->clear_count = 0;
+    for (int b = 0; b < g_state->spawn_side * g_state->spawn_side; b++) {
+        g_blocks[b].snake_cells = 0;
+        clear_block_add(b);
+    }
+}
+
+/* Spawn picks draw on the arena's own xorshift state instead of rand(), so
+ * re-running recorded ticks from a keyframe lands on the same cells */
+static uint32_t game_rand(void) {
+    uint32_t x = g_state->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return g_state->rng = x;
+}
+
+/* Drop food on a random empty cell, if there is one */
+void spawn_food(void) {
+    if (g_state->food_count >= MAX_FOOD || g_state->free_cell_count == 0) return;
+    
+    int idx = g_free_cells[game_rand() % g_state->free_cell_count];
+    for (int i = 0; i < MAX_FOOD; i++) {
+        if (!g_state->foods[i].active) {
+            g_state->foods[i].pos.x = idx % g_cfg.grid_size;
+            g_state->foods[i].pos.y = idx / g_cfg.grid_size;
+            g_state->foods[i].active = true;
+            grid_set_food(g_state->foods[i].pos, i + 1);
+            g_state->food_count++;
+            return;
+        }
+    }
+}
+
+/* Pick a spawn point: the centre of a random 5x5 block with no snake on it.
+ * With none left, returns false and a random empty cell, or the map centre
+ * if the board is full. */
+bool find_spawn_pos(int *out_x, int *out_y) {
+    int n = g_cfg.grid_size;
+    
+    if (g_state->clear_count > 0) {
+        int b = g_clear_blocks[game_rand() % g_state->clear_count];
+        *out_x = 5 + (b % g_state->spawn_side) * SPAWN_BLOCK;
+        *out_y = 5 + (b / g_state->spawn_side) * SPAWN_BLOCK;
+        return true;
+    }
+    
+    if (g_state->free_cell_count > 0) {
+        int idx = g_free_cells[game_rand() % g_state->free_cell_count];
+        *out_x = idx % n;
+        *out_y = idx / n;
+    } else {
+        *out_x = n / 2;
+        *out_y = n / 2;
+    }
+    return false;
+}
+
+/* Start a live snake on `body` (tail first, head last), heading `dir` */
+void place_snake(Player *player, const Position *body, int length, uint8_t dir) {
+    Snake *s = player_snake(player);
+    Position *ring = snake_body(player);
+    
+    s->head = body[length - 1];
+    s->direction = dir;
+    __atomic_store_n(&s->pending_dir, dir, __ATOMIC_RELAXED);
+    
+    /* A move pending for the old snake is dropped: ack it as done */
+    player->applied_tick = (uint32_t)g_state->tick + 1;
+    __atomic_store_n(&player->applied_seq, __atomic_load_n(&player->pending_seq, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+    s->alive = true;
+    s->length = length;
+    s->head_idx = length - 1;
+    memcpy(ring, body, length * sizeof(Position));
+    grid_add_snake(player);
+    
+    s->spawn_protection = PROTECTION_TICKS;
+    s->respawn_timer = 0;
+}
+
+/* Place a fresh snake; the old one (if any) must already be off the grid */
+void init_snake(Player *player, int spawn_x, int spawn_y) {
+    Position body[3] = {
+        { spawn_x - 2, spawn_y },
+        { spawn_x - 1, spawn_y },
+        { spawn_x, spawn_y }
+    };
+    place_snake(player, body, 3, DIR_RIGHT);
+}
+
+/* Queue a move for the slot's coming ticks. Lock-free, for the one worker
+ * holding the slot. Returns false if the queue is full and the move dropped. */
+bool input_push(Player *player, uint8_t dir, uint32_t seq) {
+    uint32_t head = player->queue_head;
+    if (head - __atomic_load_n(&player->queue_tail, __ATOMIC_ACQUIRE) >= INPUT_QUEUE_LEN) {
+        return false;
+    }
+    player->queue_seq[head % INPUT_QUEUE_LEN] = seq;
+    player->queue_dir[head % INPUT_QUEUE_LEN] = dir;
+    __atomic_store_n(&player->queue_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Before a tick: make the oldest queued move of each slot its pending one */
+void inputs_dequeue(void) {
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        Player *player = &g_players[p];
+        uint32_t tail = player->queue_tail;
+        if (tail == __atomic_load_n(&player->queue_head, __ATOMIC_ACQUIRE)) continue;
+        
+        __atomic_store_n(&g_snakes[p].pending_dir, player->queue_dir[tail % INPUT_QUEUE_LEN],
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&player->pending_seq, player->queue_seq[tail % INPUT_QUEUE_LEN],
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&player->queue_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Lock-free: a writer claims the next ticket and fills its ring slot, so
+ * posting never waits on other writers or on readers */
+void add_chat_message(uint32_t sender_id, const char *sender_name, const char *text) {
+    uint64_t n = __atomic_fetch_add(&g_state->chat_count, 1, __ATOMIC_RELAXED);
+    ChatSlot *slot = &g_state->chat_ring[n % MAX_CHAT_HISTORY];
+    ChatMessage *msg = &slot->msg;
+    
+    __atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    msg->sender_id = sender_id;
+    strncpy(msg->sender_name, sender_name, MAX_NAME_LEN - 1);
+    msg->sender_name[MAX_NAME_LEN - 1] = '\0';
+    strncpy(msg->text, text, MAX_CHAT_LEN - 1);
+    msg->text[MAX_CHAT_LEN - 1] = '\0';
+    msg->timestamp = get_time_ms();
+    
+    __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    
+    if (!g_game_quiet) printf("[CHAT] %s: %s\n", sender_name, text);
+}
+
+/* Start a fresh arena in the bound, zeroed state */
+void game_init(void) {
+    g_state->next_player_id = 1;
+    g_state->rng = (uint32_t)rand() | 1;   /* Never 0, xorshift's fixed point */
+    
+    /* Lowest slot on top, so an empty server hands out 0, 1, 2... */
+    g_state->player_count = 0;
+    g_state->free_count = g_cfg.max_players;
+    for (int i = 0; i < g_cfg.max_players; i++) {
+        g_free_slots[i] = g_cfg.max_players - 1 - i;
+    }
+    
+    init_map();
+    
+    for (int i = 0; i < MAX_FOOD / 2; i++) {
+        spawn_food();
+    }
+}
+
+/* ============================================================================
+ * Slot Allocation
+ *
+ * Taken slots are kept on g_active in ascending order, so the per-tick loops
+ * cost O(players online) and still visit snakes in slot order (which the
+ * parallel tick's merge relies on). Free slots sit on a stack. Both are only
+ * changed under the state lock.
+ * ============================================================================ */
+
+/* Take a free slot and mark it active. Returns it, or -1 if the server is full. */
+int slot_alloc(void) {
+    if (g_state->free_count == 0) return -1;
+    int slot = g_free_slots[--g_state->free_count];
+    
+    int a = g_state->player_count;
+    while (a > 0 && g_active[a - 1] > slot) {
+        g_active[a] = g_active[a - 1];
+        a--;
+    }
+    g_active[a] = slot;
+    g_state->player_count++;
+    g_snakes[slot].active = true;
+    return slot;
+}
+
+/* Return an active slot to the free stack */
+void slot_free(int slot) {
+    int a = 0;
+    while (a < g_state->player_count && g_active[a] != slot) a++;
+    if (a == g_state->player_count) return;
+    
+    memmove(&g_active[a], &g_active[a + 1],
+            (g_state->player_count - a - 1) * sizeof(uint16_t));
+    g_state->player_count--;
+    g_free_slots[g_state->free_count++] = slot;
+    g_snakes[slot].active = false;
+}
+
+/* ============================================================================
+ * Game Logic
+ * ============================================================================ */
+
+/* Direction a snake heading `dir` takes when `want` is pending: anything but
+ * a reversal onto its own neck. Pure, shared with the client's prediction. */
+uint8_t snake_turn(uint8_t dir, uint8_t want) {
+    static const uint8_t opposite[4] = { DIR_DOWN, DIR_UP, DIR_RIGHT, DIR_LEFT };
+    return want == opposite[dir] ? dir : want;
+}
+
+/* The cell one step from `pos`. Pure, shared with the client's prediction. */
+Position snake_step(Position pos, uint8_t dir) {
+    switch (dir) {
+        case DIR_UP:    pos.y--; break;
+        case DIR_DOWN:  pos.y++; break;
+        case DIR_LEFT:  pos.x--; break;
+        case DIR_RIGHT: pos.x++; break;
+    }
+    return pos;
+}
+
+/* Turn and advance the head in the body ring, without touching the grid,
+ * and publish the number of the move the turn came from */
+static void advance_snake(Player *player) {
+    Snake *s = player_snake(player);
+    Position *body = snake_body(player);
+    
+    uint32_t seq = __atomic_load_n(&player->pending_seq, __ATOMIC_ACQUIRE);
+    s->direction = snake_turn(s->direction, __atomic_load_n(&s->pending_dir, __ATOMIC_RELAXED));
+    if (seq != player->applied_seq) {
+        player->applied_tick = (uint32_t)g_state->tick + 1;
+        __atomic_store_n(&player->applied_seq, seq, __ATOMIC_RELEASE);
+    }
+    Position new_head = snake_step(s->head, s->direction);
+    
+    s->head_idx = (s->head_idx + 1) % g_cfg.max_snake_len;
+    body[s->head_idx] = new_head;
+    s->head = new_head;
+}
+
+void move_snake(Player *player) {
+    Snake *s = player_snake(player);
+    Position *body = snake_body(player);
+    if (!s->alive) return;
+    
+    advance_snake(player);
+    
+    /* Head enters its cell; the old tail (now just past the body) leaves */
+    grid_mark(s->head, player_slot(player), 1);
+    grid_mark(body[snake_seg_idx(s, s->length)], player_slot(player), -1);
+}
+
+/* Resolve one live, unprotected snake's head: wall, food, then other snakes */
+static void collide_snake(int p) {
+    Player *pl = &g_players[p];
+    Snake *s = &g_snakes[p];
+    Position head = s->head;
+    int n = g_cfg.grid_size;
+    
+    /* Wall collision */
+    if (head.x <= 0 || head.x >= n - 1 ||
+        head.y <= 0 || head.y >= n - 1) {
+        kill_snake(pl);
+        s->respawn_timer = RESPAWN_TICKS;
+        if (!g_game_quiet) printf("[GAME] %s hit wall! Respawning...\n", pl->name);
+        return;
+    }
+    
+    GridCell *cell = &g_grid[cell_index(head.x, head.y)];
+    
+    /* Food collision */
+    if (cell->food) {
+        int i = cell->food - 1;
+        
+        pl->score += 10;
+        if (s->length < g_cfg.max_snake_len - 1) {
+            /* The tail that just retracted stays */
+            s->length++;
+            grid_mark(snake_body(pl)[snake_seg_idx(s, s->length - 1)], p, 1);
+        }
+        g_state->foods[i].active = false;
+        g_state->food_count--;
+        grid_set_food(head, 0);
+        spawn_food();
+    }
+    
+    /* Snake collision: anything besides our own head on this cell */
+    if (cell->snakes > 1) {
+        kill_snake(pl);
+        s->respawn_timer = RESPAWN_TICKS;
+        if (!g_game_quiet) printf("[GAME] %s collided! Respawning...\n", pl->name);
+    }
+}
+
+void check_collisions(void) {
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        Snake *s = &g_snakes[p];
+        if (!s->alive)
+            continue;
+        
+        /* Spawn protection */
+        if (s->spawn_protection > 0) {
+            s->spawn_protection--;
+            continue;
+        }
+        
+        collide_snake(p);
+    }
+}
+
+/* Auto-respawn dead snakes whose timer ran out */
+void respawn_snakes(void) {
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        Snake *s = &g_snakes[p];
+        if (!s->alive) {
+            if (s->respawn_timer > 0) {
+                s->respawn_timer--;
+            } else {
+                int spawn_x, spawn_y;
+                find_spawn_pos(&spawn_x, &spawn_y);
+                init_snake(&g_players[p], spawn_x, spawn_y);
+                if (!g_game_quiet) printf("[GAME] %s respawned!\n", g_players[p].name);
+                
+                char msg[64];
+                snprintf(msg, sizeof(msg), "%s respawned!", g_players[p].name);
+                add_chat_message(0, "SYSTEM", msg);
+            }
+        }
+    }
+}
+
+/* ============================================================================
+ * Parallel Tick
+ *
+ * With more than one tick thread the move and collision passes are split so
+ * the outcome, down to the order of g_dirty, matches the serial passes:
+ *
+ *  1. Advance (players split by slot range): turn and advance every live
+ *     snake's head in its body ring. Only the snake's own state is written.
+ *  2. Mark (grid split by row band): each thread applies the head +1 / tail -1
+ *     grid marks of every snake in slot order, but only on its own rows, so
+ *     every cell sees its marks in serial order. Owner lookups treat the
+ *     snakes after the one being marked as not yet moved, just as the serial
+ *     pass sees them. Each band logs its map changes with the mark's serial
+ *     number, and the logs are replayed onto g_dirty and the spawn index in
+ *     that order.
+ *  3. Screen (players split): protected snakes count down, and a snake whose
+ *     head cell has no wall, food or second segment is left alone. Only heads
+ *     that hit something -- or that sit where an eater's tail may regrow --
+ *     go through collide_snake(), serially and in slot order.
+ * ============================================================================ */
+
+enum { SCREEN_DONE, SCREEN_CLEAR, SCREEN_COLLIDE };
+
+typedef struct {
+    pthread_t thread;
+    int index;
+    DirtyLog log;
+} TickThread;
+
+static TickThread *g_tick_threads;
+static int g_tick_thread_count = 1;
+static pthread_barrier_t g_tick_barrier;
+static bool g_tick_stop;
+static uint8_t *g_screen;        /* SCREEN_* per slot for this tick */
+
+static void slot_range(int index, int *begin, int *end) {
+    *begin = (int)((long)g_state->player_count * index / g_tick_thread_count);
+    *end = (int)((long)g_state->player_count * (index + 1) / g_tick_thread_count);
+}
+
+static void tick_advance(int index) {
+    int begin, end;
+    slot_range(index, &begin, &end);
+    for (int a = begin; a < end; a++) {
+        int p = g_active[a];
+        if (g_snakes[p].alive) {
+            advance_snake(&g_players[p]);
+        }
+    }
+}
+
+static void tick_mark_band(TickThread *t) {
+    int n = g_cfg.grid_size;
+    int y0 = n * t->index / g_tick_thread_count;
+    int y1 = n * (t->index + 1) / g_tick_thread_count;
+    
+    t->log.count = 0;
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        const Snake *s = &g_snakes[p];
+        if (!s->alive) continue;
+        
+        const Position *body = snake_body(&g_players[p]);
+        Position head = s->head;
+        Position tail = body[snake_seg_idx(s, s->length)];
+        
+        t->log.unmoved_from = p + 1;
+        if (head.y >= y0 && head.y < y1) {
+            t->log.seq = 2 * p;
+            grid_mark_logged(head, p, 1, &t->log);
+        }
+        if (tail.y >= y0 && tail.y < y1) {
+            t->log.seq = 2 * p + 1;
+            grid_mark_logged(tail, p, -1, &t->log);
+        }
+    }
+}
+
+static void tick_screen(int index) {
+    int n = g_cfg.grid_size;
+    int begin, end;
+    slot_range(index, &begin, &end);
+    
+    for (int a = begin; a < end; a++) {
+        int p = g_active[a];
+        Snake *s = &g_snakes[p];
+        g_screen[p] = SCREEN_DONE;
+        if (!s->alive) continue;
+        
+        if (s->spawn_protection > 0) {
+            s->spawn_protection--;
+            continue;
+        }
+        
+        Position head = s->head;
+        if (head.x <= 0 || head.x >= n - 1 || head.y <= 0 || head.y >= n - 1) {
+            g_screen[p] = SCREEN_COLLIDE;
+            continue;
+        }
+        const GridCell *cell = &g_grid[cell_index(head.x, head.y)];
+        g_screen[p] = (cell->food || cell->snakes > 1) ? SCREEN_COLLIDE : SCREEN_CLEAR;
+    }
+}
+
+/* Replay the map changes the bands logged in serial mark order: queue cells
+ * onto g_dirty and update the spawn index */
+static void tick_merge_dirty(void) {
+    int next[g_tick_thread_count];
+    memset(next, 0, sizeof(next));
+    
+    for (;;) {
+        TickThread *best = NULL;
+        for (int t = 0; t < g_tick_thread_count; t++) {
+            TickThread *tt = &g_tick_threads[t];
+            if (next[t] < tt->log.count &&
+                (!best || tt->log.events[next[t]].seq < best->log.events[next[best->index]].seq)) {
+                best = tt;
+            }
+        }
+        if (!best) break;
+        const DirtyEvent *ev = &best->log.events[next[best->index]++];
+        if (ev->queued) g_dirty[g_state->dirty_count++] = ev->idx;
+        spawn_index_update(ev->idx, ev->old, ev->value);
+    }
+}
+
+/* A snake that eats regrows its old tail, which can land on a clear head */
+static void tick_screen_regrowth(void) {
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        if (g_screen[p] != SCREEN_COLLIDE) continue;
+        
+        const Player *eater = &g_players[p];
+        const Snake *s = &g_snakes[p];
+        Position head = s->head;
+        int n = g_cfg.grid_size;
+        if (head.x <= 0 || head.x >= n - 1 || head.y <= 0 || head.y >= n - 1 ||
+            !g_grid[cell_index(head.x, head.y)].food) continue;
+        
+        Position tail = snake_body(eater)[snake_seg_idx(s, s->length)];
+        for (int b = 0; b < g_state->player_count; b++) {
+            int q = g_active[b];
+            if (g_screen[q] != SCREEN_CLEAR) continue;
+            Position other = g_snakes[q].head;
+            if (other.x == tail.x && other.y == tail.y) {
+                g_screen[q] = SCREEN_COLLIDE;
+            }
+        }
+    }
+}
+
+/* The three parallel phases; thread 0 is the caller of game_tick() */
+static void tick_phases(TickThread *t) {
+    tick_advance(t->index);
+    pthread_barrier_wait(&g_tick_barrier);
+    tick_mark_band(t);
+    pthread_barrier_wait(&g_tick_barrier);
+    tick_screen(t->index);
+    pthread_barrier_wait(&g_tick_barrier);
+}
+
+static void *tick_thread_main(void *arg) {
+    TickThread *t = arg;
+    
+    for (;;) {
+        pthread_barrier_wait(&g_tick_barrier);
+        if (g_tick_stop) break;
+        tick_phases(t);
+    }
+    return NULL;
+}
+
+/* Run ticks on `count` threads (the caller plus count - 1 helpers). Returns 0,
+ * or -1 if the helpers could not be set up (ticks then stay serial). */
+int game_threads_start(int count) {
+    if (count <= 1) return 0;
+    
+    g_tick_threads = calloc(count, sizeof(TickThread));
+    g_screen = calloc(g_cfg.max_players, 1);
+    if (!g_tick_threads || !g_screen) goto fail;
+    for (int t = 0; t < count; t++) {
+        g_tick_threads[t].index = t;
+        /* Each head or tail mark changes at most one cell */
+        g_tick_threads[t].log.events = malloc(2 * g_cfg.max_players * sizeof(DirtyEvent));
+        if (!g_tick_threads[t].log.events) goto fail;
+    }
+    
+    if (pthread_barrier_init(&g_tick_barrier, NULL, count) != 0) goto fail;
+    g_tick_stop = false;
+    g_tick_thread_count = count;
+    for (int t = 1; t < count; t++) {
+        if (pthread_create(&g_tick_threads[t].thread, NULL, tick_thread_main,
+                           &g_tick_threads[t]) != 0) {
+            /* Threads already started are parked on the barrier for good */
+            g_tick_thread_count = 1;
+            return -1;
+        }
+    }
+    return 0;
+    
+fail:
+    if (g_tick_threads) {
+        for (int t = 0; t < count; t++) free(g_tick_threads[t].log.events);
+    }
+    free(g_tick_threads);
+    free(g_screen);
+    g_tick_threads = NULL;
+    g_screen = NULL;
+    return -1;
+}
+
+void game_threads_stop(void) {
+    if (g_tick_thread_count <= 1) return;
+    
+    g_tick_stop = true;
+    pthread_barrier_wait(&g_tick_barrier);
+    for (int t = 1; t < g_tick_thread_count; t++) {
+        pthread_join(g_tick_threads[t].thread, NULL);
+    }
+    pthread_barrier_destroy(&g_tick_barrier);
+    
+    for (int t = 0; t < g_tick_thread_count; t++) free(g_tick_threads[t].log.events);
+    free(g_tick_threads);
+    free(g_screen);
+    g_tick_threads = NULL;
+    g_screen = NULL;
+    g_tick_thread_count = 1;
+}
+
+int game_threads(void) {
+    return g_tick_thread_count;
+}
+
+/* One simulation step: respawns, moves and collisions. Food spawning and
+ * publishing are left to the caller. */
+void game_tick(void) {
+    respawn_snakes();
+    
+    if (g_tick_thread_count <= 1) {
+        for (int a = 0; a < g_state->player_count; a++) {
+            int p = g_active[a];
+            if (g_snakes[p].alive) {
+                move_snake(&g_players[p]);
+            }
+        }
+        check_collisions();
+        return;
+    }
+    
+    pthread_barrier_wait(&g_tick_barrier);
+    tick_phases(&g_tick_threads[0]);
+    
+    tick_merge_dirty();
+    tick_screen_regrowth();
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        if (g_screen[p] == SCREEN_COLLIDE && g_snakes[p].alive) {
+            collide_snake(p);
+        }
+    }
+}
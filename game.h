@@ -0,0 +1,69 @@
+/**
+ * game.h - Game Simulation
+ *
+ * Shared-state layout, occupancy grid, tick logic and bots, used by the
+ * server's game loop and workers and by the benchmarks. Every function works
+ * on the arena bound with state_bind() and, unless noted, requires
+ * g_state->lock.
+ */
+
+#ifndef GAME_H
+#define GAME_H
+
+#include "common.h"
+#include <stddef.h>
+
+/* The bound arena: header and this process's pointers to its arrays */
+extern GameState *g_state;
+extern GameConfig g_cfg;
+extern MapCell *g_map;
+extern GridCell *g_grid;
+extern uint16_t *g_dirty;
+extern uint16_t *g_free_cells;  /* g_state->free_cell_count empty interior cells */
+extern SpawnBlock *g_blocks;
+extern uint16_t *g_clear_blocks; /* g_state->clear_count blocks with no snake */
+extern Snake *g_snakes;
+extern Player *g_players;
+extern Position *g_bodies;
+extern uint16_t *g_active;      /* g_state->player_count taken slots, ascending */
+extern uint16_t *g_free_slots;
+
+extern bool g_game_quiet;       /* Suppress per-event log lines */
+
+uint64_t get_time_ms(void);
+
+size_t snapshot_frame_cap(const GameConfig *cfg);
+size_t delta_frame_cap(const GameConfig *cfg);
+size_t state_layout(GameState *st, const GameConfig *cfg);
+void state_bind(void);
+SnapshotFrame *snapshot_slot(uint64_t tick);
+MapDeltaFrame *delta_slot(uint64_t tick);
+
+void game_init(void);
+int slot_alloc(void);
+void slot_free(int slot);
+void spawn_food(void);
+bool find_spawn_pos(int *out_x, int *out_y);
+void init_snake(Player *player, int spawn_x, int spawn_y);
+void place_snake(Player *player, const Position *body, int length, uint8_t dir);
+void kill_snake(Player *player);
+void add_chat_message(uint32_t sender_id, const char *sender_name, const char *text);
+bool input_push(Player *player, uint8_t dir, uint32_t seq);
+void inputs_dequeue(void);
+
+uint8_t snake_turn(uint8_t dir, uint8_t want);
+Position snake_step(Position pos, uint8_t dir);
+void respawn_snakes(void);
+void move_snake(Player *player);
+void check_collisions(void);
+void game_tick(void);
+
+void bots_steer(const uint16_t *slots, int count);
+int bot_add(void);
+void bot_remove(int slot);
+
+int game_threads_start(int count);
+void game_threads_stop(void);
+int game_threads(void);
+
+#endif /* GAME_H */
@@ -0,0 +1,885 @@
+/**
+ * loadtest.c - Open-Loop Load Generator
+ *
+ * Simulates many clients from a few epoll threads (one per core by default).
+ * Every client sends moves on a fixed schedule whether or not the server
+ * keeps up, and each move is matched to the map delta in which its snake
+ * actually turns. Latency is taken from the scheduled send time, so it
+ * includes any backlog in the generator itself, the wait for the next tick
+ * and frame delivery.
+ *
+ * Usage: ./loadtest [--host H] [--port P] [--clients N] [--threads N]
+ *                   [--rate MOVES/S] [--duration S] [--connect-rate N/S]
+ *                   [--compress] [--view N] [--spectate] [--server-name NAME]
+ *                   [--csv FILE] [--json FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <zlib.h>
+
+#include "common.h"
+#include "proto.h"
+
+#define LT_INBUF_INIT   4096
+#define LT_INBUF_MAX    (sizeof(PacketHeader) + MAX_PAYLOAD_SIZE)
+#define LT_MAX_PENDING  32
+#define LT_MOVE_TIMEOUT 2000000000ULL   /* A move not seen by then is lost */
+#define LT_WARMUP_NS    1000000000ULL   /* After the last connect, before measuring */
+#define LT_DRAIN_NS     2000000000ULL   /* After measuring, for late deltas */
+
+/* ============================================================================
+ * Configuration
+ * ============================================================================ */
+
+static struct {
+    const char *host;
+    int port;
+    int clients;
+    int threads;
+    double rate;            /* Moves per second per client */
+    int duration;           /* Measured seconds */
+    double connect_rate;    /* New connections per second, all threads */
+    bool compress;
+    int view;               /* View size sent at login, 0 for the whole arena */
+    bool spectate;          /* Watch instead of playing: no moves, no slots */
+    const char *server_name;
+    const char *csv_path;
+    const char *json_path;
+} g_opt = {
+    .host = "127.0.0.1",
+    .port = SERVER_PORT,
+    .clients = 1000,
+    .rate = 5.0,
+    .duration = 10,
+    .connect_rate = 500.0,
+    .server_name = "server"
+};
+
+static struct sockaddr_in g_addr;
+
+/* Phase boundaries, on the CLOCK_MONOTONIC nanosecond scale */
+static uint64_t g_t0;
+static uint64_t g_measure_start;
+static uint64_t g_measure_end;
+static uint64_t g_stop;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool in_window(uint64_t t) {
+    return t >= g_measure_start && t < g_measure_end;
+}
+
+/* ============================================================================
+ * Simulated Client
+ * ============================================================================ */
+
+typedef enum {
+    LT_IDLE,
+    LT_CONNECTING,
+    LT_LOGIN,
+    LT_PLAYING,
+    LT_CLOSED
+} LtState;
+
+typedef struct {
+    int fd;
+    LtState state;
+    uint32_t player_id;
+    int slot;                 /* -1 until our PLAYER_JOIN */
+    int grid_w, grid_h;
+    
+    /* Head as last seen in a delta, and the step that took it there */
+    int head_x, head_y;       /* -1 if unknown (dead, respawned, not seen yet) */
+    int dir;                  /* DIR_*, -1 if unknown */
+    uint64_t last_tick;
+    
+    /* Moves scheduled but not yet seen: all ask for pending_dir */
+    int pending_dir;
+    int pending_count;
+    uint64_t pending_ns[LT_MAX_PENDING];     /* Scheduled send times */
+    uint64_t pending_tick[LT_MAX_PENDING];   /* Newest tick seen at the time */
+    
+    uint8_t *in_buf;
+    uint32_t in_len;
+    uint32_t in_cap;
+} LtConn;
+
+/* Per-thread results, merged by main once the threads are joined */
+typedef struct {
+    uint64_t connected;
+    uint64_t rejected;        /* Connect failed or server full */
+    uint64_t disconnected;    /* Dropped by the server mid-run */
+    uint64_t moves_sent;      /* Scheduled in the window... */
+    uint64_t moves_matched;   /* ...seen taking effect */
+    uint64_t moves_lost;      /* ...never seen (death, respawn, timeout) */
+    uint64_t moves_unsent;    /* ...not sent: socket full, heading unknown or too many pending */
+    uint64_t frames;          /* Map frames received in the window */
+    uint64_t bytes;           /* Bytes received in the window */
+    uint64_t effect_ticks;    /* Sum over matched moves of ticks until effect */
+    uint64_t *latency_ns;
+    size_t latency_count;
+    size_t latency_cap;
+} LtStats;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    int epoll_fd;
+    LtConn *conns;
+    int count;
+    uint8_t *inflate_buf;
+    LtStats stats;
+} LtThread;
+
+static void record_latency(LtStats *st, uint64_t ns) {
+    if (st->latency_count == st->latency_cap) {
+        size_t cap = st->latency_cap ? 2 * st->latency_cap : 4096;
+        uint64_t *p = realloc(st->latency_ns, cap * sizeof(uint64_t));
+        if (!p) return;
+        st->latency_ns = p;
+        st->latency_cap = cap;
+    }
+    st->latency_ns[st->latency_count++] = ns;
+}
+
+/* Forget the outstanding moves; the ones from the window count as lost */
+static void drop_pending(LtThread *t, LtConn *c) {
+    for (int i = 0; i < c->pending_count; i++) {
+        if (in_window(c->pending_ns[i])) t->stats.moves_lost++;
+    }
+    c->pending_count = 0;
+}
+
+static void conn_close(LtThread *t, LtConn *c) {
+    if (c->state == LT_CLOSED) return;
+    if (c->state == LT_PLAYING && now_ns() < g_stop) t->stats.disconnected++;
+    drop_pending(t, c);
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->state = LT_CLOSED;
+    free(c->in_buf);
+    c->in_buf = NULL;
+}
+
+static int conn_send(LtConn *c, uint16_t opcode, const void *payload, uint32_t len) {
+    uint8_t frame[sizeof(PacketHeader) + sizeof(LoginRequest)];
+    size_t n = encode_packet(frame, opcode, payload, len);
+    return send(c->fd, frame, n, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)n ? 0 : -1;
+}
+
+static void conn_start(LtThread *t, LtConn *c) {
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0) {
+        t->stats.rejected++;
+        c->state = LT_CLOSED;
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    if (connect(c->fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0 &&
+        errno != EINPROGRESS) {
+        t->stats.rejected++;
+        close(c->fd);
+        c->fd = -1;
+        c->state = LT_CLOSED;
+        return;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = c };
+    epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->state = LT_CONNECTING;
+}
+
+/* Connection is up: log in and from then on only wait for input */
+static void conn_connected(LtThread *t, LtConn *c) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        t->stats.rejected++;
+        c->state = LT_IDLE;     /* Not counted as a disconnect */
+        conn_close(t, c);
+        return;
+    }
+    
+    c->in_buf = malloc(LT_INBUF_INIT);
+    c->in_cap = LT_INBUF_INIT;
+    c->in_len = 0;
+    
+    LoginRequest req;
+    memset(&req, 0, sizeof(req));
+    int idx = t->id + g_opt.threads * (int)(c - t->conns);
+    snprintf(req.name, MAX_NAME_LEN, "LT_%05d", idx % 100000);
+    req.is_ai = true;
+    req.compression = g_opt.compress ? COMPRESS_ZLIB : COMPRESS_NONE;
+    req.view_size = g_opt.view;
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    
+    SpectateRequest spec = { .compression = req.compression };
+    if (!c->in_buf || (g_opt.spectate ? conn_send(c, OP_SPECTATE, &spec, sizeof(spec)) :
+                       conn_send(c, OP_LOGIN_REQ, &req, sizeof(req))) < 0) {
+        t->stats.rejected++;
+        c->state = LT_IDLE;
+        conn_close(t, c);
+        return;
+    }
+    c->state = LT_LOGIN;
+}
+
+/* Our snake's new head in this delta: the changed cell one step from the old
+ * head that now shows our slot, or failing that any such cell */
+static void track_head(LtThread *t, LtConn *c, uint32_t tick, const CellChange *cells,
+                       int cell_count, uint64_t now) {
+    MapCell mine = CELL_SNAKE_BASE + c->slot;
+    int found = -1;
+    
+    for (int i = 0; i < cell_count; i++) {
+        if (cells[i].cell != mine) continue;
+        found = i;
+        if (c->head_x >= 0 &&
+            abs(cells[i].x - c->head_x) + abs(cells[i].y - c->head_y) == 1) {
+            break;
+        }
+    }
+    if (found < 0) return;
+    
+    int nx = cells[found].x, ny = cells[found].y;
+    int step = -1;
+    if (c->head_x >= 0) {
+        if (nx == c->head_x && ny == c->head_y - 1) step = DIR_UP;
+        else if (nx == c->head_x && ny == c->head_y + 1) step = DIR_DOWN;
+        else if (ny == c->head_y && nx == c->head_x - 1) step = DIR_LEFT;
+        else if (ny == c->head_y && nx == c->head_x + 1) step = DIR_RIGHT;
+    }
+    c->head_x = nx;
+    c->head_y = ny;
+    
+    if (step < 0) {
+        /* Respawned or lost track: moves in flight can no longer be matched */
+        c->dir = -1;
+        drop_pending(t, c);
+        return;
+    }
+    
+    c->dir = step;
+    if (c->pending_count > 0 && step == c->pending_dir) {
+        for (int i = 0; i < c->pending_count; i++) {
+            if (!in_window(c->pending_ns[i])) continue;
+            t->stats.moves_matched++;
+            t->stats.effect_ticks += tick - c->pending_tick[i];
+            record_latency(&t->stats, now - c->pending_ns[i]);
+        }
+        c->pending_count = 0;
+    }
+}
+
+/* One tick's changes, from an OP_MAP_DELTA or OP_VIEW_DELTA */
+static void handle_delta(LtThread *t, LtConn *c, uint32_t tick, const CellChange *cells,
+                         int cell_count, const PlayerChange *pc, int player_count, uint64_t now) {
+    c->last_tick = tick;
+    
+    /* Death: wait for the respawn before trusting the head again */
+    for (int i = 0; i < player_count; i++) {
+        if (pc[i].slot == c->slot && !pc[i].alive) {
+            c->head_x = c->head_y = c->dir = -1;
+            drop_pending(t, c);
+        }
+    }
+    if (c->slot >= 0) track_head(t, c, tick, cells, cell_count, now);
+}
+
+static void handle_packet(LtThread *t, LtConn *c, uint16_t opcode,
+                          const uint8_t *payload, uint32_t len, uint64_t now, bool nested);
+
+/* Unpack an OP_COMPRESSED snapshot and handle the packets inside */
+static void handle_compressed(LtThread *t, LtConn *c, const uint8_t *payload,
+                              uint32_t len, uint64_t now) {
+    if (len < sizeof(CompressedHeader)) return;
+    const CompressedHeader *hdr = (const CompressedHeader *)payload;
+    uLongf raw_len = hdr->raw_len;
+    if (raw_len > MAX_INFLATED_SIZE ||
+        uncompress(t->inflate_buf, &raw_len, payload + sizeof(*hdr), len - sizeof(*hdr)) != Z_OK) {
+        return;
+    }
+    
+    size_t off = 0;
+    for (;;) {
+        uint16_t op;
+        unsigned char *inner;
+        uint32_t inner_len;
+        int used = decode_packet(t->inflate_buf + off, raw_len - off, &op, &inner, &inner_len);
+        if (used <= 0) break;
+        handle_packet(t, c, op, inner, inner_len, now, true);
+        off += used;
+    }
+}
+
+static void handle_packet(LtThread *t, LtConn *c, uint16_t opcode,
+                          const uint8_t *payload, uint32_t len, uint64_t now, bool nested) {
+    switch (opcode) {
+        case OP_LOGIN_RESP: {
+            if (len < offsetof(LoginResponse, compression)) break;
+            const LoginResponse *resp = (const LoginResponse *)payload;
+            c->player_id = resp->player_id;
+            c->grid_w = resp->grid_width;
+            c->grid_h = resp->grid_height;
+            c->state = LT_PLAYING;
+            t->stats.connected++;
+            break;
+        }
+        
+        case OP_ERROR: {
+            /* Server full */
+            t->stats.rejected++;
+            c->state = LT_IDLE;
+            conn_close(t, c);
+            break;
+        }
+        
+        case OP_PLAYER_JOIN: {
+            if (len < sizeof(PlayerJoin)) break;
+            const PlayerJoin *pj = (const PlayerJoin *)payload;
+            if (pj->player_id == c->player_id) c->slot = pj->slot;
+            break;
+        }
+        
+        case OP_MAP_UPDATE:
+        case OP_COMPRESSED: {
+            /* A snapshot: the head shows up again in the next delta */
+            if (!nested && in_window(now)) t->stats.frames++;
+            if (len >= sizeof(MapUpdateHeader) && opcode == OP_MAP_UPDATE) {
+                c->last_tick = ((const MapUpdateHeader *)payload)->tick;
+            }
+            if (opcode == OP_COMPRESSED) handle_compressed(t, c, payload, len, now);
+            break;
+        }
+        
+        case OP_MAP_DELTA: {
+            if (in_window(now)) t->stats.frames++;
+            if (len < sizeof(MapDeltaHeader)) break;
+            const MapDeltaHeader *hdr = (const MapDeltaHeader *)payload;
+            if (len < sizeof(*hdr) + hdr->cell_count * sizeof(CellChange) +
+                      hdr->player_count * sizeof(PlayerChange)) {
+                break;
+            }
+            const CellChange *cells = (const CellChange *)(hdr + 1);
+            handle_delta(t, c, hdr->tick, cells, hdr->cell_count,
+                         (const PlayerChange *)(cells + hdr->cell_count), hdr->player_count, now);
+            break;
+        }
+        
+        case OP_VIEW_DELTA: {
+            if (in_window(now)) t->stats.frames++;
+            if (len < sizeof(ViewDeltaHeader)) break;
+            const ViewDeltaHeader *hdr = (const ViewDeltaHeader *)payload;
+            if (len < sizeof(*hdr) + hdr->cell_count * sizeof(CellChange) +
+                      hdr->player_count * sizeof(PlayerChange)) {
+                break;
+            }
+            /* Starting over, like a snapshot: the head shows up again later */
+            if (hdr->base_tick == 0) {
+                c->last_tick = hdr->tick;
+                c->head_x = c->head_y = c->dir = -1;
+                drop_pending(t, c);
+                break;
+            }
+            const CellChange *cells = (const CellChange *)(hdr + 1);
+            handle_delta(t, c, hdr->tick, cells, hdr->cell_count,
+                         (const PlayerChange *)(cells + hdr->cell_count), hdr->player_count, now);
+            break;
+        }
+    }
+}
+
+static void conn_read(LtThread *t, LtConn *c) {
+    uint64_t now = now_ns();
+    for (;;) {
+        if (c->in_len == c->in_cap) {
+            uint32_t cap = c->in_cap * 2;
+            if (cap > LT_INBUF_MAX) cap = LT_INBUF_MAX;
+            uint8_t *buf = cap > c->in_cap ? realloc(c->in_buf, cap) : NULL;
+            if (!buf) {
+                conn_close(t, c);
+                return;
+            }
+            c->in_buf = buf;
+            c->in_cap = cap;
+        }
+        
+        ssize_t n = recv(c->fd, c->in_buf + c->in_len, c->in_cap - c->in_len, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            conn_close(t, c);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (in_window(now)) t->stats.bytes += n;
+        c->in_len += n;
+        
+        uint32_t off = 0;
+        for (;;) {
+            uint16_t opcode;
+            unsigned char *payload;
+            uint32_t len;
+            int used = decode_packet(c->in_buf + off, c->in_len - off, &opcode, &payload, &len);
+            if (used < 0) {
+                conn_close(t, c);
+                return;
+            }
+            if (used == 0) break;
+            off += used;
+            handle_packet(t, c, opcode, payload, len, now, false);
+            if (c->state == LT_CLOSED) return;
+        }
+        if (off > 0) {
+            memmove(c->in_buf, c->in_buf + off, c->in_len - off);
+            c->in_len -= off;
+        }
+    }
+}
+
+/* The move scheduled for `when`: keep asking for the turn still in flight,
+ * otherwise turn towards the side with more room */
+static void conn_move(LtThread *t, LtConn *c, uint64_t when) {
+    bool counted = in_window(when);
+    if (counted) t->stats.moves_sent++;
+    
+    /* Moves that never showed up (e.g. blocked by a collision) */
+    while (c->pending_count > 0 && when - c->pending_ns[0] > LT_MOVE_TIMEOUT) {
+        if (in_window(c->pending_ns[0])) t->stats.moves_lost++;
+        memmove(c->pending_ns, c->pending_ns + 1, --c->pending_count * sizeof(uint64_t));
+        memmove(c->pending_tick, c->pending_tick + 1, c->pending_count * sizeof(uint64_t));
+    }
+    
+    /* A move that could not be matched to a frame is not sent at all */
+    if (c->dir < 0 || c->pending_count == LT_MAX_PENDING) {
+        if (counted) t->stats.moves_unsent++;
+        return;
+    }
+    
+    int dir;
+    if (c->pending_count > 0) {
+        dir = c->pending_dir;
+    } else if (c->dir == DIR_UP || c->dir == DIR_DOWN) {
+        dir = c->head_x < c->grid_w / 2 ? DIR_RIGHT : DIR_LEFT;
+    } else {
+        dir = c->head_y < c->grid_h / 2 ? DIR_DOWN : DIR_UP;
+    }
+    
+    MoveCommand cmd = { .direction = dir };
+    if (conn_send(c, OP_MOVE, &cmd, sizeof(cmd)) < 0) {
+        if (counted) t->stats.moves_unsent++;
+        return;
+    }
+    
+    c->pending_dir = dir;
+    c->pending_ns[c->pending_count] = when;
+    c->pending_tick[c->pending_count] = c->last_tick;
+    c->pending_count++;
+}
+
+static void *lt_thread_main(void *arg) {
+    LtThread *t = arg;
+    struct epoll_event events[256];
+    
+    /* Connects go out at the global connect rate, interleaved across threads;
+     * each client's moves are spread evenly over the move interval */
+    uint64_t connect_gap = (uint64_t)(1e9 * g_opt.threads / g_opt.connect_rate);
+    uint64_t next_connect = g_t0 + (uint64_t)(1e9 * t->id / g_opt.connect_rate);
+    int connect_idx = 0;
+    uint64_t move_gap = (uint64_t)(1e9 / g_opt.rate / t->count);
+    uint64_t next_move = g_t0 + move_gap * t->id / g_opt.threads;
+    int move_idx = 0;
+    
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= g_stop) break;
+        
+        while (connect_idx < t->count && next_connect <= now) {
+            conn_start(t, &t->conns[connect_idx++]);
+            next_connect += connect_gap;
+        }
+        while (next_move <= now) {
+            LtConn *c = &t->conns[move_idx];
+            if (c->state == LT_PLAYING && next_move < g_measure_end && !g_opt.spectate) {
+                conn_move(t, c, next_move);
+            }
+            move_idx = (move_idx + 1) % t->count;
+            next_move += move_gap;
+        }
+        
+        uint64_t wake = next_move;
+        if (connect_idx < t->count && next_connect < wake) wake = next_connect;
+        if (g_stop < wake) wake = g_stop;
+        int timeout = wake > now ? (int)((wake - now + 999999) / 1000000) : 0;
+        
+        int n = epoll_wait(t->epoll_fd, events, 256, timeout);
+        for (int i = 0; i < n; i++) {
+            LtConn *c = events[i].data.ptr;
+            if (c->state == LT_CONNECTING) {
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) conn_connected(t, c);
+            } else if (c->state != LT_CLOSED) {
+                conn_read(t, c);
+            }
+        }
+    }
+    
+    for (int i = 0; i < t->count; i++) {
+        conn_close(t, &t->conns[i]);
+    }
+    return NULL;
+}
+
+/* ============================================================================
+ * Server CPU (from /proc)
+ * ============================================================================ */
+
+/* Total user + system clock ticks of the processes named `name`; -1 if none */
+static long long server_cpu_ticks(const char *name, int *procs) {
+    DIR *dir = opendir("/proc");
+    if (!dir) return -1;
+    
+    long long total = 0;
+    *procs = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] < '0' || de->d_name[0] > '9') continue;
+        
+        char path[280], buf[512];
+        snprintf(path, sizeof(path), "/proc/%s/stat", de->d_name);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        buf[n] = '\0';
+        
+        /* pid (comm) state ppid ... utime stime are fields 14 and 15 */
+        char *open = strchr(buf, '(');
+        char *close_paren = strrchr(buf, ')');
+        if (!open || !close_paren) continue;
+        if ((size_t)(close_paren - open - 1) != strlen(name) ||
+            strncmp(open + 1, name, strlen(name)) != 0) {
+            continue;
+        }
+        
+        unsigned long long utime, stime;
+        if (sscanf(close_paren + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                   &utime, &stime) == 2) {
+            total += utime + stime;
+            (*procs)++;
+        }
+    }
+    closedir(dir);
+    return *procs > 0 ? total : -1;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = { .tv_sec = t / 1000000000ULL, .tv_nsec = t % 1000000000ULL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/* ============================================================================
+ * Report
+ * ============================================================================ */
+
+typedef struct {
+    LtStats total;
+    double p50_ms, p99_ms, p999_ms, max_ms;
+    double avg_ticks;
+    double fps;               /* Map frames per second per client */
+    double kb_per_client;     /* Received KB per second per client */
+    double cpu_pct;           /* -1 if the server was not found */
+    int server_procs;
+} LtReport;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const LtStats *st, double pct) {
+    if (st->latency_count == 0) return 0.0;
+    size_t i = (size_t)(st->latency_count * pct / 100.0);
+    if (i >= st->latency_count) i = st->latency_count - 1;
+    return st->latency_ns[i] / 1e6;
+}
+
+static void print_report(const LtReport *r) {
+    const LtStats *s = &r->total;
+    printf("loadtest: %d clients (%llu connected, %llu rejected, %llu dropped), "
+           "%d threads, %.1f moves/s each, %d s\n",
+           g_opt.clients, (unsigned long long)s->connected, (unsigned long long)s->rejected,
+           (unsigned long long)s->disconnected, g_opt.threads, g_opt.rate, g_opt.duration);
+    printf("  moves:      %llu scheduled, %llu matched, %llu lost, %llu unsent\n",
+           (unsigned long long)s->moves_sent, (unsigned long long)s->moves_matched,
+           (unsigned long long)s->moves_lost, (unsigned long long)s->moves_unsent);
+    printf("  latency:    p50 %.2f ms  p99 %.2f ms  p999 %.2f ms  max %.2f ms "
+           "(%.2f ticks to effect)\n",
+           r->p50_ms, r->p99_ms, r->p999_ms, r->max_ms, r->avg_ticks);
+    printf("  frames:     %.2f/s per client\n", r->fps);
+    printf("  received:   %.2f KB/s per client\n", r->kb_per_client);
+    if (r->cpu_pct >= 0) {
+        printf("  server CPU: %.1f%% (%d processes named '%s')\n",
+               r->cpu_pct, r->server_procs, g_opt.server_name);
+    } else {
+        printf("  server CPU: n/a (no process named '%s')\n", g_opt.server_name);
+    }
+}
+
+/* One row per run, with a header when the file is new */
+static void write_csv(const LtReport *r, const char *path) {
+    FILE *f = fopen(path, "a+");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) == 0) {
+        fprintf(f, "time,clients,connected,rejected,dropped,threads,rate,duration,"
+                   "moves,matched,lost,unsent,p50_ms,p99_ms,p999_ms,max_ms,ticks_to_effect,"
+                   "fps_per_client,kb_per_client,server_cpu_pct\n");
+    }
+    const LtStats *s = &r->total;
+    fprintf(f, "%ld,%d,%llu,%llu,%llu,%d,%.2f,%d,%llu,%llu,%llu,%llu,"
+               "%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f\n",
+            (long)time(NULL), g_opt.clients, (unsigned long long)s->connected,
+            (unsigned long long)s->rejected, (unsigned long long)s->disconnected,
+            g_opt.threads, g_opt.rate, g_opt.duration,
+            (unsigned long long)s->moves_sent, (unsigned long long)s->moves_matched,
+            (unsigned long long)s->moves_lost, (unsigned long long)s->moves_unsent,
+            r->p50_ms, r->p99_ms, r->p999_ms, r->max_ms, r->avg_ticks,
+            r->fps, r->kb_per_client, r->cpu_pct);
+    fclose(f);
+}
+
+static void write_json(const LtReport *r, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    const LtStats *s = &r->total;
+    fprintf(f, "{\n"
+               "  \"time\": %ld,\n"
+               "  \"clients\": %d, \"connected\": %llu, \"rejected\": %llu, \"dropped\": %llu,\n"
+               "  \"threads\": %d, \"rate\": %.2f, \"duration\": %d,\n"
+               "  \"moves\": { \"scheduled\": %llu, \"matched\": %llu, \"lost\": %llu, "
+               "\"unsent\": %llu },\n"
+               "  \"latency_ms\": { \"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f },\n"
+               "  \"ticks_to_effect\": %.3f,\n"
+               "  \"fps_per_client\": %.3f,\n"
+               "  \"kb_per_client\": %.3f,\n"
+               "  \"server_cpu_pct\": %.1f\n"
+               "}\n",
+            (long)time(NULL), g_opt.clients, (unsigned long long)s->connected,
+            (unsigned long long)s->rejected, (unsigned long long)s->disconnected,
+            g_opt.threads, g_opt.rate, g_opt.duration,
+            (unsigned long long)s->moves_sent, (unsigned long long)s->moves_matched,
+            (unsigned long long)s->moves_lost, (unsigned long long)s->moves_unsent,
+            r->p50_ms, r->p99_ms, r->p999_ms, r->max_ms, r->avg_ticks,
+            r->fps, r->kb_per_client, r->cpu_pct);
+    fclose(f);
+}
+
+/* ============================================================================
+ * Main
+ * ============================================================================ */
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("Options:\n");
+    printf("  --host HOST          Server host (default: 127.0.0.1)\n");
+    printf("  --port PORT          Server port (default: %d)\n", SERVER_PORT);
+    printf("  --clients N          Simulated clients (default: 1000)\n");
+    printf("  --threads N          Event loop threads (default: one per core)\n");
+    printf("  --rate R             Moves per second per client (default: 5)\n");
+    printf("  --duration S         Measured seconds (default: 10)\n");
+    printf("  --connect-rate R     New connections per second (default: 500)\n");
+    printf("  --compress           Ask for compressed snapshots\n");
+    printf("  --view N             Ask for only the N x N cells around each snake\n");
+    printf("  --spectate           Connect as spectators (e.g. to a relay)\n");
+    printf("  --server-name NAME   Process name to charge server CPU to (default: server)\n");
+    printf("  --csv FILE           Append the results to FILE as CSV\n");
+    printf("  --json FILE          Write the results to FILE as JSON\n");
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        
+        if (strcmp(arg, "--compress") == 0) {
+            g_opt.compress = true;
+            continue;
+        }
+        if (strcmp(arg, "--spectate") == 0) {
+            g_opt.spectate = true;
+            continue;
+        }
+        if (strcmp(arg, "--help") == 0 || !val) {
+            print_usage(argv[0]);
+            return strcmp(arg, "--help") == 0 ? 0 : 1;
+        }
+        i++;
+        if (strcmp(arg, "--host") == 0) g_opt.host = val;
+        else if (strcmp(arg, "--port") == 0) g_opt.port = atoi(val);
+        else if (strcmp(arg, "--clients") == 0) g_opt.clients = atoi(val);
+        else if (strcmp(arg, "--threads") == 0) g_opt.threads = atoi(val);
+        else if (strcmp(arg, "--rate") == 0) g_opt.rate = atof(val);
+        else if (strcmp(arg, "--duration") == 0) g_opt.duration = atoi(val);
+        else if (strcmp(arg, "--connect-rate") == 0) g_opt.connect_rate = atof(val);
+        else if (strcmp(arg, "--view") == 0) g_opt.view = atoi(val);
+        else if (strcmp(arg, "--server-name") == 0) g_opt.server_name = val;
+        else if (strcmp(arg, "--csv") == 0) g_opt.csv_path = val;
+        else if (strcmp(arg, "--json") == 0) g_opt.json_path = val;
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (g_opt.threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        g_opt.threads = cores < 1 ? 1 : (int)cores;
+    }
+    if (g_opt.threads > g_opt.clients) g_opt.threads = g_opt.clients;
+    if (g_opt.clients < 1 || g_opt.rate <= 0 || g_opt.duration < 1 || g_opt.connect_rate <= 0 ||
+        g_opt.view < 0 || g_opt.view > MAX_VIEW_SIZE) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    struct hostent *he = gethostbyname(g_opt.host);
+    if (!he) {
+        fprintf(stderr, "Unknown host %s\n", g_opt.host);
+        return 1;
+    }
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(g_opt.port);
+    memcpy(&g_addr.sin_addr, he->h_addr_list[0], he->h_length);
+    
+    /* One fd per client, plus some slack */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)g_opt.clients + 64) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    
+    uint64_t ramp = (uint64_t)(1e9 * g_opt.clients / g_opt.connect_rate);
+    g_t0 = now_ns();
+    g_measure_start = g_t0 + ramp + LT_WARMUP_NS;
+    g_measure_end = g_measure_start + (uint64_t)g_opt.duration * 1000000000ULL;
+    g_stop = g_measure_end + LT_DRAIN_NS;
+    
+    LtThread *threads = calloc(g_opt.threads, sizeof(LtThread));
+    if (!threads) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < g_opt.threads; i++) {
+        LtThread *t = &threads[i];
+        t->id = i;
+        t->count = g_opt.clients / g_opt.threads + (i < g_opt.clients % g_opt.threads);
+        t->conns = calloc(t->count, sizeof(LtConn));
+        t->inflate_buf = malloc(MAX_INFLATED_SIZE);
+        t->epoll_fd = epoll_create1(0);
+        if (!t->conns || !t->inflate_buf || t->epoll_fd < 0) {
+            perror("loadtest setup");
+            return 1;
+        }
+        for (int j = 0; j < t->count; j++) {
+            LtConn *c = &t->conns[j];
+            c->fd = -1;
+            c->slot = -1;
+            c->head_x = c->head_y = c->dir = -1;
+        }
+    }
+    
+    printf("Ramping up %d clients over %.1f s, then measuring for %d s...\n",
+           g_opt.clients, ramp / 1e9, g_opt.duration);
+    fflush(stdout);
+    
+    for (int i = 0; i < g_opt.threads; i++) {
+        pthread_create(&threads[i].thread, NULL, lt_thread_main, &threads[i]);
+    }
+    
+    int procs = 0;
+    sleep_until(g_measure_start);
+    long long cpu_start = server_cpu_ticks(g_opt.server_name, &procs);
+    sleep_until(g_measure_end);
+    long long cpu_end = server_cpu_ticks(g_opt.server_name, &procs);
+    
+    LtReport r;
+    memset(&r, 0, sizeof(r));
+    LtStats *s = &r.total;
+    for (int i = 0; i < g_opt.threads; i++) {
+        LtThread *t = &threads[i];
+        pthread_join(t->thread, NULL);
+        
+        const LtStats *ts = &t->stats;
+        s->connected += ts->connected;
+        s->rejected += ts->rejected;
+        s->disconnected += ts->disconnected;
+        s->moves_sent += ts->moves_sent;
+        s->moves_matched += ts->moves_matched;
+        s->moves_lost += ts->moves_lost;
+        s->moves_unsent += ts->moves_unsent;
+        s->frames += ts->frames;
+        s->bytes += ts->bytes;
+        s->effect_ticks += ts->effect_ticks;
+        for (size_t j = 0; j < ts->latency_count; j++) {
+            record_latency(s, ts->latency_ns[j]);
+        }
+        
+        close(t->epoll_fd);
+        free(ts->latency_ns);
+        free(t->inflate_buf);
+        free(t->conns);
+    }
+    free(threads);
+    
+    qsort(s->latency_ns, s->latency_count, sizeof(uint64_t), cmp_u64);
+    r.p50_ms = percentile_ms(s, 50);
+    r.p99_ms = percentile_ms(s, 99);
+    r.p999_ms = percentile_ms(s, 99.9);
+    r.max_ms = s->latency_count ? s->latency_ns[s->latency_count - 1] / 1e6 : 0.0;
+    r.avg_ticks = s->moves_matched ? (double)s->effect_ticks / s->moves_matched : 0.0;
+    
+    double clients = s->connected ? (double)s->connected : 1.0;
+    r.fps = s->frames / clients / g_opt.duration;
+    r.kb_per_client = s->bytes / 1024.0 / clients / g_opt.duration;
+    r.cpu_pct = (cpu_start >= 0 && cpu_end >= 0) ?
+        100.0 * (cpu_end - cpu_start) / sysconf(_SC_CLK_TCK) / g_opt.duration : -1.0;
+    r.server_procs = procs;
+    
+    print_report(&r);
+    if (g_opt.csv_path) write_csv(&r, g_opt.csv_path);
+    if (g_opt.json_path) write_json(&r, g_opt.json_path);
+    
+    free(s->latency_ns);
+    return 0;
+}
@@ -9,62 +9,409 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
-uint16_t calculate_checksum(const unsigned char *data, size_t len) {
+/* ============================================================================
+ * Checksum / Cipher Kernels
+ *
+ * The checksum is the byte sum modulo 2^16 and the cipher XORs every byte with
+ * XOR_KEY, so both vectorize directly: SAD against zero sums 8 bytes per lane.
+ * The fused variants touch the payload once. The fastest implementation the
+ * CPU supports is picked on first use; -DPROTO_NO_SIMD forces scalar.
+ * ============================================================================ */
+
+#if !defined(PROTO_NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define PROTO_X86 1
+#include <immintrin.h>
+#elif !defined(PROTO_NO_SIMD) && defined(__aarch64__)
+#define PROTO_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Encode: sum src, write src ^ key to dst (dst may equal src) */
+typedef uint32_t (*encode_kernel_fn)(unsigned char *dst, const unsigned char *src, size_t len);
+/* Decode: buf ^= key in place, sum the result */
+typedef uint32_t (*decode_kernel_fn)(unsigned char *buf, size_t len);
+typedef uint32_t (*sum_kernel_fn)(const unsigned char *data, size_t len);
+
+static uint32_t sum_scalar(const unsigned char *data, size_t len) {
     uint32_t sum = 0;
     for (size_t i = 0; i < len; i++) {
         sum += data[i];
     }
-    return (uint16_t)(sum & 0xFFFF);
+    return sum;
 }
 
-void xor_cipher(unsigned char *data, size_t len) {
+static uint32_t encode_scalar(unsigned char *dst, const unsigned char *src, size_t len) {
+    uint32_t sum = 0;
     for (size_t i = 0; i < len; i++) {
-        data[i] ^= XOR_KEY;
+        sum += src[i];
+        dst[i] = src[i] ^ XOR_KEY;
     }
+    return sum;
 }
 
-int send_packet(int sockfd, uint16_t opcode, const void *payload, uint32_t payload_len) {
+static uint32_t decode_scalar(unsigned char *buf, size_t len) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        buf[i] ^= XOR_KEY;
+        sum += buf[i];
+    }
+    return sum;
+}
+
+#ifdef PROTO_X86
+
+static uint32_t hsum_epi64(__m128i acc) {
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    return (uint32_t)_mm_cvtsi128_si32(acc);
+}
+
+static uint32_t sum_sse2(const unsigned char *data, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    return hsum_epi64(acc) + sum_scalar(data + i, len - i);
+}
+
+static uint32_t encode_sse2(unsigned char *dst, const unsigned char *src, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i key = _mm_set1_epi8((char)XOR_KEY);
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, key));
+    }
+    return hsum_epi64(acc) + encode_scalar(dst + i, src + i, len - i);
+}
+
+static uint32_t decode_sse2(unsigned char *buf, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i key = _mm_set1_epi8((char)XOR_KEY);
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(buf + i)), key);
+        _mm_storeu_si128((__m128i *)(buf + i), v);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    return hsum_epi64(acc) + decode_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t hsum_epi64_avx2(__m256i acc) {
+    __m128i lo = _mm256_castsi256_si128(acc);
+    __m128i hi = _mm256_extracti128_si256(acc, 1);
+    __m128i s = _mm_add_epi64(lo, hi);
+    s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+    return (uint32_t)_mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2")))
+static uint32_t sum_avx2(const unsigned char *data, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+    }
+    return hsum_epi64_avx2(acc) + sum_sse2(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t encode_avx2(unsigned char *dst, const unsigned char *src, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i key = _mm256_set1_epi8((char)XOR_KEY);
+    __m256i acc = zero;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, key));
+    }
+    return hsum_epi64_avx2(acc) + encode_sse2(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t decode_avx2(unsigned char *buf, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i key = _mm256_set1_epi8((char)XOR_KEY);
+    __m256i acc = zero;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(buf + i)), key);
+        _mm256_storeu_si256((__m256i *)(buf + i), v);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+    }
+    return hsum_epi64_avx2(acc) + decode_sse2(buf + i, len - i);
+}
+
+#endif /* PROTO_X86 */
+
+#ifdef PROTO_NEON
+
+static uint32_t sum_neon(const unsigned char *data, size_t len) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(data + i)));
+    }
+    return vaddvq_u32(acc) + sum_scalar(data + i, len - i);
+}
+
+static uint32_t encode_neon(unsigned char *dst, const unsigned char *src, size_t len) {
+    const uint8x16_t key = vdupq_n_u8(XOR_KEY);
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        acc = vpadalq_u16(acc, vpaddlq_u8(v));
+        vst1q_u8(dst + i, veorq_u8(v, key));
+    }
+    return vaddvq_u32(acc) + encode_scalar(dst + i, src + i, len - i);
+}
+
+static uint32_t decode_neon(unsigned char *buf, size_t len) {
+    const uint8x16_t key = vdupq_n_u8(XOR_KEY);
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = veorq_u8(vld1q_u8(buf + i), key);
+        vst1q_u8(buf + i, v);
+        acc = vpadalq_u16(acc, vpaddlq_u8(v));
+    }
+    return vaddvq_u32(acc) + decode_scalar(buf + i, len - i);
+}
+
+#endif /* PROTO_NEON */
+
+static sum_kernel_fn g_sum_kernel = NULL;
+static encode_kernel_fn g_encode_kernel = NULL;
+static decode_kernel_fn g_decode_kernel = NULL;
+static const char *g_kernel_name = "scalar";
+static pthread_once_t g_kernels_once = PTHREAD_ONCE_INIT;
+
+/* Run once via pthread_once, which also publishes the pointers to every thread */
+static void select_kernels(void) {
+    sum_kernel_fn sum = sum_scalar;
+    encode_kernel_fn encode = encode_scalar;
+    decode_kernel_fn decode = decode_scalar;
+    const char *name = "scalar";
+    
+#if defined(PROTO_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        sum = sum_avx2;
+        encode = encode_avx2;
+        decode = decode_avx2;
+        name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        sum = sum_sse2;
+        encode = encode_sse2;
+        decode = decode_sse2;
+        name = "sse2";
+    }
+#elif defined(PROTO_NEON)
+    sum = sum_neon;
+    encode = encode_neon;
+    decode = decode_neon;
+    name = "neon";
+#endif
+    
+    g_encode_kernel = encode;
+    g_decode_kernel = decode;
+    g_kernel_name = name;
+    g_sum_kernel = sum;
+}
+
+/* Name of the checksum/cipher implementation in use */
+const char *proto_kernel_name(void) {
+    pthread_once(&g_kernels_once, select_kernels);
+    return g_kernel_name;
+}
+
+uint16_t calculate_checksum(const unsigned char *data, size_t len) {
+    pthread_once(&g_kernels_once, select_kernels);
+    return (uint16_t)(g_sum_kernel(data, len) & 0xFFFF);
+}
+
+void xor_cipher(unsigned char *data, size_t len) {
+    pthread_once(&g_kernels_once, select_kernels);
+    /* The decode kernel's sum is simply discarded */
+    g_decode_kernel(data, len);
+}
+
+/* Checksum of src and dst = ciphered src, in one pass (dst may equal src) */
+uint16_t checksum_and_cipher(unsigned char *dst, const unsigned char *src, size_t len) {
+    pthread_once(&g_kernels_once, select_kernels);
+    return (uint16_t)(g_encode_kernel(dst, src, len) & 0xFFFF);
+}
+
+/* Decipher buf in place and return the checksum of the plaintext, in one pass */
+uint16_t cipher_and_checksum(unsigned char *buf, size_t len) {
+    pthread_once(&g_kernels_once, select_kernels);
+    return (uint16_t)(g_decode_kernel(buf, len) & 0xFFFF);
+}
+
+/* Write header + checksummed, ciphered payload into `out`, which must hold
+ * sizeof(PacketHeader) + payload_len bytes. Returns the frame length. */
+size_t encode_packet(unsigned char *out, uint16_t opcode, const void *payload, uint32_t payload_len) {
     PacketHeader header;
-    unsigned char *buffer = NULL;
+    unsigned char *body = out + sizeof(PacketHeader);
     
     if (payload_len > 0 && payload != NULL) {
-        buffer = (unsigned char *)malloc(payload_len);
-        if (!buffer) return -1;
-        memcpy(buffer, payload, payload_len);
-        
-        header.checksum = htons(calculate_checksum((unsigned char*)payload, payload_len));
-        xor_cipher(buffer, payload_len);
+        header.checksum = htons(checksum_and_cipher(body, payload, payload_len));
     } else {
+        payload_len = 0;
         header.checksum = 0;
     }
-
+    
     header.length = htonl(payload_len);
     header.opcode = htons(opcode);
+    memcpy(out, &header, sizeof(header));
+    
+    return sizeof(PacketHeader) + payload_len;
+}
 
-    ssize_t sent = send(sockfd, &header, sizeof(header), MSG_NOSIGNAL);
-    if (sent != sizeof(header)) {
-        free(buffer);
-        return -1;
+/* Send a frame produced by encode_packet() */
+int send_frame(int sockfd, const void *frame, size_t len) {
+    size_t total_sent = 0;
+    while (total_sent < len) {
+        ssize_t n = send(sockfd, (const unsigned char *)frame + total_sent,
+                         len - total_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        total_sent += n;
     }
+    return 0;
+}
 
-    if (payload_len > 0 && buffer != NULL) {
-        size_t total_sent = 0;
-        while (total_sent < payload_len) {
-            ssize_t n = send(sockfd, buffer + total_sent, payload_len - total_sent, MSG_NOSIGNAL);
-            if (n <= 0) {
-                free(buffer);
-                return -1;
-            }
-            total_sent += n;
+/* sendmsg() until every iovec is out, advancing past partial writes */
+static int send_iov_all(int sockfd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        ssize_t n = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (unsigned char *)iov->iov_base + n;
+            iov->iov_len -= n;
         }
-        free(buffer);
     }
+    return 0;
+}
+
+/* Payloads up to this size go out with their header in a single syscall,
+ * ciphered through a stack buffer; larger ones continue in chunks */
+#define SEND_CHUNK 4096
 
+int send_packet(int sockfd, uint16_t opcode, const void *payload, uint32_t payload_len) {
+    PacketHeader header;
+    unsigned char chunk[SEND_CHUNK];
+    const unsigned char *src = payload;
+    
+    if (src == NULL) payload_len = 0;
+    
+    header.length = htonl(payload_len);
+    header.opcode = htons(opcode);
+    header.checksum = 0;
+    
+    /* The header must carry the checksum of the whole payload, so only a
+     * payload that fits in one chunk can be summed and ciphered in one pass */
+    size_t n = payload_len < SEND_CHUNK ? payload_len : SEND_CHUNK;
+    if (payload_len > SEND_CHUNK) {
+        header.checksum = htons(calculate_checksum(src, payload_len));
+        memcpy(chunk, src, n);
+        xor_cipher(chunk, n);
+    } else if (n > 0) {
+        header.checksum = htons(checksum_and_cipher(chunk, src, n));
+    }
+    
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = chunk,   .iov_len = n }
+    };
+    if (send_iov_all(sockfd, iov, n ? 2 : 1) < 0) return -1;
+    
+    for (size_t off = n; off < payload_len; off += n) {
+        n = payload_len - off < SEND_CHUNK ? payload_len - off : SEND_CHUNK;
+        checksum_and_cipher(chunk, src + off, n);
+        if (send_frame(sockfd, chunk, n) < 0) return -1;
+    }
+    
     return 0;
 }
 
+/* Like send_packet(), but ciphers the caller's buffer in place instead of
+ * copying it: no copy and one syscall at any size. The payload is left
+ * ciphered. */
+int send_packet_inplace(int sockfd, uint16_t opcode, void *payload, uint32_t payload_len) {
+    PacketHeader header;
+    
+    if (payload == NULL) payload_len = 0;
+    
+    header.length = htonl(payload_len);
+    header.opcode = htons(opcode);
+    header.checksum = 0;
+    
+    if (payload_len > 0) {
+        header.checksum = htons(checksum_and_cipher(payload, payload, payload_len));
+    }
+    
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = payload, .iov_len = payload_len }
+    };
+    return send_iov_all(sockfd, iov, payload_len ? 2 : 1);
+}
+
+/* Decode one packet at the start of a receive buffer, in place. Returns the
+ * number of bytes consumed, 0 if `avail` does not hold a whole packet yet, or
+ * -1 if the packet is malformed. Once the header has arrived *payload_len is
+ * set even for an incomplete packet, so callers know how much to wait for.
+ * On success *payload points into `buf` (NULL for an empty payload). */
+int decode_packet(unsigned char *buf, size_t avail, uint16_t *opcode,
+                  unsigned char **payload, uint32_t *payload_len) {
+    PacketHeader header;
+    
+    if (avail < sizeof(header)) return 0;
+    memcpy(&header, buf, sizeof(header));
+    
+    uint32_t len = ntohl(header.length);
+    if (len > MAX_PAYLOAD_SIZE) return -1;
+    *payload_len = len;
+    
+    if (avail < sizeof(header) + len) return 0;
+    
+    *opcode = ntohs(header.opcode);
+    
+    if (len > 0) {
+        *payload = buf + sizeof(header);
+        if (cipher_and_checksum(*payload, len) != ntohs(header.checksum)) return -1;
+    } else {
+        *payload = NULL;
+    }
+    
+    return (int)(sizeof(header) + len);
+}
+
 int recv_packet(int sockfd, uint16_t *opcode, void **payload, uint32_t *payload_len) {
     PacketHeader header;
     
@@ -95,9 +442,7 @@ int recv_packet(int sockfd, uint16_t *opcode, void **payload, uint32_t *payload_
             total_received += r;
         }
 
-        xor_cipher((unsigned char*)*payload, len);
-
-        uint16_t calc_checksum = calculate_checksum((unsigned char*)*payload, len);
+        uint16_t calc_checksum = cipher_and_checksum((unsigned char*)*payload, len);
         if (calc_checksum != received_checksum) {
             free(*payload);
             *payload = NULL;
@@ -110,6 +455,34 @@ int recv_packet(int sockfd, uint16_t *opcode, void **payload, uint32_t *payload_
     return 0;
 }
 
+/* Receive one packet into a caller-supplied buffer of `cap` bytes instead of
+ * allocating. Fails if the payload does not fit. */
+int recv_packet_into(int sockfd, uint16_t *opcode, void *buf, uint32_t cap, uint32_t *payload_len) {
+    PacketHeader header;
+    
+    ssize_t received = recv(sockfd, &header, sizeof(header), MSG_WAITALL);
+    if (received != sizeof(header)) return -1;
+    
+    uint32_t len = ntohl(header.length);
+    *opcode = ntohs(header.opcode);
+    *payload_len = len;
+    
+    if (len > MAX_PAYLOAD_SIZE || len > cap) return -1;
+    
+    size_t total_received = 0;
+    while (total_received < len) {
+        ssize_t r = recv(sockfd, (unsigned char *)buf + total_received,
+                         len - total_received, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        total_received += r;
+    }
+    
+    if (len > 0 && cipher_and_checksum(buf, len) != ntohs(header.checksum)) return -1;
+    
+    return 0;
+}
+
 int recv_packet_timeout(int sockfd, uint16_t *opcode, void **payload, 
                         uint32_t *payload_len, int timeout_ms) {
     fd_set readfds;
@@ -128,3 +501,205 @@ int recv_packet_timeout(int sockfd, uint16_t *opcode, void **payload,
     
     return recv_packet(sockfd, opcode, payload, payload_len);
 }
+
+/* ============================================================================
+ * Buffered Packet Reader
+ * ============================================================================ */
+
+void reader_init(PacketReader *r, void *buf, size_t cap) {
+    r->buf = buf;
+    r->cap = cap;
+    r->start = 0;
+    r->end = 0;
+}
+
+/* Return the next packet, reading from the socket only when the buffer does
+ * not already hold one, so a burst of packets costs a single recv(). The
+ * payload points into the reader's buffer and stays valid until the next
+ * call. Waits at most timeout_ms per read (-1 = forever); returns -2 on
+ * timeout and -1 on error or disconnect. */
+int reader_next(int sockfd, PacketReader *r, uint16_t *opcode,
+                unsigned char **payload, uint32_t *payload_len, int timeout_ms) {
+    for (;;) {
+        int used = decode_packet(r->buf + r->start, r->end - r->start,
+                                 opcode, payload, payload_len);
+        if (used < 0) return -1;
+        if (used > 0) {
+            r->start += used;
+            return 0;
+        }
+        
+        /* Incomplete: make room at the end of the buffer */
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == r->cap) return -1;
+        
+        if (timeout_ms >= 0) {
+            struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+            int ret = poll(&pfd, 1, timeout_ms);
+            if (ret == 0) return -2;
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+        }
+        
+        ssize_t n = recv(sockfd, r->buf + r->end, r->cap - r->end, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        r->end += n;
+    }
+}
+
+/* ============================================================================
+ * Non-blocking Output Queue
+ * ============================================================================ */
+
+void outbuf_init(OutBuffer *ob, size_t cap) {
+    ob->data = NULL;
+    ob->cap = cap;
+    ob->head = 0;
+    ob->len = 0;
+}
+
+void outbuf_free(OutBuffer *ob) {
+    free(ob->data);
+    ob->data = NULL;
+    ob->head = 0;
+    ob->len = 0;
+}
+
+/* Write out as much of the queue as the socket takes without blocking.
+ * Returns -1 if the connection is broken. */
+int outbuf_flush(int sockfd, OutBuffer *ob) {
+    while (ob->len > 0) {
+        struct iovec iov[2];
+        size_t first = ob->cap - ob->head;
+        int iovcnt = 1;
+        
+        iov[0].iov_base = ob->data + ob->head;
+        if (first >= ob->len) {
+            iov[0].iov_len = ob->len;
+        } else {
+            iov[0].iov_len = first;
+            iov[1].iov_base = ob->data;
+            iov[1].iov_len = ob->len - first;
+            iovcnt = 2;
+        }
+        
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        ssize_t n = sendmsg(sockfd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        
+        ob->head = (ob->head + n) % ob->cap;
+        ob->len -= n;
+    }
+    
+    ob->head = 0;
+    return 0;
+}
+
+/* Send without blocking. Whatever the socket does not take right away is
+ * queued behind any earlier data. Returns -1 if the connection is broken and
+ * -2 if the queue would exceed its capacity (consumer too slow). */
+int outbuf_write(int sockfd, OutBuffer *ob, const void *data, size_t len) {
+    const unsigned char *p = data;
+    
+    if (ob->len == 0) {
+        while (len > 0) {
+            ssize_t n = send(sockfd, p, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return -1;
+            }
+            p += n;
+            len -= n;
+        }
+        if (len == 0) return 0;
+    }
+    
+    if (ob->len + len > ob->cap) return -2;
+    
+    if (!ob->data) {
+        ob->data = malloc(ob->cap);
+        if (!ob->data) return -1;
+    }
+    
+    size_t tail = (ob->head + ob->len) % ob->cap;
+    size_t first = ob->cap - tail;
+    if (first > len) first = len;
+    memcpy(ob->data + tail, p, first);
+    memcpy(ob->data, p + first, len - first);
+    ob->len += len;
+    
+    return 0;
+}
+
+/* ============================================================================
+ * Map Run-Length Coding (OP_MAP_UPDATE, token format in common.h)
+ * ============================================================================ */
+
+/* Encode `count` cells into `out`, which must hold MAP_RLE_MAX_BYTES(count).
+ * Returns the encoded length. */
+size_t map_rle_encode(const MapCell *cells, size_t count, unsigned char *out) {
+    unsigned char *p = out;
+    size_t i = 0;
+    
+    while (i < count) {
+        MapCell v = cells[i];
+        size_t max_run = (v == CELL_EMPTY) ? 128 : 64;
+        size_t run = 1;
+        while (i + run < count && run < max_run && cells[i + run] == v) run++;
+        
+        if (v == CELL_EMPTY) {
+            *p++ = (unsigned char)(run - 1);
+        } else if (run == 1 && v < 0x40) {
+            *p++ = (unsigned char)(0xC0 | v);
+        } else {
+            *p++ = (unsigned char)(0x80 | (run - 1));
+            *p++ = (unsigned char)(v >> 8);
+            *p++ = (unsigned char)(v & 0xFF);
+        }
+        i += run;
+    }
+    
+    return p - out;
+}
+
+/* Decode exactly `count` cells. Returns 0 on success, -1 if the input is
+ * truncated or does not describe exactly `count` cells. */
+int map_rle_decode(const unsigned char *in, size_t len, MapCell *cells, size_t count) {
+    size_t i = 0, pos = 0;
+    
+    while (pos < len) {
+        unsigned char t = in[pos++];
+        MapCell v;
+        size_t run;
+        
+        if (t < 0x80) {
+            v = CELL_EMPTY;
+            run = t + 1;
+        } else if (t < 0xC0) {
+            if (pos + 2 > len) return -1;
+            v = (MapCell)((in[pos] << 8) | in[pos + 1]);
+            pos += 2;
+            run = (t & 0x3F) + 1;
+        } else {
+            v = t & 0x3F;
+            run = 1;
+        }
+        
+        if (run > count - i) return -1;
+        for (size_t k = 0; k < run; k++) cells[i++] = v;
+    }
+    
+    return i == count ? 0 : -1;
+}
@@ -8,10 +8,53 @@
 #include "common.h"
 #include <stddef.h>
 
+/* Non-blocking output queue (ring buffer) for one socket */
+typedef struct {
+    unsigned char *data;   /* Allocated on first use */
+    size_t cap;
+    size_t head;           /* Offset of the oldest pending byte */
+    size_t len;            /* Bytes pending */
+} OutBuffer;
+
+/* Buffered receiver decoding packets in place in a caller-supplied buffer */
+typedef struct {
+    unsigned char *buf;
+    size_t cap;            /* At least sizeof(PacketHeader) + MAX_PAYLOAD_SIZE */
+    size_t start;          /* First byte not yet decoded */
+    size_t end;            /* One past the last byte received */
+} PacketReader;
+
+#define READER_BUF_SIZE (sizeof(PacketHeader) + MAX_PAYLOAD_SIZE)
+
 uint16_t calculate_checksum(const unsigned char *data, size_t len);
 void xor_cipher(unsigned char *data, size_t len);
+uint16_t checksum_and_cipher(unsigned char *dst, const unsigned char *src, size_t len);
+uint16_t cipher_and_checksum(unsigned char *buf, size_t len);
+const char *proto_kernel_name(void);
+size_t encode_packet(unsigned char *out, uint16_t opcode, const void *payload, uint32_t payload_len);
+int send_frame(int sockfd, const void *frame, size_t len);
+int decode_packet(unsigned char *buf, size_t avail, uint16_t *opcode,
+                  unsigned char **payload, uint32_t *payload_len);
 int send_packet(int sockfd, uint16_t opcode, const void *payload, uint32_t payload_len);
+int send_packet_inplace(int sockfd, uint16_t opcode, void *payload, uint32_t payload_len);
 int recv_packet(int sockfd, uint16_t *opcode, void **payload, uint32_t *payload_len);
+int recv_packet_into(int sockfd, uint16_t *opcode, void *buf, uint32_t cap, uint32_t *payload_len);
 int recv_packet_timeout(int sockfd, uint16_t *opcode, void **payload, uint32_t *payload_len, int timeout_ms);
 
+void reader_init(PacketReader *r, void *buf, size_t cap);
+int reader_next(int sockfd, PacketReader *r, uint16_t *opcode,
+                unsigned char **payload, uint32_t *payload_len, int timeout_ms);
+
+void outbuf_init(OutBuffer *ob, size_t cap);
+void outbuf_free(OutBuffer *ob);
+int outbuf_write(int sockfd, OutBuffer *ob, const void *data, size_t len);
+int outbuf_flush(int sockfd, OutBuffer *ob);
+
+size_t map_rle_encode(const MapCell *cells, size_t count, unsigned char *out);
+int map_rle_decode(const unsigned char *in, size_t len, MapCell *cells, size_t count);
+
+static inline size_t outbuf_pending(const OutBuffer *ob) {
+    return ob->len;
+}
+
 #endif /* PROTO_H */
@@ -0,0 +1,734 @@
+/**
+ * replay.c - Replay Recording and Playback
+ *
+ * The tick side only copies: turns and keyframes go onto a single-producer
+ * single-consumer byte ring, and a writer thread compresses the keyframes
+ * and appends everything to the file in REPLAY_WRITE_CHUNK writes. If the
+ * ring is full the record is dropped and the next tick starts over with a
+ * keyframe, so the tick never waits on the disk.
+ *
+ * Playback maps the file, indexes the keyframes and re-simulates: it is
+ * exact because every spawn draws on g_state->rng (part of the keyframe) and
+ * the recorded turns are the directions the ticks actually moved in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "replay.h"
+#include "game.h"
+
+/* Simulation state in a keyframe: the header, then every array up to the
+ * published frames */
+static size_t keyframe_size(const GameState *st) {
+    return sizeof(GameState) + (st->snapshots_off - st->map_off);
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * Recording
+ * ============================================================================ */
+
+struct ReplayWriter {
+    char path[256];
+    int fd;
+    size_t key_size;
+    pthread_t thread;
+    int stop;                 /* Set (atomic) to drain the ring and finish */
+    
+    /* Byte ring of whole records: the game loop fills from `fill` and
+     * publishes it as `head`, the writer thread consumes up to `tail` */
+    uint8_t *ring;
+    size_t cap;               /* Power of two */
+    size_t head;
+    size_t tail;
+    size_t fill;
+    
+    /* Game loop side */
+    uint8_t *was_alive;       /* Per slot, before the tick */
+    uint8_t *dir;
+    ReplayTurn *turns;
+    uint64_t last_key;
+    uint32_t next_player_id;  /* Roster as of the last tick */
+    int player_count;
+    bool need_key;
+    uint64_t ticks;
+    uint64_t keyframes;
+    uint64_t dropped;
+    
+    /* Writer thread side */
+    uint8_t *rec;
+    uint8_t *zbuf;
+    size_t zcap;
+    uint8_t *out;
+    size_t out_len;
+    uint64_t bytes;
+    int error;
+};
+
+static bool queue_reserve(ReplayWriter *w, size_t len) {
+    size_t tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+    return w->cap - (w->fill - tail) >= len;
+}
+
+static void queue_put(ReplayWriter *w, const void *src, size_t len) {
+    size_t at = w->fill & (w->cap - 1);
+    size_t first = len < w->cap - at ? len : w->cap - at;
+    memcpy(w->ring + at, src, first);
+    memcpy(w->ring, (const uint8_t *)src + first, len - first);
+    w->fill += len;
+}
+
+static void queue_commit(ReplayWriter *w) {
+    __atomic_store_n(&w->head, w->fill, __ATOMIC_RELEASE);
+}
+
+static void queue_get(ReplayWriter *w, size_t *tail, void *dst, size_t len) {
+    size_t at = *tail & (w->cap - 1);
+    size_t first = len < w->cap - at ? len : w->cap - at;
+    memcpy(dst, w->ring + at, first);
+    memcpy((uint8_t *)dst + first, w->ring, len - first);
+    *tail += len;
+}
+
+static void out_flush(ReplayWriter *w) {
+    if (w->out_len > 0 && !w->error && write_all(w->fd, w->out, w->out_len) < 0) {
+        perror("replay write");
+        w->error = 1;
+    }
+    w->bytes += w->out_len;
+    w->out_len = 0;
+}
+
+static void out_append(ReplayWriter *w, const void *data, size_t len) {
+    if (w->out_len + len > REPLAY_WRITE_CHUNK) out_flush(w);
+    if (len > REPLAY_WRITE_CHUNK) {
+        if (!w->error && write_all(w->fd, data, len) < 0) {
+            perror("replay write");
+            w->error = 1;
+        }
+        w->bytes += len;
+        return;
+    }
+    memcpy(w->out + w->out_len, data, len);
+    w->out_len += len;
+}
+
+/* Writes one record taken off the ring, compressing keyframes */
+static void write_record(ReplayWriter *w, ReplayRecord *rec) {
+    if (rec->type != REPLAY_KEYFRAME) {
+        out_append(w, rec, sizeof(*rec));
+        out_append(w, w->rec, rec->len);
+        return;
+    }
+    
+    uint32_t raw_len = rec->len;
+    uLongf zlen = w->zcap;
+    if (compress2(w->zbuf, &zlen, w->rec, raw_len, Z_BEST_SPEED) != Z_OK) return;
+    rec->len = sizeof(raw_len) + zlen;
+    out_append(w, rec, sizeof(*rec));
+    out_append(w, &raw_len, sizeof(raw_len));
+    out_append(w, w->zbuf, zlen);
+}
+
+static void *writer_thread(void *arg) {
+    ReplayWriter *w = arg;
+    size_t tail = w->tail;
+    uint64_t last_flush = get_time_ms();
+    
+    for (;;) {
+        int stopping = __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        
+        if (tail == head) {
+            /* Idle: keep the writes big, but get data out within a second */
+            uint64_t now = get_time_ms();
+            if (stopping || now - last_flush >= 1000) {
+                out_flush(w);
+                last_flush = now;
+            }
+            if (stopping) break;
+            struct timespec ts = { 0, 20 * 1000000L };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        
+        ReplayRecord rec;
+        queue_get(w, &tail, &rec, sizeof(rec));
+        queue_get(w, &tail, w->rec, rec.len);
+        __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+        write_record(w, &rec);
+    }
+    return NULL;
+}
+
+static void writer_free(ReplayWriter *w) {
+    if (w->fd >= 0) close(w->fd);
+    free(w->ring);
+    free(w->was_alive);
+    free(w->dir);
+    free(w->turns);
+    free(w->rec);
+    free(w->zbuf);
+    free(w->out);
+    free(w);
+}
+
+/* Start recording the bound arena into `path` (truncated). Returns NULL
+ * with a message printed on failure. */
+ReplayWriter *replay_writer_open(const char *path) {
+    ReplayWriter *w = calloc(1, sizeof(ReplayWriter));
+    if (!w) return NULL;
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->key_size = keyframe_size(g_state);
+    w->need_key = true;
+    
+    /* Room for a few keyframes in flight */
+    w->cap = 1;
+    while (w->cap < REPLAY_QUEUE_SIZE || w->cap < 4 * (w->key_size + sizeof(ReplayRecord))) {
+        w->cap <<= 1;
+    }
+    w->zcap = compressBound(w->key_size);
+    w->ring = malloc(w->cap);
+    w->was_alive = calloc(g_cfg.max_players, 1);
+    w->dir = calloc(g_cfg.max_players, 1);
+    w->turns = calloc(g_cfg.max_players, sizeof(ReplayTurn));
+    w->rec = malloc(w->key_size);
+    w->zbuf = malloc(w->zcap);
+    w->out = malloc(REPLAY_WRITE_CHUNK);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        perror(path);
+        writer_free(w);
+        return NULL;
+    }
+    if (!w->ring || !w->was_alive || !w->dir || !w->turns || !w->rec || !w->zbuf || !w->out) {
+        perror("malloc");
+        writer_free(w);
+        return NULL;
+    }
+    
+    ReplayHeader hdr = {
+        .magic = REPLAY_MAGIC,
+        .state_size = sizeof(GameState),
+        .keyframe_size = w->key_size,
+        .keyframe_interval = REPLAY_KEYFRAME_INTERVAL,
+        .cfg = g_cfg
+    };
+    if (write_all(w->fd, &hdr, sizeof(hdr)) < 0) {
+        perror(path);
+        writer_free(w);
+        return NULL;
+    }
+    w->bytes = sizeof(hdr);
+    
+    if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+        fprintf(stderr, "%s: could not start the writer thread\n", path);
+        writer_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+/* Queue a keyframe of the bound arena; on a full ring the caller skips
+ * ticks until one gets through */
+static void push_keyframe(ReplayWriter *w, uint64_t tick, uint8_t flags) {
+    ReplayRecord rec = {
+        .type = REPLAY_KEYFRAME,
+        .flags = flags,
+        .len = w->key_size,
+        .tick = tick
+    };
+    if (!queue_reserve(w, sizeof(rec) + w->key_size)) {
+        w->dropped++;
+        w->need_key = true;
+        return;
+    }
+    queue_put(w, &rec, sizeof(rec));
+    queue_put(w, g_state, sizeof(GameState));
+    queue_put(w, (uint8_t *)g_state + g_state->map_off, w->key_size - sizeof(GameState));
+    queue_commit(w);
+    
+    w->last_key = tick;
+    w->need_key = false;
+    w->keyframes++;
+}
+
+/* Before game_tick(): a keyframe if due, and each snake's state so the turns
+ * can be told afterwards */
+void replay_begin_tick(ReplayWriter *w) {
+    uint64_t tick = g_state->tick + 1;
+    bool roster = g_state->next_player_id != w->next_player_id ||
+                  g_state->player_count != w->player_count;
+    
+    if (w->need_key || roster || tick - w->last_key >= REPLAY_KEYFRAME_INTERVAL) {
+        push_keyframe(w, tick, w->need_key ? REPLAY_RESYNC :
+                               roster ? REPLAY_ROSTER : REPLAY_PERIODIC);
+    }
+    w->next_player_id = g_state->next_player_id;
+    w->player_count = g_state->player_count;
+    
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        w->was_alive[p] = g_snakes[p].alive;
+        w->dir[p] = g_snakes[p].direction;
+    }
+}
+
+/* After game_tick() and the food spawn: the directions the snakes moved in,
+ * wherever replaying pending_dir = direction would not reproduce them */
+void replay_end_tick(ReplayWriter *w, bool food) {
+    if (w->need_key) return;
+    
+    int count = 0;
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        const Snake *s = &g_snakes[p];
+        if (w->was_alive[p] ? s->direction != w->dir[p] : s->alive) {
+            w->turns[count].slot = p;
+            w->turns[count].dir = s->direction;
+            w->turns[count].pad = 0;
+            count++;
+        }
+    }
+    
+    ReplayRecord rec = {
+        .type = REPLAY_TICK,
+        .flags = food ? REPLAY_FOOD : 0,
+        .count = count,
+        .len = count * sizeof(ReplayTurn),
+        .tick = g_state->tick + 1
+    };
+    if (!queue_reserve(w, sizeof(rec) + rec.len)) {
+        w->dropped++;
+        w->need_key = true;
+        return;
+    }
+    queue_put(w, &rec, sizeof(rec));
+    queue_put(w, w->turns, rec.len);
+    queue_commit(w);
+    w->ticks++;
+}
+
+/* Drain the ring, flush and close */
+void replay_writer_close(ReplayWriter *w) {
+    if (!w) return;
+    __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(w->thread, NULL);
+    
+    printf("[REPLAY] %s: %llu ticks, %llu keyframes, %llu KB, %llu records dropped\n",
+           w->path, (unsigned long long)w->ticks, (unsigned long long)w->keyframes,
+           (unsigned long long)(w->bytes / 1024), (unsigned long long)w->dropped);
+    writer_free(w);
+}
+
+/* ============================================================================
+ * Playback
+ * ============================================================================ */
+
+struct Replay {
+    uint8_t *data;            /* The mapped file */
+    size_t map_size;
+    size_t size;              /* Up to the last complete record */
+    ReplayHeader hdr;
+    GameState layout;         /* state_layout() of hdr.cfg */
+    size_t *keys;             /* Offsets of the keyframe records */
+    uint64_t *key_ticks;
+    int key_count;
+    uint64_t last_tick;
+    size_t pos;               /* Next record to play */
+    void *mem;                /* Private arena */
+    uint8_t *raw;             /* Keyframe being loaded or checked */
+    bool verify;
+    int checked;
+    int mismatches;
+};
+
+static void read_record(const Replay *r, size_t off, ReplayRecord *rec) {
+    memcpy(rec, r->data + off, sizeof(*rec));
+}
+
+/* Inflate the keyframe record at `off` into r->raw */
+static bool inflate_key(Replay *r, size_t off) {
+    ReplayRecord rec;
+    read_record(r, off, &rec);
+    const uint8_t *payload = r->data + off + sizeof(rec);
+    uint32_t raw_len;
+    if (rec.len < sizeof(raw_len)) return false;
+    memcpy(&raw_len, payload, sizeof(raw_len));
+    
+    uLongf dlen = r->hdr.keyframe_size;
+    return raw_len == r->hdr.keyframe_size &&
+           uncompress(r->raw, &dlen, payload + sizeof(raw_len), rec.len - sizeof(raw_len)) == Z_OK &&
+           dlen == raw_len;
+}
+
+/* Make the private arena the one game.c works on */
+static void replay_bind(const Replay *r) {
+    g_state = r->mem;
+    state_bind();
+}
+
+/* The keyframe's GameState is copied over the arena whole, so its offsets and
+ * counts must fit the layout the file's config gives */
+static bool key_fits(const Replay *r) {
+    const GameState *key = (const GameState *)r->raw;
+    const GameState *st = &r->layout;
+    size_t cells = (size_t)st->cfg.grid_size * st->cfg.grid_size;
+    size_t blocks = (size_t)st->spawn_side * st->spawn_side;
+    
+    /* map_off up to delta_stride are all size_t */
+    return memcmp(&key->map_off, &st->map_off,
+                  offsetof(GameState, dirty_count) - offsetof(GameState, map_off)) == 0 &&
+           key->cfg.grid_size == st->cfg.grid_size &&
+           key->cfg.max_players == st->cfg.max_players &&
+           key->cfg.max_snake_len == st->cfg.max_snake_len &&
+           key->spawn_side == st->spawn_side &&
+           key->dirty_count >= 0 && (size_t)key->dirty_count <= cells &&
+           key->free_cell_count >= 0 && (size_t)key->free_cell_count <= cells &&
+           key->clear_count >= 0 && (size_t)key->clear_count <= blocks &&
+           key->player_count >= 0 && key->player_count <= st->cfg.max_players &&
+           key->free_count >= 0 && key->free_count <= st->cfg.max_players &&
+           key->food_count >= 0 && key->food_count <= MAX_FOOD;
+}
+
+static bool load_key(Replay *r, size_t off) {
+    if (!inflate_key(r, off) || !key_fits(r)) return false;
+    memcpy(r->mem, r->raw, sizeof(GameState));
+    memcpy((uint8_t *)r->mem + g_state->map_off, r->raw + sizeof(GameState),
+           r->hdr.keyframe_size - sizeof(GameState));
+    state_bind();
+    
+    ReplayRecord rec;
+    read_record(r, off, &rec);
+    r->pos = off + sizeof(rec) + rec.len;
+    return true;
+}
+
+/* Does the re-simulated state equal the keyframe in r->raw? pending_dir, the
+ * input acks and the input queue are left out: workers write them at any
+ * time, and playback sets only the direction, per tick. */
+static bool state_matches(const Replay *r) {
+    const GameState *key = (const GameState *)r->raw;
+    const uint8_t *arrays = r->raw + sizeof(GameState) - g_state->map_off;
+    size_t cells = (size_t)g_cfg.grid_size * g_cfg.grid_size;
+    size_t blocks = (size_t)g_state->spawn_side * g_state->spawn_side;
+    
+    if (key->tick != g_state->tick || key->rng != g_state->rng ||
+        key->food_count != g_state->food_count ||
+        memcmp(key->foods, g_state->foods, sizeof(key->foods)) != 0 ||
+        key->player_count != g_state->player_count || key->free_count != g_state->free_count ||
+        key->next_player_id != g_state->next_player_id ||
+        key->free_cell_count != g_state->free_cell_count ||
+        key->clear_count != g_state->clear_count) return false;
+    
+    if (memcmp(arrays + g_state->map_off, g_map, cells * sizeof(MapCell)) != 0 ||
+        memcmp(arrays + g_state->grid_off, g_grid, cells * sizeof(GridCell)) != 0 ||
+        memcmp(arrays + g_state->free_cells_off, g_free_cells,
+               g_state->free_cell_count * sizeof(uint16_t)) != 0 ||
+        memcmp(arrays + g_state->blocks_off, g_blocks, blocks * sizeof(SpawnBlock)) != 0 ||
+        memcmp(arrays + g_state->clear_off, g_clear_blocks,
+               g_state->clear_count * sizeof(uint16_t)) != 0 ||
+        memcmp(arrays + g_state->bodies_off, g_bodies,
+               (size_t)g_cfg.max_players * g_cfg.max_snake_len * sizeof(Position)) != 0 ||
+        memcmp(arrays + g_state->active_off, g_active,
+               g_state->player_count * sizeof(uint16_t)) != 0 ||
+        memcmp(arrays + g_state->free_off, g_free_slots,
+               g_state->free_count * sizeof(uint16_t)) != 0) return false;
+    
+    for (int p = 0; p < g_cfg.max_players; p++) {
+        Player pl;
+        memcpy(&pl, arrays + g_state->players_off + p * sizeof(Player), sizeof(pl));
+        pl.pending_seq = g_players[p].pending_seq;
+        pl.applied_seq = g_players[p].applied_seq;
+        pl.applied_tick = g_players[p].applied_tick;
+        memcpy(pl.queue_seq, g_players[p].queue_seq, sizeof(pl.queue_seq));
+        memcpy(pl.queue_dir, g_players[p].queue_dir, sizeof(pl.queue_dir));
+        pl.queue_head = g_players[p].queue_head;
+        pl.queue_tail = g_players[p].queue_tail;
+        if (memcmp(&pl, &g_players[p], sizeof(pl)) != 0) return false;
+        
+        Snake s;
+        memcpy(&s, arrays + g_state->snakes_off + p * sizeof(Snake), sizeof(s));
+        s.pending_dir = g_snakes[p].pending_dir;
+        if (memcmp(&s, &g_snakes[p], sizeof(s)) != 0) return false;
+    }
+    return true;
+}
+
+/* One recorded tick, as game_tick() plus the game loop's food spawn ran it */
+static void simulate(const ReplayRecord *rec, const uint8_t *payload) {
+    respawn_snakes();
+    
+    for (int a = 0; a < g_state->player_count; a++) {
+        Snake *s = &g_snakes[g_active[a]];
+        s->pending_dir = s->direction;
+    }
+    for (int i = 0; i < rec->count; i++) {
+        ReplayTurn turn;
+        memcpy(&turn, payload + i * sizeof(turn), sizeof(turn));
+        if (turn.slot < g_cfg.max_players) g_snakes[turn.slot].pending_dir = turn.dir;
+    }
+    
+    for (int a = 0; a < g_state->player_count; a++) {
+        int p = g_active[a];
+        if (g_snakes[p].alive) {
+            move_snake(&g_players[p]);
+        }
+    }
+    check_collisions();
+    if (rec->flags & REPLAY_FOOD) spawn_food();
+    
+    /* Stand in for the publisher */
+    for (int i = 0; i < g_state->dirty_count; i++) {
+        g_grid[g_dirty[i]].dirty = false;
+    }
+    g_state->dirty_count = 0;
+    g_state->tick = rec->tick;
+}
+
+/* Map `path` and index it; the private arena is bound at the first
+ * keyframe. Returns NULL with a message printed on failure. */
+Replay *replay_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ReplayHeader)) {
+        fprintf(stderr, "%s: not a replay\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    
+    Replay *r = calloc(1, sizeof(Replay));
+    if (!r) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    g_game_quiet = true;
+    r->data = data;
+    r->map_size = r->size = st.st_size;
+    memcpy(&r->hdr, data, sizeof(r->hdr));
+    
+    const GameConfig *cfg = &r->hdr.cfg;
+    bool valid = r->hdr.magic == REPLAY_MAGIC && r->hdr.state_size == sizeof(GameState) &&
+                 cfg->grid_size >= MIN_GRID_SIZE && cfg->grid_size <= MAX_GRID_SIZE &&
+                 cfg->max_players > 0 && cfg->max_players <= MAX_PLAYERS_LIMIT &&
+                 cfg->max_snake_len > 0;
+    if (valid) {
+        state_layout(&r->layout, cfg);
+        valid = r->hdr.keyframe_size == keyframe_size(&r->layout);
+    }
+    if (!valid) {
+        fprintf(stderr, "%s: not a replay from this build\n", path);
+        replay_close(r);
+        return NULL;
+    }
+    
+    /* Index the keyframes; a record cut short (recording still running, or
+     * the server died) ends the file */
+    size_t key_cap = 64;
+    r->keys = malloc(key_cap * sizeof(size_t));
+    r->key_ticks = malloc(key_cap * sizeof(uint64_t));
+    size_t off = sizeof(ReplayHeader);
+    while (r->keys && r->key_ticks && off + sizeof(ReplayRecord) <= r->size) {
+        ReplayRecord rec;
+        read_record(r, off, &rec);
+        if (rec.len > r->size - off - sizeof(rec)) break;
+        /* Nor may a tick claim more turns than it holds */
+        if (rec.type == REPLAY_TICK && (size_t)rec.count * sizeof(ReplayTurn) > rec.len) break;
+        
+        if (rec.type == REPLAY_KEYFRAME) {
+            if ((size_t)r->key_count == key_cap) {
+                key_cap *= 2;
+                r->keys = realloc(r->keys, key_cap * sizeof(size_t));
+                r->key_ticks = realloc(r->key_ticks, key_cap * sizeof(uint64_t));
+                if (!r->keys || !r->key_ticks) break;
+            }
+            r->keys[r->key_count] = off;
+            r->key_ticks[r->key_count++] = rec.tick;
+        } else if (rec.type == REPLAY_TICK) {
+            r->last_tick = rec.tick;
+        }
+        off += sizeof(rec) + rec.len;
+    }
+    r->size = off;
+    
+    r->mem = NULL;
+    if (posix_memalign(&r->mem, 64, r->layout.snapshots_off) != 0) r->mem = NULL;
+    r->raw = malloc(r->hdr.keyframe_size);
+    if (!r->keys || !r->key_ticks || !r->mem || !r->raw) {
+        perror("malloc");
+        replay_close(r);
+        return NULL;
+    }
+    if (r->key_count == 0) {
+        fprintf(stderr, "%s: no keyframes\n", path);
+        replay_close(r);
+        return NULL;
+    }
+    
+    memset(r->mem, 0, r->layout.snapshots_off);
+    memcpy(r->mem, &r->layout, sizeof(r->layout));
+    replay_bind(r);
+    if (!load_key(r, r->keys[0])) {
+        fprintf(stderr, "%s: damaged keyframe\n", path);
+        replay_close(r);
+        return NULL;
+    }
+    if (r->last_tick < g_state->tick) r->last_tick = g_state->tick;
+    return r;
+}
+
+void replay_close(Replay *r) {
+    if (!r) return;
+    munmap(r->data, r->map_size);
+    free(r->keys);
+    free(r->key_ticks);
+    free(r->mem);
+    free(r->raw);
+    free(r);
+}
+
+const GameConfig *replay_config(const Replay *r) {
+    return &r->hdr.cfg;
+}
+
+/* Ticks that can be shown: the state ending each of them */
+uint64_t replay_first_tick(const Replay *r) {
+    return r->key_ticks[0] - 1;
+}
+
+uint64_t replay_last_tick(const Replay *r) {
+    return r->last_tick;
+}
+
+uint64_t replay_tick(const Replay *r) {
+    return ((const GameState *)r->mem)->tick;
+}
+
+/* Play the next tick. Returns 1, 0 at the end of the file, -1 on a damaged
+ * keyframe. Ticks missing from the recording are skipped up to the keyframe
+ * that follows them. */
+int replay_step(Replay *r) {
+    replay_bind(r);
+    
+    while (r->pos < r->size) {
+        ReplayRecord rec;
+        read_record(r, r->pos, &rec);
+        const uint8_t *payload = r->data + r->pos + sizeof(rec);
+        size_t next = r->pos + sizeof(rec) + rec.len;
+        
+        if (rec.type == REPLAY_KEYFRAME) {
+            /* A periodic keyframe in sequence changes nothing */
+            if (rec.flags == REPLAY_PERIODIC && rec.tick == g_state->tick + 1) {
+                if (r->verify) {
+                    if (!inflate_key(r, r->pos)) return -1;
+                    r->checked++;
+                    if (!state_matches(r)) {
+                        fprintf(stderr, "state differs from the keyframe at tick %llu\n",
+                                (unsigned long long)rec.tick);
+                        r->mismatches++;
+                        if (!load_key(r, r->pos)) return -1;
+                        continue;
+                    }
+                }
+                r->pos = next;
+                continue;
+            }
+            if (!load_key(r, r->pos)) return -1;
+            continue;
+        }
+        
+        r->pos = next;
+        if (rec.type == REPLAY_TICK && rec.tick == g_state->tick + 1) {
+            simulate(&rec, payload);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Go to the state ending `tick` (clamped to what was recorded): load the
+ * last keyframe taken before it and re-simulate the rest. A keyframe taken
+ * just after `tick` would already hold the joins that followed it. */
+bool replay_seek(Replay *r, uint64_t tick) {
+    if (tick < replay_first_tick(r)) tick = replay_first_tick(r);
+    if (tick > r->last_tick) tick = r->last_tick;
+    
+    int lo = 0, hi = r->key_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (r->key_ticks[mid] <= tick) lo = mid;
+        else hi = mid - 1;
+    }
+    
+    replay_bind(r);
+    if (!load_key(r, r->keys[lo])) return false;
+    while (g_state->tick < tick) {
+        if (replay_step(r) <= 0) break;
+    }
+    return g_state->tick == tick;
+}
+
+const MapCell *replay_map(const Replay *r) {
+    return (const MapCell *)((const uint8_t *)r->mem + ((const GameState *)r->mem)->map_off);
+}
+
+/* The player in `slot`, or NULL if the slot is free */
+const Player *replay_player(const Replay *r, int slot, bool *alive) {
+    const GameState *st = r->mem;
+    if (slot < 0 || slot >= st->cfg.max_players) return NULL;
+    const Snake *s = (const Snake *)((const uint8_t *)r->mem + st->snakes_off) + slot;
+    if (!s->active) return NULL;
+    *alive = s->alive;
+    return (const Player *)((const uint8_t *)r->mem + st->players_off) + slot;
+}
+
+/* Play the whole file from the start, checking the re-simulated state
+ * against every periodic keyframe. Returns the number that differed, or -1
+ * if the file is damaged. */
+int replay_verify(Replay *r, int *checked) {
+    replay_bind(r);
+    if (!load_key(r, r->keys[0])) return -1;
+    
+    r->verify = true;
+    r->checked = r->mismatches = 0;
+    int ret;
+    while ((ret = replay_step(r)) > 0);
+    r->verify = false;
+    
+    *checked = r->checked;
+    return ret < 0 ? -1 : r->mismatches;
+}
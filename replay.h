@@ -0,0 +1,88 @@
+/**
+ * replay.h - Replay Recording and Playback
+ *
+ * A replay file is a ReplayHeader followed by records. The game loop appends
+ * one REPLAY_TICK record per tick with the turns the tick applied, and a
+ * REPLAY_KEYFRAME with the whole simulation state every
+ * REPLAY_KEYFRAME_INTERVAL ticks and whenever players joined or left since
+ * the last tick. Playback loads the nearest keyframe and re-runs the ticks
+ * with the game's own respawn, move and collision code.
+ *
+ * `tick` on both records is the tick about to be simulated: a keyframe holds
+ * the state as of the end of tick - 1.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "common.h"
+
+#define REPLAY_MAGIC             0x53525031   /* "SRP1" */
+#define REPLAY_KEYFRAME_INTERVAL 100          /* Ticks (10 s) between keyframes */
+#define REPLAY_QUEUE_SIZE        (8u << 20)   /* Ring between tick and writer thread */
+#define REPLAY_WRITE_CHUNK       (1u << 20)   /* write() size */
+
+typedef struct {
+    uint32_t magic;           /* REPLAY_MAGIC */
+    uint32_t state_size;      /* sizeof(GameState) of the recording build */
+    uint32_t keyframe_size;   /* Uncompressed keyframe bytes */
+    uint32_t keyframe_interval;
+    GameConfig cfg;
+} ReplayHeader;
+
+enum {
+    REPLAY_TICK = 1,          /* ReplayTurn[count] */
+    REPLAY_KEYFRAME = 2       /* uint32_t raw length, then the zlib stream */
+};
+
+/* REPLAY_TICK flags */
+#define REPLAY_FOOD      0x01   /* spawn_food() ran after the tick */
+
+/* REPLAY_KEYFRAME flags: why it was taken */
+#define REPLAY_PERIODIC  0x01   /* Interval only: re-simulation must match it */
+#define REPLAY_ROSTER    0x02   /* Players joined or left */
+#define REPLAY_RESYNC    0x04   /* First one, or records were dropped before it */
+
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t count;           /* REPLAY_TICK: turns */
+    uint32_t len;             /* Payload bytes after this header */
+    uint64_t tick;
+} ReplayRecord;
+
+/* A snake that moved in a direction other than the one it came in with (or
+ * that respawned this tick) */
+typedef struct {
+    uint16_t slot;
+    uint8_t dir;
+    uint8_t pad;
+} ReplayTurn;
+
+/* Recording, driven by the game loop on the bound arena. replay_begin_tick()
+ * and replay_end_tick() bracket game_tick() (food included) under the state
+ * lock; they only copy into a lock-free queue, the file is compressed and
+ * written by a background thread. */
+typedef struct ReplayWriter ReplayWriter;
+
+ReplayWriter *replay_writer_open(const char *path);
+void replay_begin_tick(ReplayWriter *w);
+void replay_end_tick(ReplayWriter *w, bool food);
+void replay_writer_close(ReplayWriter *w);
+
+/* Playback on a private arena, which becomes the bound one */
+typedef struct Replay Replay;
+
+Replay *replay_open(const char *path);
+void replay_close(Replay *r);
+const GameConfig *replay_config(const Replay *r);
+uint64_t replay_first_tick(const Replay *r);
+uint64_t replay_last_tick(const Replay *r);
+uint64_t replay_tick(const Replay *r);
+bool replay_seek(Replay *r, uint64_t tick);
+int replay_step(Replay *r);
+const MapCell *replay_map(const Replay *r);
+const Player *replay_player(const Replay *r, int slot, bool *alive);
+int replay_verify(Replay *r, int *checked);
+
+#endif /* REPLAY_H */
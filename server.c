@@ -3,651 +3,2997 @@
  * 
  * Architecture:
  * - Master Process: Accept connections, dispatch to workers
- * - Game Loop Process: Update game state, move snakes, auto-respawn
- * - Worker Processes (Prefork): Handle client I/O
+ * - Game Loop Processes: Update game state, move snakes, auto-respawn; each
+ *   ticks its share of the arenas
+ * - Worker Processes (Prefork): Handle client I/O, placing each player in an
+ *   arena at login
  * 
- * IPC: System V Shared Memory with process-shared mutex
+ * IPC: POSIX Shared Memory with process-shared mutex, one segment per arena
+ *
+ * ./server --takeover replaces a running server without dropping anyone: the
+ * new one attaches to the live segments and is handed the listening sockets
+ * and every client connection (see Hot Restart).
+ *
+ * With --relay the server hosts no game: a relay feed process takes the place
+ * of the game loops and fills one arena's frames from an upstream server, and
+ * the workers serve them to spectators.
  */
 
+#define _GNU_SOURCE   /* struct ucred, for SO_PEERCRED */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/random.h>
+#include <poll.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <zlib.h>
 
 #include "common.h"
 #include "proto.h"
+#include "game.h"
+#include "replay.h"
 
 /* ============================================================================
  * Global Variables
  * ============================================================================ */
 
-static int g_shmid = -1;
-static GameState *g_state = NULL;
-static int g_server_fd = -1;
-static pid_t g_workers[NUM_WORKERS];
-static pid_t g_game_loop_pid = 0;
+static int g_seg_ids[MAX_ARENAS];      /* SHM_*_ID of each arena's segment, -1 if none */
+static size_t g_seg_sizes[MAX_ARENAS]; /* Bytes mapped */
+static GameState *g_arenas[MAX_ARENAS];  /* Mapped before forking, so in every process */
+static int g_num_arenas = 1;
+static int g_arena = 0;               /* Index of the bound arena (g_state) */
+static int g_server_fd = -1;          /* This worker's listener */
+static int g_listen_fds[MAX_WORKERS]; /* One per worker (the same fd if shared) */
+static int g_num_workers = 0;
+static int g_worker_id = -1;
+static pid_t g_workers[MAX_WORKERS];
+static int g_num_loops = 0;           /* Game loop processes */
+static pid_t g_game_loops[MAX_ARENAS];
 static volatile int g_running = 1;
+static int g_use_epoll = 1;
+static int g_tick_fds[MAX_WORKERS];  /* eventfd per worker, signalled every tick */
+
+static int g_tick_threads = 1;        /* Threads simulating each tick */
+static int g_metrics_id = -1;
+static ServerMetrics *g_metrics = NULL;
+static WorkerMetrics *g_wm = NULL;    /* This worker's slot in g_metrics */
+
+/* Relay mode (--relay HOST:PORT): the upstream connection and what it carries */
+static bool g_relay = false;
+static int g_upstream_fd = -1;
+static int g_upstream_arena = 0;      /* Arena number upstream */
+
+static const char *g_record_path = NULL;  /* --record: replay file (per arena) */
+static int g_bot_target = 0;              /* --bots: snakes kept in every arena */
+
+/* Shared memory options and hot restart (see Hot Restart) */
+static bool g_hugepages = false;          /* --hugepages: back segments with THP */
+static bool g_mlock = false;              /* --mlock: keep segments resident */
+static int g_port = 0;
+static int g_control_fd = -1;             /* Master: where a --takeover server calls */
+static int g_handoff_fds[MAX_WORKERS];    /* Where old worker i hands over its clients */
+static volatile int g_handoff = 0;        /* SIGUSR2: stop and hand over */
+static bool g_segments_ours = true;       /* False while a takeover is under way */
+
+/* Game loop process only: per arena, the last published map and scoreboard
+ * (for deltas) and roster */
+typedef struct {
+    MapCell *prev_map;
+    PlayerChange *prev_players;
+    PlayerChange *cur_players;
+    uint32_t *roster_ids;     /* Player id per slot as published, 0 if free */
+    uint16_t *roster_slots;   /* Published slots in ascending order */
+    int roster_count;
+    uint64_t last_food_spawn;
+    ReplayWriter *replay;     /* With --record */
+    uint16_t *bots;           /* Slots of the arena's bots, oldest first */
+    int bot_count;
+} Publisher;
+
+static Publisher g_pubs[MAX_ARENAS];
+static Publisher *g_pub = &g_pubs[0]; /* The bound arena's */
+
+/* Game loop process only: payload scratch space, shared by its arenas */
+static uint8_t *g_update_payload;
+static uint8_t *g_delta_payload;
 
 /* ============================================================================
  * Utility Functions
  * ============================================================================ */
 
-static void msleep(int ms) {
-    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
-    nanosleep(&ts, NULL);
+static void timespec_add_ms(struct timespec *ts, int ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* a - b in milliseconds */
+static int64_t timespec_diff_ms(const struct timespec *a, const struct timespec *b) {
+    return (int64_t)(a->tv_sec - b->tv_sec) * 1000 + (a->tv_nsec - b->tv_nsec) / 1000000;
 }
 
-static uint64_t get_time_ms(void) {
+static uint64_t get_time_ns(void) {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 /* ============================================================================
- * Game Initialization
+ * Histograms
  * ============================================================================ */
 
-static void init_map(void) {
-    memset(g_state->map, CELL_EMPTY, sizeof(g_state->map));
-    
-    for (int x = 0; x < GRID_SIZE; x++) {
-        g_state->map[0][x] = CELL_WALL;
-        g_state->map[GRID_SIZE - 1][x] = CELL_WALL;
-    }
-    for (int y = 0; y < GRID_SIZE; y++) {
-        g_state->map[y][0] = CELL_WALL;
-        g_state->map[y][GRID_SIZE - 1] = CELL_WALL;
-    }
+static void hist_add(Histogram *h, uint64_t v) {
+    int b = v ? 63 - __builtin_clzll(v) : 0;
+    if (b >= HIST_BUCKETS) b = HIST_BUCKETS - 1;
+    h->buckets[b]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
 }
 
-static void spawn_food(void) {
-    if (g_state->food_count >= MAX_FOOD) return;
-    
-    for (int attempt = 0; attempt < 100; attempt++) {
-        int x = 1 + rand() % (GRID_SIZE - 2);
-        int y = 1 + rand() % (GRID_SIZE - 2);
-        
-        if (g_state->map[y][x] == CELL_EMPTY) {
-            for (int i = 0; i < MAX_FOOD; i++) {
-                if (!g_state->foods[i].active) {
-                    g_state->foods[i].pos.x = x;
-                    g_state->foods[i].pos.y = y;
-                    g_state->foods[i].active = true;
-                    g_state->food_count++;
-                    return;
-                }
-            }
+/* Upper bound of the bucket holding the pct-th percentile */
+static uint64_t hist_percentile(const Histogram *h, double pct) {
+    uint64_t want = (uint64_t)(h->count * pct / 100.0);
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > want) {
+            uint64_t bound = (2ULL << b) - 1;
+            return bound < h->max ? bound : h->max;
         }
     }
+    return h->max;
 }
 
-static bool find_spawn_pos(int *out_x, int *out_y) {
-    for (int attempt = 0; attempt < 100; attempt++) {
-        int x = 5 + rand() % (GRID_SIZE - 10);
-        int y = 5 + rand() % (GRID_SIZE - 10);
-        
-        bool clear = true;
-        for (int dy = -2; dy <= 2 && clear; dy++) {
-            for (int dx = -2; dx <= 2 && clear; dx++) {
-                int nx = x + dx, ny = y + dy;
-                if (nx < 1 || nx >= GRID_SIZE-1 || ny < 1 || ny >= GRID_SIZE-1) continue;
-                uint8_t cell = g_state->map[ny][nx];
-                if (cell != CELL_EMPTY && cell != CELL_FOOD) {
-                    clear = false;
-                }
-            }
-        }
-        
-        if (clear) {
-            *out_x = x;
-            *out_y = y;
-            return true;
-        }
+/* ============================================================================
+ * Shared Locks
+ * ============================================================================ */
+
+static void shm_lock_init(ShmLock *l, const pthread_mutexattr_t *attr) {
+    pthread_mutex_init(&l->mutex, attr);
+    memset(&l->stats, 0, sizeof(l->stats));
+}
+
+/* Lock, counting the acquisition and, if it had to wait, for how long */
+static void shm_lock(ShmLock *l) {
+    uint64_t start = 0;
+    bool contended = pthread_mutex_trylock(&l->mutex) != 0;
+    if (contended) {
+        start = get_time_ns();
+        pthread_mutex_lock(&l->mutex);
     }
     
-    *out_x = GRID_SIZE / 2;
-    *out_y = GRID_SIZE / 2;
-    return false;
+    l->acquired_ns = get_time_ns();
+    l->stats.acquisitions++;
+    if (contended) {
+        l->stats.contended++;
+        l->stats.wait_ns += l->acquired_ns - start;
+        hist_add(&l->stats.wait_hist, l->acquired_ns - start);
+    }
 }
 
-static void init_snake(Player *player, int spawn_x, int spawn_y) {
-    Snake *s = &player->snake;
-    memset(s, 0, sizeof(Snake));
-    
-    s->direction = DIR_RIGHT;
-    s->pending_dir = DIR_RIGHT;
-    s->alive = true;
-    s->length = 3;
-    s->head_idx = 2;
-    
-    s->body[2].x = spawn_x;
-    s->body[2].y = spawn_y;
-    s->body[1].x = spawn_x - 1;
-    s->body[1].y = spawn_y;
-    s->body[0].x = spawn_x - 2;
-    s->body[0].y = spawn_y;
-    
-    player->spawn_protection = PROTECTION_TICKS;
-    player->respawn_timer = 0;
+static void shm_unlock(ShmLock *l) {
+    uint64_t held = get_time_ns() - l->acquired_ns;
+    l->stats.hold_ns += held;
+    if (held > l->stats.max_hold_ns) {
+        l->stats.max_hold_ns = held;
+    }
+    hist_add(&l->stats.hold_hist, held);
+    pthread_mutex_unlock(&l->mutex);
+}
+
+static void print_lock_stats(const char *name, const LockStats *st) {
+    uint64_t n = st->acquisitions ? st->acquisitions : 1;
+    printf("[SERVER] %s lock: %llu acquisitions, %llu contended (%.1f%%), "
+           "avg wait %llu ns, avg hold %llu ns, max hold %llu ns\n",
+           name, (unsigned long long)st->acquisitions,
+           (unsigned long long)st->contended, 100.0 * st->contended / n,
+           (unsigned long long)(st->contended ? st->wait_ns / st->contended : 0),
+           (unsigned long long)(st->hold_ns / n),
+           (unsigned long long)st->max_hold_ns);
+}
+
+/* ============================================================================
+ * Shared State Setup
+ * ============================================================================ */
+
+#define HUGE_PAGE_SIZE  (2u << 20)
+
+/* POSIX shared memory object name of segment `id` of the server on g_port */
+static void segment_name(char *name, size_t len, int id) {
+    snprintf(name, len, SHM_NAME_PREFIX "%d-%02x", g_port, id);
 }
 
-static void add_chat_message(uint32_t sender_id, const char *sender_name, const char *text) {
-    int idx = g_state->chat_count % MAX_CHAT_HISTORY;
+/* Pin a segment in RAM and fault in this process's page tables for it, so
+ * touching it never faults. Failing (RLIMIT_MEMLOCK) only costs that. */
+static void lock_segment(void *mem, size_t size) {
+    if (mlock(mem, size) < 0) {
+        fprintf(stderr, "[SERVER] mlock of %zu KB failed (%s), segment stays pageable\n",
+                size / 1024, strerror(errno));
+    }
+}
+
+/* Map segment `id`: a new object of *size bytes, or with `attach` the one a
+ * running server made (*size is set to its length). Returns NULL on error. */
+static void *map_segment(int id, size_t *size, bool attach) {
+    char name[48];
+    segment_name(name, sizeof(name), id);
     
-    g_state->chat_history[idx].sender_id = sender_id;
-    strncpy(g_state->chat_history[idx].sender_name, sender_name, MAX_NAME_LEN - 1);
-    g_state->chat_history[idx].sender_name[MAX_NAME_LEN - 1] = '\0';
-    strncpy(g_state->chat_history[idx].text, text, MAX_CHAT_LEN - 1);
-    g_state->chat_history[idx].text[MAX_CHAT_LEN - 1] = '\0';
-    g_state->chat_history[idx].timestamp = get_time_ms();
+    int fd;
+    if (attach) {
+        fd = shm_open(name, O_RDWR, 0);
+    } else {
+        /* Left over from a crash: drop it. A server still using it keeps its
+         * own mapping. */
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "shm_open %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
     
-    g_state->chat_count++;
+    struct stat st;
+    if (attach) {
+        if (fstat(fd, &st) < 0) st.st_size = 0;
+        *size = st.st_size;
+    } else if (g_hugepages) {
+        *size = (*size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    }
+    if (*size == 0 || (!attach && ftruncate(fd, *size) < 0)) {
+        fprintf(stderr, "shm %s: %s\n", name, *size ? strerror(errno) : "empty");
+        close(fd);
+        return NULL;
+    }
     
-    printf("[CHAT] %s: %s\n", sender_name, text);
+    /* Huge pages have to be asked for before the first touch, so then the
+     * pages come in when the state is initialized instead */
+    void *mem = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | (g_hugepages ? 0 : MAP_POPULATE), fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    if (g_hugepages && madvise(mem, *size, MADV_HUGEPAGE) < 0) {
+        fprintf(stderr, "[SERVER] madvise(MADV_HUGEPAGE): %s, using small pages\n",
+                strerror(errno));
+    }
+    return mem;
+}
+
+/* Make arena `a` the one g_state and the game.c arrays refer to */
+static void arena_bind(int a) {
+    if (g_state == g_arenas[a]) return;
+    g_arena = a;
+    g_state = g_arenas[a];
+    g_pub = &g_pubs[a];
+    state_bind();
 }
 
-static void init_game_state(void) {
-    memset(g_state, 0, sizeof(GameState));
+/* Set up arena `a` in its fresh segment and bind it. `layout` carries the
+ * configuration and offsets from state_layout(). */
+static void init_game_state(int a, const GameState *layout) {
+    g_arena = a;
+    g_state = g_arenas[a];
+    g_pub = &g_pubs[a];
+    memset(g_state, 0, layout->shm_size);
+    memcpy(g_state, layout, sizeof(GameState));
+    state_bind();
     
     pthread_mutexattr_init(&g_state->lock_attr);
     pthread_mutexattr_setpshared(&g_state->lock_attr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&g_state->lock, &g_state->lock_attr);
+    shm_lock_init(&g_state->lock, &g_state->lock_attr);
     
-    g_state->next_player_id = 1;
     g_state->running = 1;
+    game_init();
     
-    init_map();
+    g_state->header_size = sizeof(GameState);
+    g_state->version = STATE_VERSION;
+    __sync_synchronize();
+    g_state->magic = STATE_MAGIC;
+}
+
+/* Whether arena `a`, mapped from a running server, is laid out as this
+ * build would lay it out for `cfg` */
+static bool state_compatible(int a, const GameConfig *cfg) {
+    const GameState *st = g_arenas[a];
+    if (g_seg_sizes[a] < sizeof(GameState) || st->magic != STATE_MAGIC ||
+        st->version != STATE_VERSION || st->header_size != sizeof(GameState)) return false;
     
-    for (int i = 0; i < MAX_FOOD / 2; i++) {
-        spawn_food();
-    }
+    GameState layout;
+    memset(&layout, 0, sizeof(layout));
+    state_layout(&layout, cfg);
+    return layout.shm_size <= g_seg_sizes[a] &&
+           memcmp(&layout.cfg, &st->cfg,
+                  offsetof(GameState, dirty_count) - offsetof(GameState, cfg)) == 0;
 }
 
 /* ============================================================================
- * Game Logic
+ * Frame Publishing (game loop)
  * ============================================================================ */
 
-static Position snake_head(const Snake *s) {
-    return s->body[s->head_idx];
+/* Scoreboard entry for slot j as sent to clients */
+static void build_player_entry(int j, PlayerChange *pc) {
+    const Player *p = &g_players[j];
+    
+    memset(pc, 0, sizeof(*pc));
+    pc->slot = j;
+    pc->alive = g_snakes[j].alive ? 1 : 0;
+    pc->score = p->score;
+}
+
+static size_t encode_player_join(uint8_t *out, int j) {
+    const Player *p = &g_players[j];
+    PlayerJoin ev;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.slot = j;
+    ev.player_id = p->id;
+    ev.color = p->color;
+    memcpy(ev.name, p->name, MAX_NAME_LEN);
+    return encode_packet(out, OP_PLAYER_JOIN, &ev, sizeof(ev));
 }
 
-static void move_snake(Snake *s) {
-    if (!s->alive) return;
+/* Encode OP_PLAYER_LEAVE / OP_PLAYER_JOIN for every slot whose occupant
+ * changed since the last tick and update g_pub's roster_ids and
+ * roster_slots. Returns the bytes written to `out`. */
+static uint32_t build_roster_events(uint8_t *out) {
+    uint8_t *p = out;
+    int a = 0, r = 0;
     
-    int opposite[4] = { DIR_DOWN, DIR_UP, DIR_RIGHT, DIR_LEFT };
-    if (s->pending_dir != opposite[s->direction]) {
-        s->direction = s->pending_dir;
+    /* Only slots taken now or at the last tick can have changed: walk both
+     * ascending lists together */
+    while (a < g_state->player_count || r < g_pub->roster_count) {
+        int ja = a < g_state->player_count ? g_active[a] : g_cfg.max_players;
+        int jr = r < g_pub->roster_count ? g_pub->roster_slots[r] : g_cfg.max_players;
+        int j = ja < jr ? ja : jr;
+        if (ja == j) a++;
+        if (jr == j) r++;
+        
+        uint32_t id = ja == j ? g_players[j].id : 0;
+        if (id == g_pub->roster_ids[j]) continue;
+        
+        if (g_pub->roster_ids[j]) {
+            PlayerLeave ev = { .slot = j, .player_id = g_pub->roster_ids[j] };
+            p += encode_packet(p, OP_PLAYER_LEAVE, &ev, sizeof(ev));
+        }
+        if (id) {
+            p += encode_player_join(p, j);
+            /* Clients know nothing about the newcomer: force its entry out */
+            memset(&g_pub->prev_players[j], 0xFF, sizeof(PlayerChange));
+        }
+        g_pub->roster_ids[j] = id;
     }
     
-    Position head = snake_head(s);
-    Position new_head = head;
+    g_pub->roster_count = g_state->player_count;
+    memcpy(g_pub->roster_slots, g_active, g_pub->roster_count * sizeof(uint16_t));
+    return p - out;
+}
+
+/* Encode the full map and the active players' entries (g_pub->cur_players)
+ * into an OP_MAP_UPDATE payload. Returns the payload length. */
+static uint32_t build_map_update(uint64_t tick, uint8_t *payload) {
+    MapUpdateHeader *hdr = (MapUpdateHeader *)payload;
+    uint8_t *rle = payload + sizeof(MapUpdateHeader);
+    size_t map_bytes = map_rle_encode(g_map, (size_t)g_cfg.grid_size * g_cfg.grid_size, rle);
+    PlayerChange *players = (PlayerChange *)(rle + map_bytes);
+    int player_count = 0;
     
-    switch (s->direction) {
-        case DIR_UP:    new_head.y--; break;
-        case DIR_DOWN:  new_head.y++; break;
-        case DIR_LEFT:  new_head.x--; break;
-        case DIR_RIGHT: new_head.x++; break;
+    for (int r = 0; r < g_pub->roster_count; r++) {
+        players[player_count++] = g_pub->cur_players[g_pub->roster_slots[r]];
     }
     
-    s->head_idx = (s->head_idx + 1) % MAX_SNAKE_LEN;
-    s->body[s->head_idx] = new_head;
+    hdr->tick = tick;
+    hdr->width = g_cfg.grid_size;
+    hdr->height = g_cfg.grid_size;
+    hdr->map_bytes = map_bytes;
+    hdr->player_count = player_count;
+    
+    return sizeof(MapUpdateHeader) + map_bytes + player_count * sizeof(PlayerChange);
 }
 
-static void rebuild_map(void) {
-    /* Clear interior */
-    for (int y = 1; y < GRID_SIZE - 1; y++) {
-        for (int x = 1; x < GRID_SIZE - 1; x++) {
-            g_state->map[y][x] = CELL_EMPTY;
-        }
-    }
+/* Diff the map and the active players' scoreboard entries against the last
+ * published tick into an OP_MAP_DELTA payload, visiting only the cells queued
+ * on the dirty list (which is consumed). Returns the payload length, or 0 if
+ * max_delta_cells overflowed. */
+static uint32_t build_map_delta(uint64_t tick, uint8_t *payload) {
+    MapDeltaHeader *hdr = (MapDeltaHeader *)payload;
+    CellChange *cells = (CellChange *)(payload + sizeof(MapDeltaHeader));
+    int cell_count = 0;
+    bool overflow = false;
     
-    /* Place food */
-    for (int i = 0; i < MAX_FOOD; i++) {
-        if (g_state->foods[i].active) {
-            int x = g_state->foods[i].pos.x;
-            int y = g_state->foods[i].pos.y;
-            if (x > 0 && x < GRID_SIZE - 1 && y > 0 && y < GRID_SIZE - 1) {
-                g_state->map[y][x] = CELL_FOOD;
-            }
+    for (int i = 0; i < g_state->dirty_count; i++) {
+        int idx = g_dirty[i];
+        g_grid[idx].dirty = false;
+        
+        /* Cells that changed and changed back need not be sent */
+        if (g_map[idx] == g_pub->prev_map[idx]) continue;
+        g_pub->prev_map[idx] = g_map[idx];
+        if (cell_count == g_cfg.max_delta_cells) {
+            overflow = true;
+            continue;
         }
+        cells[cell_count].x = idx % g_cfg.grid_size;
+        cells[cell_count].y = idx / g_cfg.grid_size;
+        cells[cell_count].cell = g_map[idx];
+        cell_count++;
     }
+    g_state->dirty_count = 0;
+    if (overflow) return 0;
+    
+    PlayerChange *players = (PlayerChange *)(cells + cell_count);
+    int player_count = 0;
     
-    /* Place snakes */
-    for (int p = 0; p < MAX_PLAYERS; p++) {
-        if (!g_state->players[p].active || !g_state->players[p].snake.alive)
+    for (int r = 0; r < g_pub->roster_count; r++) {
+        int j = g_pub->roster_slots[r];
+        if (memcmp(&g_pub->cur_players[j], &g_pub->prev_players[j], sizeof(PlayerChange)) == 0)
             continue;
-        
-        Snake *s = &g_state->players[p].snake;
-        
-        for (int i = 0; i < s->length; i++) {
-            int idx = (s->head_idx - s->length + 1 + i + MAX_SNAKE_LEN) % MAX_SNAKE_LEN;
-            Position pos = s->body[idx];
-            if (pos.x > 0 && pos.x < GRID_SIZE - 1 &&
-                pos.y > 0 && pos.y < GRID_SIZE - 1) {
-                g_state->map[pos.y][pos.x] = CELL_SNAKE_BASE + p;
-            }
-        }
+        players[player_count++] = g_pub->cur_players[j];
     }
+    
+    hdr->tick = tick;
+    hdr->base_tick = tick - 1;
+    hdr->cell_count = cell_count;
+    hdr->player_count = player_count;
+    
+    return sizeof(MapDeltaHeader) +
+           cell_count * sizeof(CellChange) +
+           player_count * sizeof(PlayerChange);
 }
 
-static void check_collisions(void) {
-    for (int p = 0; p < MAX_PLAYERS; p++) {
-        if (!g_state->players[p].active || !g_state->players[p].snake.alive)
-            continue;
-        
-        /* Spawn protection */
-        if (g_state->players[p].spawn_protection > 0) {
-            g_state->players[p].spawn_protection--;
-            continue;
-        }
-        
-        Snake *s = &g_state->players[p].snake;
-        Position head = snake_head(s);
-        
-        /* Wall collision */
-        if (head.x <= 0 || head.x >= GRID_SIZE - 1 ||
-            head.y <= 0 || head.y >= GRID_SIZE - 1) {
-            s->alive = false;
-            g_state->players[p].respawn_timer = RESPAWN_TICKS;
-            printf("[GAME] %s hit wall! Respawning...\n", g_state->players[p].name);
-            continue;
-        }
-        
-        /* Food collision */
-        for (int i = 0; i < MAX_FOOD; i++) {
-            if (g_state->foods[i].active &&
-                g_state->foods[i].pos.x == head.x &&
-                g_state->foods[i].pos.y == head.y) {
-                
-                g_state->players[p].score += 10;
-                if (s->length < MAX_SNAKE_LEN - 1) {
-                    s->length++;
-                }
-                g_state->foods[i].active = false;
-                g_state->food_count--;
-                spawn_food();
-                break;
-            }
-        }
-        
-        /* Snake collision */
-        for (int other = 0; other < MAX_PLAYERS; other++) {
-            if (!g_state->players[other].active || !g_state->players[other].snake.alive)
-                continue;
-            
-            Snake *os = &g_state->players[other].snake;
-            
-            for (int i = 0; i < os->length; i++) {
-                int idx = (os->head_idx - i + MAX_SNAKE_LEN) % MAX_SNAKE_LEN;
-                
-                /* Skip own head */
-                if (p == other && i == 0) continue;
-                
-                if (os->body[idx].x == head.x && os->body[idx].y == head.y) {
-                    s->alive = false;
-                    g_state->players[p].respawn_timer = RESPAWN_TICKS;
-                    printf("[GAME] %s collided! Respawning...\n", g_state->players[p].name);
-                    break;
-                }
-            }
-            if (!s->alive) break;
-        }
+/* Encode this tick's snapshot and delta frames into shared memory, then
+ * advance g_state->tick so workers pick them up. Caller must hold
+ * g_state->lock. */
+static void publish_tick(void) {
+    uint64_t tick = g_state->tick + 1;
+    
+    for (int a = 0; a < g_state->player_count; a++) {
+        build_player_entry(g_active[a], &g_pub->cur_players[g_active[a]]);
+    }
+    
+    MapDeltaFrame *delta = delta_slot(tick);
+    delta->tick = 0;
+    __sync_synchronize();
+    uint32_t events_len = build_roster_events(delta->data);
+    uint32_t delta_len = build_map_delta(tick, g_delta_payload);
+    delta->overflow = (delta_len == 0);
+    delta->len = delta->overflow ? 0 : events_len +
+                 encode_packet(delta->data + events_len, OP_MAP_DELTA, g_delta_payload, delta_len);
+    __sync_synchronize();
+    delta->tick = tick;
+    
+    uint32_t update_len = build_map_update(tick, g_update_payload);
+    
+    SnapshotFrame *snap = snapshot_slot(tick);
+    snap->tick = 0;
+    __sync_synchronize();
+    uint32_t n = encode_packet(snap->data, OP_MAP_UPDATE, g_update_payload, update_len);
+    for (int r = 0; r < g_pub->roster_count; r++) {
+        n += encode_player_join(snap->data + n, g_pub->roster_slots[r]);
     }
+    snap->len = n;
+    snap->zlen = 0;    /* Workers compress it if a client asks */
+    __sync_synchronize();
+    snap->tick = tick;
+    g_state->snapshot_tick = tick;
+    
+    PlayerChange *prev = g_pub->prev_players;
+    g_pub->prev_players = g_pub->cur_players;
+    g_pub->cur_players = prev;
+    
+    __sync_synchronize();
+    g_state->tick = tick;
 }
 
+
 /* ============================================================================
  * Game Loop Process
  * ============================================================================ */
 
-static void game_loop_process(void) {
-    printf("[GAME] Game loop process started (PID: %d)\n", getpid());
+/* Set up publishing for the bound arena. Returns false if out of memory. */
+static bool publisher_init(void) {
+    size_t cells = (size_t)g_cfg.grid_size * g_cfg.grid_size;
+    g_pub->prev_map = malloc(cells * sizeof(MapCell));
+    g_pub->prev_players = calloc(g_cfg.max_players, sizeof(PlayerChange));
+    g_pub->cur_players = calloc(g_cfg.max_players, sizeof(PlayerChange));
+    g_pub->roster_ids = calloc(g_cfg.max_players, sizeof(uint32_t));
+    g_pub->roster_slots = calloc(g_cfg.max_players, sizeof(uint16_t));
+    g_pub->bots = calloc(g_cfg.max_players, sizeof(uint16_t));
+    if (!g_pub->prev_map || !g_pub->prev_players || !g_pub->cur_players ||
+        !g_pub->roster_ids || !g_pub->roster_slots || !g_pub->bots) return false;
+    
+    /* Deltas start from the map as it stands now. After a takeover the bots
+     * already in the arena are ours, oldest first. */
+    shm_lock(&g_state->lock);
+    memcpy(g_pub->prev_map, g_map, cells * sizeof(MapCell));
+    for (int a = 0; a < g_state->player_count; a++) {
+        uint16_t slot = g_active[a];
+        if (!g_players[slot].is_bot) continue;
+        int i = g_pub->bot_count++;
+        for (; i > 0 && g_players[g_pub->bots[i - 1]].id > g_players[slot].id; i--) {
+            g_pub->bots[i] = g_pub->bots[i - 1];
+        }
+        g_pub->bots[i] = slot;
+    }
+    shm_unlock(&g_state->lock);
+    
+    g_pub->last_food_spawn = get_time_ms();
+    
+    /* A recording that cannot be opened is reported, the game goes on */
+    if (g_record_path) {
+        char path[256];
+        if (g_num_arenas == 1) {
+            snprintf(path, sizeof(path), "%s", g_record_path);
+        } else {
+            snprintf(path, sizeof(path), "%s.%d", g_record_path, g_arena);
+        }
+        g_pub->replay = replay_writer_open(path);
+    }
+    return true;
+}
+
+/* Keep the bound arena at --bots snakes: bots make up for missing players
+ * and leave as players join, always keeping a slot free for the next login.
+ * Then steer them all for the coming tick. */
+static void arena_bots(ArenaMetrics *am) {
+    int humans = g_state->player_count - g_pub->bot_count;
+    int want = g_bot_target - humans;
+    if (want > g_cfg.max_players - 1 - humans) want = g_cfg.max_players - 1 - humans;
+    
+    /* The newest bots go first */
+    while (g_pub->bot_count > 0 && g_pub->bot_count > want) {
+        bot_remove(g_pub->bots[--g_pub->bot_count]);
+    }
+    while (g_pub->bot_count < want) {
+        int slot = bot_add();
+        if (slot < 0) break;
+        g_pub->bots[g_pub->bot_count++] = slot;
+    }
+    am->bots = g_pub->bot_count;
+    if (g_pub->bot_count == 0) return;
+    
+    uint64_t start = get_time_ns();
+    bots_steer(g_pub->bots, g_pub->bot_count);
+    hist_add(&am->bot_ns, get_time_ns() - start);
+}
+
+/* One tick of the bound arena, frames included */
+static void arena_tick(uint64_t now) {
+    ArenaMetrics *am = &g_metrics->arenas[g_arena];
+    uint64_t tick_start = get_time_ns();
+    
+    shm_lock(&g_state->lock);
+    if (g_bot_target > 0 || g_pub->bot_count > 0) arena_bots(am);
+    if (g_pub->replay) replay_begin_tick(g_pub->replay);
+    inputs_dequeue();
+    
+    /* Respawns, moves and collisions (keeps the map up to date) */
+    game_tick();
+    
+    /* Spawn food periodically */
+    bool food = false;
+    if (now - g_pub->last_food_spawn > 3000 && g_state->food_count < MAX_FOOD / 2) {
+        spawn_food();
+        g_pub->last_food_spawn = now;
+        food = true;
+    }
+    
+    if (g_pub->replay) replay_end_tick(g_pub->replay, food);
+    publish_tick();
+    am->state_lock = g_state->lock.stats;
+    am->players = g_state->player_count;
+    
+    shm_unlock(&g_state->lock);
+    hist_add(&am->tick_ns, get_time_ns() - tick_start);
+    am->ticks++;
+}
+
+static void handoff_handler(int sig) {
+    (void)sig;
+    g_handoff = 1;
+}
+
+/* Signal every worker's tick eventfd */
+static void wake_workers(void) {
+    for (int i = 0; i < g_num_workers; i++) {
+        uint64_t one = 1;
+        if (write(g_tick_fds[i], &one, sizeof(one)) < 0) {
+            /* Counter saturated or worker gone: nothing to do */
+        }
+    }
+}
+
+/* Tick arenas loop_id, loop_id + g_num_loops, ... on one schedule */
+static void game_loop_process(int loop_id) {
+    int arenas = (g_num_arenas - loop_id + g_num_loops - 1) / g_num_loops;
+    printf("[GAME %d] Game loop process started (PID: %d, %d arena%s)\n", loop_id, getpid(),
+           arenas, arenas == 1 ? "" : "s");
     
     srand(time(NULL) ^ getpid());
+    signal(SIGUSR2, handoff_handler);
     
-    uint64_t last_tick = get_time_ms();
-    uint64_t last_food_spawn = last_tick;
+    g_update_payload = malloc(MAP_UPDATE_MAX_PAYLOAD(g_cfg.grid_size, g_cfg.max_players));
+    g_delta_payload = malloc(MAP_DELTA_MAX_PAYLOAD(g_cfg.max_delta_cells, g_cfg.max_players));
+    if (!g_update_payload || !g_delta_payload) {
+        perror("malloc");
+        return;
+    }
+    for (int a = loop_id; a < g_num_arenas; a += g_num_loops) {
+        arena_bind(a);
+        if (!publisher_init()) {
+            perror("malloc");
+            return;
+        }
+        if (g_mlock) lock_segment(g_arenas[a], g_seg_sizes[a]);
+    }
     
-    while (g_state->running) {
-        uint64_t now = get_time_ms();
+    if (game_threads_start(g_tick_threads) < 0) {
+        fprintf(stderr, "[GAME %d] Could not start %d tick threads, ticking serially\n",
+                loop_id, g_tick_threads);
+    }
+    
+    GameLoopMetrics *lm = &g_metrics->loops[loop_id];
+    
+    /* Ticks run on absolute deadlines, so the time spent in a tick does not
+     * push the next one back */
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    
+    /* A handover stops between ticks, leaving the arenas to the next loop */
+    while (g_state->running && !g_handoff) {
+        timespec_add_ms(&deadline, GAME_TICK_MS);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR &&
+               g_state->running && !g_handoff);
+        if (!g_state->running || g_handoff) break;
         
-        if (now - last_tick >= GAME_TICK_MS) {
-            pthread_mutex_lock(&g_state->lock);
-            
-            /* Auto-respawn dead snakes */
-            for (int p = 0; p < MAX_PLAYERS; p++) {
-                if (g_state->players[p].active && !g_state->players[p].snake.alive) {
-                    if (g_state->players[p].respawn_timer > 0) {
-                        g_state->players[p].respawn_timer--;
-                    } else {
-                        int spawn_x, spawn_y;
-                        find_spawn_pos(&spawn_x, &spawn_y);
-                        init_snake(&g_state->players[p], spawn_x, spawn_y);
-                        printf("[GAME] %s respawned!\n", g_state->players[p].name);
-                        
-                        char msg[64];
-                        snprintf(msg, sizeof(msg), "%s respawned!", g_state->players[p].name);
-                        add_chat_message(0, "SYSTEM", msg);
-                    }
-                }
-            }
-            
-            /* Move all snakes */
-            for (int p = 0; p < MAX_PLAYERS; p++) {
-                if (g_state->players[p].active && g_state->players[p].snake.alive) {
-                    move_snake(&g_state->players[p].snake);
-                }
-            }
-            
-            /* Check collisions */
-            check_collisions();
-            
-            /* Rebuild map */
-            rebuild_map();
-            
-            /* Spawn food periodically */
-            if (now - last_food_spawn > 3000 && g_state->food_count < MAX_FOOD / 2) {
-                spawn_food();
-                last_food_spawn = now;
-            }
-            
-            g_state->tick++;
-            
-            pthread_mutex_unlock(&g_state->lock);
-            
-            last_tick = now;
+        uint64_t now = get_time_ms();
+        for (int a = loop_id; a < g_num_arenas; a += g_num_loops) {
+            arena_bind(a);
+            arena_tick(now);
         }
+        lm->ticks++;
         
-        msleep(10);
+        /* Wake the workers so they push the new frames right away */
+        wake_workers();
+        
+        /* More than a tick behind (overloaded or stopped): restart the
+         * schedule from now instead of running the missed ticks back to back */
+        struct timespec cur;
+        clock_gettime(CLOCK_MONOTONIC, &cur);
+        if (timespec_diff_ms(&cur, &deadline) >= GAME_TICK_MS) {
+            deadline = cur;
+            lm->overruns++;
+        }
     }
     
-    printf("[GAME] Game loop process stopped.\n");
+    game_threads_stop();
+    for (int a = loop_id; a < g_num_arenas; a += g_num_loops) {
+        replay_writer_close(g_pubs[a].replay);
+    }
+    printf("[GAME %d] %llu tick overruns.\n", loop_id, (unsigned long long)lm->overruns);
+    printf("[GAME %d] Game loop process stopped.\n", loop_id);
 }
 
 /* ============================================================================
  * Client Info (per worker)
  * ============================================================================ */
 
+#define CLIENT_INBUF_INIT   256
+#define CLIENT_INBUF_MAX    (sizeof(PacketHeader) + MAX_PAYLOAD_SIZE)
+
+/*
+ * Slow consumer policy: map frames are only queued while less than
+ * CLIENT_OUT_LOW_WATER bytes are pending, so a backed-up client skips ticks and
+ * later catches up straight to the newest state. Everything else (chat,
+ * replies) is always queued; a client whose backlog would pass
+ * CLIENT_OUT_HIGH_WATER is disconnected.
+ */
+#define CLIENT_OUT_LOW_WATER   (8 * 1024)
+#define CLIENT_OUT_HIGH_WATER  (512 * 1024)   /* Above the largest snapshot frame */
+
+/* Interest management: the tiles of a client's region as it holds them */
+typedef struct {
+    uint16_t tile;          /* ty * g_tile_cols + tx, NO_INDEX if none */
+    MapCell cells[VIEW_TILE * VIEW_TILE];
+} ViewTile;
+
+/* Tiles a region reaches out from the head's tile for a view of `size`
+ * cells, and the side of the torus of ViewTiles, indexed by tile coordinates
+ * mod k, that holds the region */
+#define VIEW_REACH(size)  (((size) / 2 + VIEW_TILE - 1) / VIEW_TILE)
+#define VIEW_TORUS(size)  (2 * VIEW_REACH(size) + 1)
+
+typedef struct {
+    int view_size;
+    int k;                  /* VIEW_TORUS(view_size) */
+    int tx, ty, tw, th;     /* Region in tiles, as last sent */
+    Position head;          /* Its centre */
+    uint64_t minimap_tick;  /* Tick of the last OP_MINIMAP sent, 0 if none */
+    PlayerChange own;       /* Own scoreboard entry as last sent */
+    ViewTile tiles[];       /* k * k */
+} ClientView;
+
+/* A worker's copy of one arena's map for its view clients, created when the
+ * first of them logs in (see Interest Management) */
+typedef struct Mirror Mirror;
+static Mirror *g_mirrors[MAX_ARENAS];
+static Mirror *mirror_create(void);
+
 typedef struct {
     int fd;
+    int arena;              /* Where player_slot is, chosen at login */
     int player_slot;
+    bool spectator;         /* Watching `arena` with no slot */
+    bool feed;              /* A relay: snapshots every RELAY_SNAPSHOT_INTERVAL */
+    uint64_t feed_tick;     /* Tick of the last snapshot sent */
     uint64_t last_chat_idx;
     uint64_t last_map_tick;
+    uint8_t compression;    /* COMPRESS_* negotiated at login */
+    int list_idx;           /* Position in g_conns */
+    
+    /* Received bytes not yet forming a whole packet */
+    uint8_t *in_buf;
+    uint32_t in_len;
+    uint32_t in_cap;
+    
+    /* Bytes the socket would not take yet */
+    OutBuffer out;
+    uint64_t frames_skipped;
+    
+    /* UDP channel: bound once a datagram with our token arrives. While bound,
+     * last_map_tick only moves on TCP sends and on the client's acks. */
+    uint32_t udp_token;     /* 0 until offered */
+    uint32_t udp_conn;      /* Id its datagrams carry: the fd, or the one it had
+                             * on the server it was adopted from */
+    bool udp_bound;
+    struct sockaddr_in udp_addr;
+    uint64_t udp_sent_tick;
+    uint32_t input_seq;     /* Newest move received, over TCP or UDP */
+    uint32_t ack_sent;      /* Newest applied_seq sent in an OP_INPUT_ACK */
+    
+    /* Set if the client only gets the region around its snake */
+    ClientView *view;
 } ClientInfo;
 
+/* State for a client asking for a view of `size` cells, or NULL */
+static ClientView *view_create(int size) {
+    if (size < MIN_VIEW_SIZE) size = MIN_VIEW_SIZE;
+    if (size > MAX_VIEW_SIZE) size = MAX_VIEW_SIZE;
+    
+    int k = VIEW_TORUS(size);
+    ClientView *v = calloc(1, sizeof(ClientView) + (size_t)k * k * sizeof(ViewTile));
+    if (!v) return NULL;
+    v->view_size = size;
+    v->k = k;
+    for (int i = 0; i < k * k; i++) {
+        v->tiles[i].tile = NO_INDEX;
+    }
+    return v;
+}
+
+static ClientInfo *g_clients = NULL;   /* Indexed by fd */
+static int g_max_clients = 0;
+static int *g_conns = NULL;            /* Dense list of connected fds */
+static int g_conn_count = 0;
+static int g_epoll_fd = -1;
+static int g_udp_fd = -1;              /* This worker's UDP socket, if any */
+static uint16_t g_udp_port = 0;
+
 /* ============================================================================
- * Handle Client Message
+ * Connection I/O (per worker)
  * ============================================================================ */
 
-static void handle_client_message(ClientInfo *client) {
-    uint16_t opcode;
-    void *payload = NULL;
-    uint32_t len;
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static ClientInfo *conn_open(int fd) {
+    if (fd >= g_max_clients || set_nonblocking(fd) < 0) {
+        close(fd);
+        return NULL;
+    }
     
-    if (recv_packet(client->fd, &opcode, &payload, &len) < 0) {
-        /* Disconnect */
-        if (client->player_slot >= 0) {
-            pthread_mutex_lock(&g_state->lock);
-            Player *p = &g_state->players[client->player_slot];
-            printf("[SERVER] %s disconnected.\n", p->name);
-            
-            char msg[64];
-            snprintf(msg, sizeof(msg), "%s left the game", p->name);
-            add_chat_message(0, "SYSTEM", msg);
-            
-            p->active = false;
-            p->snake.alive = false;
-            g_state->player_count--;
-            pthread_mutex_unlock(&g_state->lock);
-        }
-        close(client->fd);
-        client->fd = -1;
-        client->player_slot = -1;
-        return;
+    /* Replies and small frames should not wait for the previous ACK */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    ClientInfo *c = &g_clients[fd];
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->player_slot = -1;
+    c->udp_conn = fd;
+    c->last_chat_idx = g_state->chat_count;
+    c->last_map_tick = 0;
+    c->in_buf = malloc(CLIENT_INBUF_INIT);
+    c->in_cap = CLIENT_INBUF_INIT;
+    outbuf_init(&c->out, CLIENT_OUT_HIGH_WATER);
+    
+    if (g_epoll_fd >= 0) {
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.fd = fd
+        };
+        if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            free(c->in_buf);
+            close(fd);
+            c->fd = -1;
+            return NULL;
+        }
+    }
+    
+    c->list_idx = g_conn_count;
+    g_conns[g_conn_count++] = fd;
+    __atomic_add_fetch(&g_arenas[0]->worker_clients[g_worker_id], 1, __ATOMIC_RELAXED);
+    g_wm->accepts++;
+    return c;
+}
+
+static void conn_drop(ClientInfo *c);
+
+static void conn_close(ClientInfo *c) {
+    if (c->fd < 0) return;
+    
+    if (c->player_slot >= 0) {
+        arena_bind(c->arena);
+        shm_lock(&g_state->lock);
+        Player *p = &g_players[c->player_slot];
+        printf("[SERVER] %s disconnected.\n", p->name);
+        
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%s left the game", p->name);
+        add_chat_message(0, "SYSTEM", msg);
+        
+        kill_snake(p);
+        slot_free(c->player_slot);
+        shm_unlock(&g_state->lock);
+    }
+    conn_drop(c);
+}
+
+/* Forget the connection, leaving any player slot as it is */
+static void conn_drop(ClientInfo *c) {
+    if (c->spectator) g_wm->spectators--;
+    
+    /* Closing the fd also drops it from the epoll set */
+    close(c->fd);
+    __atomic_sub_fetch(&g_arenas[0]->worker_clients[g_worker_id], 1, __ATOMIC_RELAXED);
+    g_wm->disconnects++;
+    
+    int last = g_conns[--g_conn_count];
+    g_conns[c->list_idx] = last;
+    g_clients[last].list_idx = c->list_idx;
+    
+    free(c->in_buf);
+    free(c->view);
+    outbuf_free(&c->out);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    c->player_slot = -1;
+}
+
+/* Queue bytes for the client without blocking. Returns -1 if the connection
+ * is broken or the client fell past the high-water mark. */
+static int conn_write(ClientInfo *c, const void *data, size_t len) {
+    /* `data` holds whole packets: count them by opcode */
+    for (size_t off = 0; off + sizeof(PacketHeader) <= len; ) {
+        const PacketHeader *hdr = (const PacketHeader *)((const uint8_t *)data + off);
+        uint16_t opcode = ntohs(hdr->opcode);
+        g_wm->ops_out[opcode < METRIC_OPCODES ? opcode : 0]++;
+        g_wm->packets_out++;
+        off += sizeof(PacketHeader) + ntohl(hdr->length);
+    }
+    g_wm->bytes_out += len;
+    
+    int ret = outbuf_write(c->fd, &c->out, data, len);
+    if (ret == -2) {
+        printf("[SERVER] fd=%d too slow (%zu bytes queued, %llu frames skipped), dropping.\n",
+               c->fd, outbuf_pending(&c->out), (unsigned long long)c->frames_skipped);
+    }
+    return ret < 0 ? -1 : 0;
+}
+
+static int conn_send_packet(ClientInfo *c, uint16_t opcode, const void *payload, uint32_t len) {
+    static uint8_t frame[sizeof(PacketHeader) + MAX_PAYLOAD_SIZE];
+    size_t n = encode_packet(frame, opcode, payload, len);
+    return conn_write(c, frame, n);
+}
+
+/* ============================================================================
+ * Handle Client Message
+ * ============================================================================ */
+
+/* Matchmaking: the first arena with a free slot, so each arena fills up
+ * before the next one gets players. Returns the slot with its arena bound and
+ * locked, or -1 if every arena is full. */
+static int arena_join(void) {
+    for (int a = 0; a < g_num_arenas; a++) {
+        /* Peek without the lock: full arenas are skipped cheaply */
+        if (__atomic_load_n(&g_arenas[a]->free_count, __ATOMIC_RELAXED) == 0) continue;
+        
+        arena_bind(a);
+        shm_lock(&g_state->lock);
+        int slot = slot_alloc();
+        if (slot >= 0) return slot;
+        shm_unlock(&g_state->lock);
     }
+    return -1;
+}
+
+/* The token is all that authenticates a UDP datagram, so it must not be
+ * guessable. Returns 0 if no randomness is available (stay on TCP then). */
+static uint32_t udp_token_new(void) {
+    uint32_t token;
+    if (getrandom(&token, sizeof(token), 0) == sizeof(token)) return token | 1;
+    
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, &token, sizeof(token));
+    close(fd);
+    return n == sizeof(token) ? token | 1 : 0;
+}
+
+/* Returns -1 if the connection should be closed */
+static int handle_client_message(ClientInfo *client, uint16_t opcode,
+                                 unsigned char *payload, uint32_t len) {
+    arena_bind(client->arena);
     
     switch (opcode) {
         case OP_LOGIN_REQ: {
-            if (len < sizeof(LoginRequest)) break;
+            /* `compression` and `view_size` are optional: older clients do
+             * not send them */
+            if (len < offsetof(LoginRequest, compression)) break;
             LoginRequest *req = (LoginRequest *)payload;
             req->name[MAX_NAME_LEN - 1] = '\0';
+            uint8_t accepted = len > offsetof(LoginRequest, compression) ? req->compression : 0;
+            uint8_t view_size = len > offsetof(LoginRequest, view_size) ? req->view_size : 0;
             
-            pthread_mutex_lock(&g_state->lock);
-            
-            int slot = -1;
-            for (int i = 0; i < MAX_PLAYERS; i++) {
-                if (!g_state->players[i].active) {
-                    slot = i;
-                    break;
-                }
+            if (client->player_slot >= 0 || client->spectator) break;
+            if (g_relay) {
+                return conn_send_packet(client, OP_ERROR, "Spectators Only", 15);
             }
-            
+            int slot = arena_join();
             if (slot < 0) {
-                pthread_mutex_unlock(&g_state->lock);
-                send_packet(client->fd, OP_ERROR, "Server Full", 11);
-                break;
+                return conn_send_packet(client, OP_ERROR, "Server Full", 11);
             }
             
-            Player *p = &g_state->players[slot];
+            Player *p = &g_players[slot];
             memset(p, 0, sizeof(Player));
             p->id = g_state->next_player_id++;
             strncpy(p->name, req->name, MAX_NAME_LEN - 1);
             p->color = (slot % NUM_COLORS) + 1;
-            p->active = true;
             p->is_ai = req->is_ai;
             
             int spawn_x, spawn_y;
             find_spawn_pos(&spawn_x, &spawn_y);
             init_snake(p, spawn_x, spawn_y);
             
-            g_state->player_count++;
+            client->arena = g_arena;
             client->player_slot = slot;
-            client->last_chat_idx = g_state->chat_count;
+            client->last_chat_idx = __atomic_load_n(&g_state->chat_count, __ATOMIC_ACQUIRE);
+            client->compression = (accepted & COMPRESS_ZLIB) ? COMPRESS_ZLIB : COMPRESS_NONE;
             
             char join_msg[64];
             snprintf(join_msg, sizeof(join_msg), "%s joined!", p->name);
             add_chat_message(0, "SYSTEM", join_msg);
             
-            pthread_mutex_unlock(&g_state->lock);
+            shm_unlock(&g_state->lock);
+            
+            /* Without it the client just gets the whole arena */
+            if (g_cfg.grid_size > DEFAULT_GRID_SIZE && view_size > 0 && !client->view &&
+                (g_mirrors[g_arena] || (g_mirrors[g_arena] = mirror_create()))) {
+                client->view = view_create(view_size);
+            }
             
             LoginResponse resp = {
                 .player_id = p->id,
                 .color = p->color,
-                .grid_width = GRID_SIZE,
-                .grid_height = GRID_SIZE
+                .grid_width = g_cfg.grid_size,
+                .grid_height = g_cfg.grid_size,
+                .max_players = g_cfg.max_players,
+                .compression = client->compression,
+                .arena = g_arena
             };
-            send_packet(client->fd, OP_LOGIN_RESP, &resp, sizeof(resp));
             
-            printf("[SERVER] %s joined (slot %d)\n", p->name, slot);
-            break;
+            printf("[SERVER] %s joined (arena %d, slot %d)\n", p->name, g_arena, slot);
+            return conn_send_packet(client, OP_LOGIN_RESP, &resp, sizeof(resp));
+        }
+        
+        case OP_SPECTATE: {
+            if (len < sizeof(SpectateRequest) || client->player_slot >= 0 ||
+                client->spectator) break;
+            SpectateRequest *req = (SpectateRequest *)payload;
+            if (!g_relay && req->arena >= g_num_arenas) {
+                return conn_send_packet(client, OP_ERROR, "No Such Arena", 13);
+            }
+            
+            /* Nothing in the arena changes: the frames are already there */
+            arena_bind(g_relay ? 0 : req->arena);
+            client->arena = g_arena;
+            client->spectator = true;
+            client->feed = (req->flags & SPECTATE_FEED) != 0;
+            client->last_chat_idx = __atomic_load_n(&g_state->chat_count, __ATOMIC_ACQUIRE);
+            client->compression = (req->compression & COMPRESS_ZLIB) ? COMPRESS_ZLIB : COMPRESS_NONE;
+            g_wm->spectators++;
+            
+            LoginResponse resp = {
+                .player_id = 0,
+                .grid_width = g_cfg.grid_size,
+                .grid_height = g_cfg.grid_size,
+                .max_players = g_cfg.max_players,
+                .compression = client->compression,
+                .arena = g_relay ? g_upstream_arena : g_arena
+            };
+            
+            printf("[SERVER] fd=%d %s arena %d\n", client->fd,
+                   client->feed ? "relays" : "watches", resp.arena);
+            return conn_send_packet(client, OP_LOGIN_RESP, &resp, sizeof(resp));
         }
         
         case OP_MOVE: {
-            if (len < sizeof(MoveCommand)) break;
+            if (len < 1) break;
             MoveCommand *cmd = (MoveCommand *)payload;
+            uint32_t input_seq = len >= sizeof(MoveCommand) ? cmd->input_seq : 0;  /* Optional */
             
-            if (client->player_slot >= 0) {
-                pthread_mutex_lock(&g_state->lock);
-                Player *p = &g_state->players[client->player_slot];
-                if (p->active && p->snake.alive && cmd->direction <= DIR_RIGHT) {
-                    p->snake.pending_dir = cmd->direction;
-                }
-                pthread_mutex_unlock(&g_state->lock);
+            /* No lock: the slot stays ours until logout, and the game loop
+             * only samples pending_dir once per tick */
+            if (client->player_slot >= 0 && cmd->direction <= DIR_RIGHT) {
+                __atomic_store_n(&g_snakes[client->player_slot].pending_dir, cmd->direction, __ATOMIC_RELAXED);
+                __atomic_store_n(&g_players[client->player_slot].pending_seq, input_seq,
+                                 __ATOMIC_RELEASE);
+            }
+            if (input_seq > client->input_seq) {
+                client->input_seq = input_seq;
             }
             break;
         }
         
         case OP_CHAT_SEND: {
             if (len < 1) break;
-            ChatSend *chat = (ChatSend *)payload;
-            chat->text[MAX_CHAT_LEN - 1] = '\0';
+            ChatSend chat;
+            memset(&chat, 0, sizeof(chat));
+            memcpy(&chat, payload, len < sizeof(chat) ? len : sizeof(chat));
+            chat.text[MAX_CHAT_LEN - 1] = '\0';
             
+            /* id and name are fixed while the slot is ours */
             if (client->player_slot >= 0) {
-                pthread_mutex_lock(&g_state->lock);
-                Player *p = &g_state->players[client->player_slot];
-                add_chat_message(p->id, p->name, chat->text);
-                pthread_mutex_unlock(&g_state->lock);
+                Player *p = &g_players[client->player_slot];
+                add_chat_message(p->id, p->name, chat.text);
             }
             break;
         }
         
         case OP_HEARTBEAT: {
-            send_packet(client->fd, OP_HEARTBEAT_ACK, NULL, 0);
+            return conn_send_packet(client, OP_HEARTBEAT_ACK, NULL, 0);
+        }
+        
+        case OP_MAP_RESYNC: {
+            /* Client lost track of the delta chain: next update is a snapshot */
+            client->last_map_tick = 0;
             break;
         }
         
-        case OP_LOGOUT: {
+        case OP_UDP_REQUEST: {
+            /* View deltas are built per client and stay on TCP */
+            if (g_udp_fd < 0 || client->player_slot < 0 || client->view) break;
+            if (client->udp_token == 0) {
+                client->udp_token = udp_token_new();
+                if (client->udp_token == 0) break;
+            }
+            UdpOffer offer = {
+                .port = g_udp_port,
+                .conn = client->udp_conn,
+                .token = client->udp_token
+            };
+            return conn_send_packet(client, OP_UDP_OFFER, &offer, sizeof(offer));
+        }
+        
+        case OP_LOGOUT: {
             if (client->player_slot >= 0) {
-                pthread_mutex_lock(&g_state->lock);
-                Player *p = &g_state->players[client->player_slot];
+                shm_lock(&g_state->lock);
+                Player *p = &g_players[client->player_slot];
                 printf("[SERVER] %s logged out.\n", p->name);
-                p->active = false;
-                p->snake.alive = false;
-                g_state->player_count--;
-                pthread_mutex_unlock(&g_state->lock);
+                kill_snake(p);
+                slot_free(client->player_slot);
+                shm_unlock(&g_state->lock);
+                client->player_slot = -1;
+            }
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/* Drain the socket and dispatch every complete packet. Returns -1 if the
+ * connection should be closed. */
+static int conn_read(ClientInfo *c) {
+    for (;;) {
+        if (c->in_len == c->in_cap) {
+            if (c->in_cap >= CLIENT_INBUF_MAX) return -1;
+            uint32_t cap = c->in_cap * 2;
+            if (cap > CLIENT_INBUF_MAX) cap = CLIENT_INBUF_MAX;
+            uint8_t *buf = realloc(c->in_buf, cap);
+            if (!buf) return -1;
+            c->in_buf = buf;
+            c->in_cap = cap;
+        }
+        
+        ssize_t n = recv(c->fd, c->in_buf + c->in_len, c->in_cap - c->in_len, MSG_DONTWAIT);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        c->in_len += n;
+        g_wm->bytes_in += n;
+        
+        uint32_t off = 0;
+        for (;;) {
+            uint16_t opcode = 0;
+            unsigned char *payload = NULL;
+            uint32_t len = 0;
+            
+            int used = decode_packet(c->in_buf + off, c->in_len - off, &opcode, &payload, &len);
+            if (used < 0) return -1;
+            if (used == 0) break;
+            off += used;
+            g_wm->packets_in++;
+            g_wm->ops_in[opcode < METRIC_OPCODES ? opcode : 0]++;
+            
+            if (handle_client_message(c, opcode, payload, len) < 0) return -1;
+        }
+        
+        if (off > 0) {
+            memmove(c->in_buf, c->in_buf + off, c->in_len - off);
+            c->in_len -= off;
+        }
+    }
+}
+
+/* ============================================================================
+ * Map Updates (per worker)
+ * ============================================================================ */
+
+/* Copy a published frame out of shared memory. Fails if the frame is not
+ * (or stops being) the one for `tick` while we copy it. */
+static bool copy_frame(const volatile uint64_t *stamp, const uint8_t *data,
+                       uint32_t len, uint64_t tick, uint8_t *out) {
+    if (*stamp != tick) return false;
+    __sync_synchronize();
+    memcpy(out, data, len);
+    __sync_synchronize();
+    return *stamp == tick;
+}
+
+/* Worker-local copies of an arena's newest frames, so the shared ones are
+ * read once per tick rather than once per client (allocated in
+ * worker_process) */
+typedef struct {
+    uint8_t *snapshot;
+    uint32_t snapshot_len;
+    uint32_t snapshot_zlen;   /* 0 if not compressed (yet) */
+    bool snapshot_ztried;     /* Compressing it was tried */
+    uint64_t snapshot_tick;
+    uint8_t *delta;
+    uint32_t delta_len;
+    uint64_t delta_tick;
+    bool delta_overflow;
+} FrameCache;
+
+static FrameCache g_frame_caches[MAX_ARENAS];
+static uint8_t *g_delta_scratch = NULL;
+static z_stream g_deflate;          /* Reused for every snapshot compressed */
+static bool g_deflate_ready = false;
+
+/* Wrap the cached snapshot's `len` bytes of packets in an OP_COMPRESSED
+ * packet right after them. Returns its length, or 0 if that would not be
+ * smaller. Runs in the worker, without any lock, and only once a client
+ * that takes compression needs the snapshot. */
+static uint32_t compress_snapshot(FrameCache *fc) {
+    uint32_t len = fc->snapshot_len;
+    uint8_t *out = fc->snapshot + len;
+    size_t head = sizeof(PacketHeader) + sizeof(CompressedHeader);
+    if (len <= head) return 0;
+    
+    if (!g_deflate_ready) {
+        if (deflateInit(&g_deflate, Z_BEST_SPEED) != Z_OK) return 0;
+        g_deflate_ready = true;
+    } else if (deflateReset(&g_deflate) != Z_OK) {
+        return 0;
+    }
+    
+    /* Give it no more room than would pay off */
+    g_deflate.next_in = fc->snapshot;
+    g_deflate.avail_in = len;
+    g_deflate.next_out = out + head;
+    g_deflate.avail_out = len - head;
+    if (deflate(&g_deflate, Z_FINISH) != Z_STREAM_END) return 0;
+    
+    CompressedHeader *hdr = (CompressedHeader *)(out + sizeof(PacketHeader));
+    hdr->raw_len = len;
+    return encode_packet(out, OP_COMPRESSED, hdr,
+                         sizeof(CompressedHeader) + g_deflate.total_out);
+}
+
+/* Returns the bound arena's newest snapshot frame, compressed if the client
+ * negotiated it and compressing paid off */
+static const uint8_t *latest_snapshot(uint8_t compression, uint32_t *len, uint64_t *tick) {
+    FrameCache *fc = &g_frame_caches[g_arena];
+    
+    for (;;) {
+        uint64_t t = g_state->snapshot_tick;
+        if (fc->snapshot_tick == t) break;
+        
+        SnapshotFrame *snap = snapshot_slot(t);
+        uint32_t n = snap->len;
+        uint32_t zn = snap->zlen;
+        fc->snapshot_tick = 0;
+        if (n <= snapshot_frame_cap(&g_cfg) && zn <= n &&
+            copy_frame(&snap->tick, snap->data, n + zn, t, fc->snapshot)) {
+            fc->snapshot_len = n;
+            fc->snapshot_zlen = zn;
+            fc->snapshot_ztried = zn > 0;
+            fc->snapshot_tick = t;
+            break;
+        }
+    }
+    
+    *tick = fc->snapshot_tick;
+    if (compression != COMPRESS_NONE && !fc->snapshot_ztried) {
+        fc->snapshot_zlen = compress_snapshot(fc);
+        fc->snapshot_ztried = true;
+    }
+    if (compression != COMPRESS_NONE && fc->snapshot_zlen > 0) {
+        *len = fc->snapshot_zlen;
+        return fc->snapshot + fc->snapshot_len;
+    }
+    *len = fc->snapshot_len;
+    return fc->snapshot;
+}
+
+/* Returns the delta frame producing `tick`, or NULL if it has left the ring
+ * or overflowed. `scratch` is used when the frame is not the cached one. */
+static const uint8_t *delta_frame(uint64_t tick, uint8_t *scratch, uint32_t *len) {
+    FrameCache *fc = &g_frame_caches[g_arena];
+    
+    if (fc->delta_tick == tick) {
+        *len = fc->delta_len;
+        return fc->delta_overflow ? NULL : fc->delta;
+    }
+    
+    MapDeltaFrame *frame = delta_slot(tick);
+    bool overflow = frame->overflow;
+    uint32_t n = frame->len;
+    uint8_t *out = (tick == g_state->tick) ? fc->delta : scratch;
+    if (out == fc->delta) fc->delta_tick = 0;
+    
+    if (n > delta_frame_cap(&g_cfg) || !copy_frame(&frame->tick, frame->data, n, tick, out)) {
+        return NULL;
+    }
+    
+    if (out == fc->delta) {
+        fc->delta_len = n;
+        fc->delta_tick = tick;
+        fc->delta_overflow = overflow;
+    }
+    
+    *len = n;
+    return overflow ? NULL : out;
+}
+
+/* Bring the client up to current_tick: replay the delta ring if it still
+ * covers everything since the client's last tick, otherwise fall back to a
+ * full snapshot. Returns -1 if the connection should be closed. */
+static int send_map_update(ClientInfo *client, uint64_t current_tick) {
+    bool need_full = (client->last_map_tick == 0 ||
+                      current_tick - client->last_map_tick >= MAP_DELTA_HISTORY);
+    uint32_t len;
+    uint64_t tick;
+    
+    for (;;) {
+        while (!need_full && client->last_map_tick < current_tick) {
+            uint64_t t = client->last_map_tick + 1;
+            const uint8_t *frame = delta_frame(t, g_delta_scratch, &len);
+            
+            if (!frame) {
+                need_full = true;
+                break;
+            }
+            if (conn_write(client, frame, len) < 0) {
+                return -1;
+            }
+            client->last_map_tick = t;
+        }
+        if (!need_full) break;
+        
+        /* A relay's newest snapshot may trail its deltas: replay the ones
+         * after it, or wait for a newer snapshot if it brings nothing */
+        const uint8_t *frame = latest_snapshot(client->compression, &len, &tick);
+        if (tick <= client->last_map_tick) break;
+        if (conn_write(client, frame, len) < 0) {
+            return -1;
+        }
+        client->last_map_tick = tick;
+        client->feed_tick = tick;
+        need_full = false;
+    }
+    
+    /* Relays also take a snapshot now and then, for the viewers joining them.
+     * It must not run ahead of the deltas they have. */
+    if (client->feed && client->last_map_tick >= client->feed_tick + RELAY_SNAPSHOT_INTERVAL) {
+        const uint8_t *frame = latest_snapshot(client->compression, &len, &tick);
+        if (tick > client->feed_tick && tick <= client->last_map_tick) {
+            if (conn_write(client, frame, len) < 0) {
+                return -1;
+            }
+            client->feed_tick = tick;
+        }
+    }
+    
+    return 0;
+}
+
+/* The newest move the ticks applied for the client's slot. The tick is read
+ * after the number, so it is never earlier than the one that applied it. */
+static InputAck input_ack(const ClientInfo *c) {
+    const Player *p = &g_players[c->player_slot];
+    InputAck ack;
+    ack.input_seq = __atomic_load_n(&p->applied_seq, __ATOMIC_ACQUIRE);
+    ack.tick = __atomic_load_n(&p->applied_tick, __ATOMIC_RELAXED);
+    return ack;
+}
+
+/* Tell a player on TCP that a tick took (or dropped) its newest move. Over
+ * UDP every frame carries the ack instead. */
+static int send_input_ack(ClientInfo *c) {
+    if (c->player_slot < 0 || c->udp_bound) return 0;
+    
+    InputAck ack = input_ack(c);
+    if (ack.input_seq == c->ack_sent) return 0;
+    c->ack_sent = ack.input_seq;
+    return conn_send_packet(c, OP_INPUT_ACK, &ack, sizeof(ack));
+}
+
+/* ============================================================================
+ * UDP Channel (per worker)
+ *
+ * Each worker has its own UDP port, so a client's datagrams reach the worker
+ * holding its TCP connection. OP_UDP_INPUT carries moves and the client's
+ * newest map tick; every tick the client gets one OP_UDP_FRAME with all the
+ * deltas after that tick, so there is no retransmission and nothing waits
+ * behind a lost datagram. When those deltas are gone from the ring or do not
+ * fit in a datagram, the update goes over TCP as before.
+ * ============================================================================ */
+
+static int open_udp_socket(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = INADDR_ANY };
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) < 0 ||
+        set_nonblocking(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    g_udp_port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/* Send the deltas the client has not acknowledged as one datagram, once per
+ * tick. Returns false if the client should get this tick over TCP. */
+static bool send_udp_update(ClientInfo *c, uint64_t current_tick) {
+    static uint8_t payload[UDP_FRAME_MAX];
+    static uint8_t datagram[sizeof(PacketHeader) + UDP_FRAME_MAX];
+    
+    if (!c->udp_bound || c->last_map_tick == 0 ||
+        current_tick - c->last_map_tick >= MAP_DELTA_HISTORY) return false;
+    if (c->udp_sent_tick >= current_tick) return true;
+    
+    UdpFrameHeader *hdr = (UdpFrameHeader *)payload;
+    hdr->ack = input_ack(c);
+    size_t n = sizeof(*hdr);
+    for (uint64_t t = c->last_map_tick + 1; t <= current_tick; t++) {
+        uint32_t len;
+        const uint8_t *frame = delta_frame(t, g_delta_scratch, &len);
+        if (!frame || n + len > UDP_FRAME_MAX) return false;
+        memcpy(payload + n, frame, len);
+        n += len;
+    }
+    
+    /* A full socket buffer drops the datagram, as the network might */
+    size_t len = encode_packet(datagram, OP_UDP_FRAME, payload, n);
+    if (sendto(g_udp_fd, datagram, len, MSG_DONTWAIT, (struct sockaddr *)&c->udp_addr,
+               sizeof(c->udp_addr)) == (ssize_t)len) {
+        g_wm->ops_out[OP_UDP_FRAME]++;
+        g_wm->packets_out++;
+        g_wm->bytes_out += len;
+    }
+    c->udp_sent_tick = current_tick;
+    return true;
+}
+
+static ClientInfo *conn_alias(uint32_t conn, uint32_t token);
+
+static void handle_udp_input(const UdpInput *in, const struct sockaddr_in *from) {
+    ClientInfo *c = in->conn < (uint32_t)g_max_clients ? &g_clients[in->conn] : NULL;
+    if (!c || c->fd < 0 || c->udp_conn != in->conn || in->token != c->udp_token) {
+        c = conn_alias(in->conn, in->token);
+    }
+    if (!c || c->player_slot < 0 || c->udp_token == 0) return;
+    arena_bind(c->arena);
+    
+    /* The latest address wins, so a NAT rebinding does not cut the client off */
+    c->udp_addr = *from;
+    c->udp_bound = true;
+    
+    /* Acks only move a live chain forward; 0 means a snapshot is due */
+    if (c->last_map_tick != 0 && in->ack_tick > c->last_map_tick &&
+        in->ack_tick <= g_state->tick) {
+        c->last_map_tick = in->ack_tick;
+    }
+    
+    /* Queue the moves we have not seen, oldest first; any older than the
+     * datagram's window are lost for good */
+    if (in->input_seq > c->input_seq) {
+        uint32_t unseen = in->input_seq - c->input_seq;
+        if (unseen > UDP_INPUT_REDUNDANCY) unseen = UDP_INPUT_REDUNDANCY;
+        for (int i = (int)unseen - 1; i >= 0; i--) {
+            if (in->inputs[i] <= DIR_RIGHT) {
+                input_push(&g_players[c->player_slot], in->inputs[i], in->input_seq - i);
+            }
+        }
+        c->input_seq = in->input_seq;
+    }
+}
+
+static void udp_read(void) {
+    uint8_t buf[sizeof(PacketHeader) + sizeof(UdpInput) + 64];
+    
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(g_udp_fd, buf, sizeof(buf), MSG_DONTWAIT,
+                             (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        g_wm->bytes_in += n;
+        
+        uint16_t opcode;
+        unsigned char *payload;
+        uint32_t len;
+        if (decode_packet(buf, n, &opcode, &payload, &len) != n) continue;
+        g_wm->packets_in++;
+        g_wm->ops_in[opcode < METRIC_OPCODES ? opcode : 0]++;
+        
+        if (opcode == OP_UDP_INPUT && len >= sizeof(UdpInput)) {
+            UdpInput in;
+            memcpy(&in, payload, sizeof(in));
+            handle_udp_input(&in, &from);
+        }
+    }
+}
+
+/* ============================================================================
+ * Interest Management (per worker)
+ *
+ * On arenas bigger than DEFAULT_GRID_SIZE a client that gave its view size at
+ * login gets OP_VIEW_DELTAs for the VIEW_TILE tiles around its snake instead
+ * of the shared frames. The worker mirrors the map from the published deltas
+ * and notes per tile when it last changed and how many snake segments it
+ * holds; a client's update then only diffs the tiles of its region that
+ * changed since its tick or just came into it. Every MINIMAP_INTERVAL ticks
+ * the per-tile counts and the scoreboard go out as one OP_MINIMAP.
+ * ============================================================================ */
+
+#define VIEW_DELTA_MAX_PAYLOAD (sizeof(ViewDeltaHeader) + sizeof(PlayerChange) + \
+        (size_t)(VIEW_TORUS(MAX_VIEW_SIZE) * VIEW_TILE) * \
+        (VIEW_TORUS(MAX_VIEW_SIZE) * VIEW_TILE) * sizeof(CellChange))
+#define MINIMAP_MAX_PAYLOAD (sizeof(MinimapHeader) + \
+        ((MAX_GRID_SIZE + VIEW_TILE - 1) / VIEW_TILE) * \
+        ((MAX_GRID_SIZE + VIEW_TILE - 1) / VIEW_TILE) + \
+        MAX_PLAYERS_LIMIT * sizeof(PlayerChange))
+
+/* One arena's map and scoreboard as of `tick`, with the OP_MINIMAPs built
+ * from them */
+struct Mirror {
+    MapCell *map;
+    PlayerChange *players;
+    PlayerJoin *roster;         /* Per slot, player_id 0 if free */
+    uint64_t tick;
+    uint64_t *tile_tick;        /* Per tile: last tick a cell changed */
+    uint16_t *tile_snakes;      /* Per tile: snake segments on it */
+    
+    /* OP_MINIMAP with the scoreboard changes since the previous one, and the
+     * scoreboard it was built from */
+    uint8_t minimap[sizeof(PacketHeader) + MINIMAP_MAX_PAYLOAD];
+    uint32_t minimap_len;
+    uint64_t minimap_tick;
+    uint64_t minimap_prev_tick;
+    PlayerChange *minimap_players;
+    uint32_t *minimap_ids;
+    
+    /* OP_MINIMAP with the whole scoreboard, for clients starting over */
+    uint8_t full[sizeof(PacketHeader) + MINIMAP_MAX_PAYLOAD];
+    uint32_t full_len;
+    uint64_t full_tick;
+};
+
+static int g_tile_cols;             /* Tiles per side */
+static uint8_t *g_view_scratch = NULL; /* Frames being decoded (allocated in
+                                        * view_init, only on big arenas) */
+
+static int view_init(void) {
+    size_t scratch = snapshot_frame_cap(&g_cfg);
+    if (scratch < delta_frame_cap(&g_cfg)) scratch = delta_frame_cap(&g_cfg);
+    
+    g_tile_cols = (g_cfg.grid_size + VIEW_TILE - 1) / VIEW_TILE;
+    g_view_scratch = malloc(scratch);
+    return g_view_scratch ? 0 : -1;
+}
+
+/* Empty mirror, brought up to date by the first mirror_sync(), or NULL */
+static Mirror *mirror_create(void) {
+    size_t cells = (size_t)g_cfg.grid_size * g_cfg.grid_size;
+    size_t tiles = (size_t)g_tile_cols * g_tile_cols;
+    Mirror *m = calloc(1, sizeof(Mirror));
+    if (!m) return NULL;
+    
+    m->map = calloc(cells, sizeof(MapCell));
+    m->players = calloc(g_cfg.max_players, sizeof(PlayerChange));
+    m->roster = calloc(g_cfg.max_players, sizeof(PlayerJoin));
+    m->tile_tick = calloc(tiles, sizeof(uint64_t));
+    m->tile_snakes = calloc(tiles, sizeof(uint16_t));
+    m->minimap_players = calloc(g_cfg.max_players, sizeof(PlayerChange));
+    m->minimap_ids = calloc(g_cfg.max_players, sizeof(uint32_t));
+    if (m->map && m->players && m->roster && m->tile_tick && m->tile_snakes &&
+        m->minimap_players && m->minimap_ids) return m;
+    
+    free(m->map);
+    free(m->players);
+    free(m->roster);
+    free(m->tile_tick);
+    free(m->tile_snakes);
+    free(m->minimap_players);
+    free(m->minimap_ids);
+    free(m);
+    return NULL;
+}
+
+static void mirror_set(Mirror *m, int x, int y, MapCell cell, uint64_t tick) {
+    MapCell *have = &m->map[y * g_cfg.grid_size + x];
+    int tile = (y / VIEW_TILE) * g_tile_cols + x / VIEW_TILE;
+    
+    if (*have == cell) return;
+    if (*have >= CELL_SNAKE_BASE) m->tile_snakes[tile]--;
+    if (cell >= CELL_SNAKE_BASE) m->tile_snakes[tile]++;
+    *have = cell;
+    m->tile_tick[tile] = tick;
+}
+
+/* Apply the bound arena's frame producing `tick`. Fails if it left the ring
+ * or overflowed. */
+static bool mirror_apply(Mirror *m, uint64_t tick) {
+    uint32_t len;
+    const uint8_t *frame = delta_frame(tick, g_delta_scratch, &len);
+    if (!frame) return false;
+    memcpy(g_view_scratch, frame, len);
+    
+    for (uint32_t off = 0; off < len; ) {
+        uint16_t opcode;
+        unsigned char *payload;
+        uint32_t plen;
+        int used = decode_packet(g_view_scratch + off, len - off, &opcode, &payload, &plen);
+        if (used <= 0) return false;
+        off += used;
+        
+        if (opcode == OP_PLAYER_JOIN && plen >= sizeof(PlayerJoin)) {
+            const PlayerJoin *ev = (const PlayerJoin *)payload;
+            if (ev->slot < g_cfg.max_players) m->roster[ev->slot] = *ev;
+        } else if (opcode == OP_PLAYER_LEAVE && plen >= sizeof(PlayerLeave)) {
+            uint16_t slot = ((const PlayerLeave *)payload)->slot;
+            if (slot < g_cfg.max_players) m->roster[slot].player_id = 0;
+        } else if (opcode == OP_MAP_DELTA && plen >= sizeof(MapDeltaHeader)) {
+            const MapDeltaHeader *hdr = (const MapDeltaHeader *)payload;
+            if (plen < MAP_DELTA_MAX_PAYLOAD(hdr->cell_count, hdr->player_count)) return false;
+            
+            const CellChange *cells = (const CellChange *)(hdr + 1);
+            for (int i = 0; i < hdr->cell_count; i++) {
+                mirror_set(m, cells[i].x, cells[i].y, cells[i].cell, tick);
+            }
+            const PlayerChange *players = (const PlayerChange *)(cells + hdr->cell_count);
+            for (int i = 0; i < hdr->player_count; i++) {
+                if (players[i].slot < g_cfg.max_players) {
+                    m->players[players[i].slot] = players[i];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/* Start the mirror over from the bound arena's newest snapshot */
+static void mirror_reload(Mirror *m) {
+    uint32_t len;
+    uint64_t tick;
+    const uint8_t *frame = latest_snapshot(COMPRESS_NONE, &len, &tick);
+    memcpy(g_view_scratch, frame, len);
+    
+    uint16_t opcode;
+    unsigned char *payload;
+    uint32_t plen;
+    int used = decode_packet(g_view_scratch, len, &opcode, &payload, &plen);
+    if (used <= 0 || opcode != OP_MAP_UPDATE || plen < sizeof(MapUpdateHeader)) return;
+    const MapUpdateHeader *hdr = (const MapUpdateHeader *)payload;
+    const uint8_t *rle = (const uint8_t *)(hdr + 1);
+    if (plen < sizeof(*hdr) + hdr->map_bytes + hdr->player_count * sizeof(PlayerChange) ||
+        map_rle_decode(rle, hdr->map_bytes, m->map,
+                       (size_t)g_cfg.grid_size * g_cfg.grid_size) < 0) return;
+    
+    /* Every tile counts as changed: clients diff their whole region once */
+    int tiles = g_tile_cols * g_tile_cols;
+    memset(m->tile_snakes, 0, tiles * sizeof(uint16_t));
+    for (int i = 0; i < tiles; i++) {
+        m->tile_tick[i] = tick;
+    }
+    for (int y = 0; y < g_cfg.grid_size; y++) {
+        for (int x = 0; x < g_cfg.grid_size; x++) {
+            if (m->map[y * g_cfg.grid_size + x] >= CELL_SNAKE_BASE) {
+                m->tile_snakes[(y / VIEW_TILE) * g_tile_cols + x / VIEW_TILE]++;
+            }
+        }
+    }
+    
+    const PlayerChange *players = (const PlayerChange *)(rle + hdr->map_bytes);
+    for (int i = 0; i < hdr->player_count; i++) {
+        if (players[i].slot < g_cfg.max_players) {
+            m->players[players[i].slot] = players[i];
+        }
+    }
+    
+    /* The roster: the OP_PLAYER_JOINs behind the map */
+    memset(m->roster, 0, g_cfg.max_players * sizeof(PlayerJoin));
+    for (uint32_t off = used; off < len; off += used) {
+        used = decode_packet(g_view_scratch + off, len - off, &opcode, &payload, &plen);
+        if (used <= 0) break;
+        const PlayerJoin *ev = (const PlayerJoin *)payload;
+        if (opcode == OP_PLAYER_JOIN && plen >= sizeof(PlayerJoin) && ev->slot < g_cfg.max_players) {
+            m->roster[ev->slot] = *ev;
+        }
+    }
+    m->tick = tick;
+}
+
+/* Encode an OP_MINIMAP of the mirror into `out`. Unless `full`, the
+ * scoreboard part only holds the entries that changed since the previous
+ * OP_MINIMAP. Returns the frame length. */
+static uint32_t build_minimap(const Mirror *m, uint8_t *out, bool full) {
+    static uint8_t payload[MINIMAP_MAX_PAYLOAD];
+    MinimapHeader *hdr = (MinimapHeader *)payload;
+    uint8_t *tiles = (uint8_t *)(hdr + 1);
+    int count = g_tile_cols * g_tile_cols;
+    
+    for (int i = 0; i < count; i++) {
+        tiles[i] = m->tile_snakes[i] > 255 ? 255 : m->tile_snakes[i];
+    }
+    
+    PlayerChange *players = (PlayerChange *)(tiles + count);
+    int player_count = 0;
+    for (int j = 0; j < g_cfg.max_players; j++) {
+        uint32_t id = m->roster[j].player_id;
+        if (id == 0) continue;
+        if (!full && m->minimap_ids[j] == id &&
+            memcmp(&m->players[j], &m->minimap_players[j], sizeof(PlayerChange)) == 0)
+            continue;
+        players[player_count++] = m->players[j];
+    }
+    
+    hdr->tick = m->tick;
+    hdr->cols = g_tile_cols;
+    hdr->rows = g_tile_cols;
+    hdr->player_count = player_count;
+    return encode_packet(out, OP_MINIMAP, payload,
+                         sizeof(*hdr) + count + player_count * sizeof(PlayerChange));
+}
+
+/* Bring the mirror of the bound arena up to `tick`, and build the next
+ * OP_MINIMAP when it crosses a MINIMAP_INTERVAL boundary */
+static void mirror_sync(Mirror *m, uint64_t tick) {
+    if (m->tick >= tick) return;
+    
+    if (m->tick == 0 || tick - m->tick >= MAP_DELTA_HISTORY) {
+        mirror_reload(m);
+    } else {
+        while (m->tick < tick) {
+            if (!mirror_apply(m, m->tick + 1)) {
+                mirror_reload(m);
+                break;
+            }
+            m->tick++;
+        }
+    }
+    
+    if (m->tick / MINIMAP_INTERVAL != m->minimap_tick / MINIMAP_INTERVAL) {
+        m->minimap_len = build_minimap(m, m->minimap, false);
+        m->minimap_prev_tick = m->minimap_tick;
+        m->minimap_tick = m->tick;
+        memcpy(m->minimap_players, m->players, g_cfg.max_players * sizeof(PlayerChange));
+        for (int j = 0; j < g_cfg.max_players; j++) {
+            m->minimap_ids[j] = m->roster[j].player_id;
+        }
+    }
+}
+
+/* Queue the newest OP_MINIMAP: the changes since the previous one if the
+ * client got that (or anything newer), otherwise, or if `full`, all of it.
+ * Returns -1 if the connection should be closed. */
+static int send_minimap(ClientInfo *c, bool full) {
+    Mirror *m = g_mirrors[c->arena];
+    ClientView *v = c->view;
+    
+    if (!full && v->minimap_tick > 0 && v->minimap_tick >= m->minimap_prev_tick) {
+        if (v->minimap_tick >= m->minimap_tick) return 0;
+        v->minimap_tick = m->minimap_tick;
+        return conn_write(c, m->minimap, m->minimap_len);
+    }
+    
+    if (m->full_tick != m->tick) {
+        m->full_len = build_minimap(m, m->full, true);
+        m->full_tick = m->tick;
+    }
+    v->minimap_tick = m->tick;
+    return conn_write(c, m->full, m->full_len);
+}
+
+/* Start a client over on the mirror's roster and a full OP_MINIMAP. Returns
+ * -1 if the connection should be closed. */
+static int send_roster(ClientInfo *c) {
+    static uint8_t frame[MAX_PLAYERS_LIMIT * (sizeof(PacketHeader) + sizeof(PlayerJoin))];
+    const Mirror *m = g_mirrors[c->arena];
+    size_t n = 0;
+    
+    for (int j = 0; j < g_cfg.max_players; j++) {
+        if (m->roster[j].player_id) {
+            n += encode_packet(frame + n, OP_PLAYER_JOIN, &m->roster[j], sizeof(PlayerJoin));
+        }
+    }
+    if (n > 0 && conn_write(c, frame, n) < 0) return -1;
+    return send_minimap(c, true);
+}
+
+/* Bytes of roster events heading a delta frame, before its OP_MAP_DELTA */
+static uint32_t frame_events_len(const uint8_t *frame, uint32_t len) {
+    uint32_t off = 0;
+    while (off + sizeof(PacketHeader) <= len) {
+        const PacketHeader *hdr = (const PacketHeader *)(frame + off);
+        if (ntohs(hdr->opcode) == OP_MAP_DELTA) break;
+        off += sizeof(PacketHeader) + ntohl(hdr->length);
+    }
+    return off < len ? off : len;
+}
+
+/* Append the cells of one region tile that differ from what the client holds */
+static int diff_tile(const Mirror *m, ViewTile *vt, int tx, int ty, CellChange *out, int n) {
+    int x1 = (tx + 1) * VIEW_TILE, y1 = (ty + 1) * VIEW_TILE;
+    if (x1 > g_cfg.grid_size) x1 = g_cfg.grid_size;
+    if (y1 > g_cfg.grid_size) y1 = g_cfg.grid_size;
+    
+    for (int y = ty * VIEW_TILE; y < y1; y++) {
+        const MapCell *row = m->map + y * g_cfg.grid_size;
+        MapCell *have = vt->cells + (y % VIEW_TILE) * VIEW_TILE;
+        for (int x = tx * VIEW_TILE; x < x1; x++) {
+            if (have[x % VIEW_TILE] == row[x]) continue;
+            have[x % VIEW_TILE] = row[x];
+            out[n].x = x;
+            out[n].y = y;
+            out[n].cell = row[x];
+            n++;
+        }
+    }
+    return n;
+}
+
+/* Bring an interest-managed client up to the mirror's tick: the roster events
+ * since its tick, then one OP_VIEW_DELTA. When they are gone from the ring it
+ * starts over, followed by the roster and a full OP_MINIMAP. Returns -1 if
+ * the connection should be closed. */
+static int send_view_update(ClientInfo *c) {
+    static uint8_t payload[VIEW_DELTA_MAX_PAYLOAD];
+    const Mirror *m = g_mirrors[c->arena];
+    ClientView *v = c->view;
+    uint64_t tick = m->tick;
+    bool reset = c->last_map_tick == 0 || tick - c->last_map_tick >= MAP_DELTA_HISTORY;
+    
+    if (c->last_map_tick >= tick) return 0;
+    for (uint64_t t = c->last_map_tick + 1; !reset && t <= tick; t++) {
+        uint32_t len;
+        const uint8_t *frame = delta_frame(t, g_delta_scratch, &len);
+        if (!frame) {
+            reset = true;
+            break;
+        }
+        uint32_t events = frame_events_len(frame, len);
+        if (events > 0 && conn_write(c, frame, events) < 0) return -1;
+    }
+    
+    /* The region follows the snake; while it is dead the old one stays */
+    const Snake *s = &g_snakes[c->player_slot];
+    if (reset || s->alive) {
+        __atomic_load(&s->head, &v->head, __ATOMIC_RELAXED);
+        int reach = VIEW_REACH(v->view_size), last = g_tile_cols - 1;
+        int hx = v->head.x / VIEW_TILE, hy = v->head.y / VIEW_TILE;
+        v->tx = hx - reach < 0 ? 0 : hx - reach;
+        v->ty = hy - reach < 0 ? 0 : hy - reach;
+        v->tw = (hx + reach > last ? last : hx + reach) + 1 - v->tx;
+        v->th = (hy + reach > last ? last : hy + reach) + 1 - v->ty;
+    }
+    
+    /* Tiles that left the region are cleared by the client */
+    for (int i = 0; i < v->k * v->k; i++) {
+        ViewTile *vt = &v->tiles[i];
+        if (vt->tile == NO_INDEX) continue;
+        int tx = vt->tile % g_tile_cols, ty = vt->tile / g_tile_cols;
+        if (reset || tx < v->tx || tx >= v->tx + v->tw || ty < v->ty || ty >= v->ty + v->th) {
+            vt->tile = NO_INDEX;
+        }
+    }
+    
+    ViewDeltaHeader *hdr = (ViewDeltaHeader *)payload;
+    CellChange *cells = (CellChange *)(hdr + 1);
+    int cell_count = 0;
+    for (int ty = v->ty; ty < v->ty + v->th; ty++) {
+        for (int tx = v->tx; tx < v->tx + v->tw; tx++) {
+            int tile = ty * g_tile_cols + tx;
+            ViewTile *vt = &v->tiles[(ty % v->k) * v->k + tx % v->k];
+            if (vt->tile != tile) {
+                /* New to the region: the client holds it empty */
+                vt->tile = tile;
+                memset(vt->cells, 0, sizeof(vt->cells));
+            } else if (m->tile_tick[tile] <= c->last_map_tick) {
+                continue;
+            }
+            cell_count = diff_tile(m, vt, tx, ty, cells, cell_count);
+        }
+    }
+    
+    PlayerChange *players = (PlayerChange *)(cells + cell_count);
+    int player_count = 0;
+    const PlayerChange *own = &m->players[c->player_slot];
+    if (reset || memcmp(own, &v->own, sizeof(PlayerChange)) != 0) {
+        v->own = *own;
+        players[player_count++] = *own;
+    }
+    
+    int right = (v->tx + v->tw) * VIEW_TILE, bottom = (v->ty + v->th) * VIEW_TILE;
+    hdr->tick = tick;
+    hdr->base_tick = reset ? 0 : c->last_map_tick;
+    hdr->x = v->tx * VIEW_TILE;
+    hdr->y = v->ty * VIEW_TILE;
+    hdr->w = (right < g_cfg.grid_size ? right : g_cfg.grid_size) - hdr->x;
+    hdr->h = (bottom < g_cfg.grid_size ? bottom : g_cfg.grid_size) - hdr->y;
+    hdr->head_x = v->head.x;
+    hdr->head_y = v->head.y;
+    hdr->cell_count = cell_count;
+    hdr->player_count = player_count;
+    if (conn_send_packet(c, OP_VIEW_DELTA, payload, sizeof(*hdr) +
+                         cell_count * sizeof(CellChange) +
+                         player_count * sizeof(PlayerChange)) < 0) return -1;
+    c->last_map_tick = tick;
+    
+    return reset ? send_roster(c) : 0;
+}
+
+/* Copy chat message `n` out of the ring. Returns 1 on success, 0 if it is not
+ * published yet and -1 if it has already been overwritten. */
+static int chat_read(uint64_t n, ChatMessage *out) {
+    const ChatSlot *slot = &g_state->chat_ring[n % MAX_CHAT_HISTORY];
+    uint64_t want = 2 * n + 2;
+    
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq < want) return 0;
+    if (seq > want) return -1;
+    
+    memcpy(out, (const void *)&slot->msg, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == want ? 1 : -1;
+}
+
+/* Encoded OP_CHAT_BATCH for one cursor into an arena's chat. Clients that
+ * are caught up share a cursor, so update_clients() builds the frame once per
+ * pass for all of them. */
+typedef struct {
+    bool valid;
+    uint64_t from;        /* Cursor the batch was built for */
+    uint64_t head;        /* chat_count at the time */
+    uint64_t next;        /* Cursor after sending it */
+    size_t len;           /* 0 if there is nothing to send */
+    uint8_t frame[sizeof(PacketHeader) + sizeof(ChatBatchHeader) +
+                  MAX_CHAT_HISTORY * sizeof(ChatRecv)];
+} ChatBatch;
+
+static ChatBatch g_chat_batches[MAX_ARENAS];
+
+static void build_chat_batch(ChatBatch *b, uint64_t from, uint64_t head) {
+    static uint8_t payload[sizeof(ChatBatchHeader) + MAX_CHAT_HISTORY * sizeof(ChatRecv)];
+    ChatBatchHeader *hdr = (ChatBatchHeader *)payload;
+    ChatRecv *out = (ChatRecv *)(hdr + 1);
+    uint64_t missed = 0;
+    uint64_t n = from;
+    
+    /* Anything older than the ring is gone */
+    if (head - n > MAX_CHAT_HISTORY) {
+        missed = head - n - MAX_CHAT_HISTORY;
+        n = head - MAX_CHAT_HISTORY;
+    }
+    
+    int count = 0;
+    for (; n < head; n++) {
+        ChatMessage msg;
+        int ret = chat_read(n, &msg);
+        if (ret == 0) break;      /* Writer still busy: resume here next pass */
+        if (ret < 0) {
+            missed++;
+            continue;
+        }
+        
+        out[count].sender_id = msg.sender_id;
+        memcpy(out[count].sender_name, msg.sender_name, MAX_NAME_LEN);
+        memcpy(out[count].text, msg.text, MAX_CHAT_LEN);
+        count++;
+    }
+    
+    hdr->count = count;
+    hdr->missed = missed > UINT16_MAX ? UINT16_MAX : missed;
+    
+    b->valid = true;
+    b->from = from;
+    b->head = head;
+    b->next = n;
+    b->len = (count || missed) ?
+        encode_packet(b->frame, OP_CHAT_BATCH, payload,
+                      sizeof(*hdr) + count * sizeof(ChatRecv)) : 0;
+}
+
+/* Send new chat messages as one batch. Returns -1 if the connection should be
+ * closed. */
+static int send_chat_updates(ClientInfo *client) {
+    ChatBatch *b = &g_chat_batches[g_arena];
+    uint64_t head = __atomic_load_n(&g_state->chat_count, __ATOMIC_ACQUIRE);
+    if (head == client->last_chat_idx) {
+        return 0;
+    }
+    
+    if (!b->valid || b->from != client->last_chat_idx || b->head != head) {
+        build_chat_batch(b, client->last_chat_idx, head);
+    }
+    
+    client->last_chat_idx = b->next;
+    return b->len ? conn_write(client, b->frame, b->len) : 0;
+}
+
+/* Push map and chat updates to every logged-in client and spectator */
+static void update_clients(void) {
+    uint64_t start = get_time_ns();
+    
+    /* Writers may have finished slots the cached batches stopped at */
+    for (int a = 0; a < g_num_arenas; a++) {
+        g_chat_batches[a].valid = false;
+        if (g_mirrors[a]) {
+            arena_bind(a);
+            mirror_sync(g_mirrors[a], g_state->tick);
+        }
+    }
+    
+    /* Walk backwards: closing a connection moves the last one into its slot */
+    for (int i = g_conn_count - 1; i >= 0; i--) {
+        ClientInfo *c = &g_clients[g_conns[i]];
+        if (c->player_slot < 0 && !c->spectator) continue;
+        
+        arena_bind(c->arena);
+        uint64_t current_tick = g_state->tick;
+        hist_add(&g_wm->send_queue, outbuf_pending(&c->out));
+        uint64_t target = c->view ? g_mirrors[c->arena]->tick : current_tick;
+        if (c->last_map_tick < target && (c->view || !send_udp_update(c, current_tick))) {
+            if (outbuf_pending(&c->out) >= CLIENT_OUT_LOW_WATER) {
+                c->frames_skipped++;
+                g_wm->frames_skipped++;
+            } else if ((c->view ? send_view_update(c) : send_map_update(c, current_tick)) < 0) {
+                conn_close(c);
+                continue;
+            }
+        }
+        /* The minimap carries the scoreboard: it is never skipped */
+        if ((c->view && send_minimap(c, false) < 0) || send_input_ack(c) < 0 ||
+            send_chat_updates(c) < 0) {
+            conn_close(c);
+        }
+    }
+    
+    hist_add(&g_wm->update_ns, get_time_ns() - start);
+}
+
+/* Socket drained some of its backlog: flush, and once below the low-water
+ * mark catch the client up on ticks it skipped */
+static int conn_writable(ClientInfo *c) {
+    if (outbuf_flush(c->fd, &c->out) < 0) return -1;
+    
+    arena_bind(c->arena);
+    uint64_t current_tick = g_state->tick;
+    if (c->view && c->player_slot >= 0 && outbuf_pending(&c->out) < CLIENT_OUT_LOW_WATER) {
+        mirror_sync(g_mirrors[c->arena], current_tick);
+        return send_view_update(c);
+    }
+    if ((c->player_slot >= 0 || c->spectator) && c->last_map_tick < current_tick &&
+        outbuf_pending(&c->out) < CLIENT_OUT_LOW_WATER && !send_udp_update(c, current_tick)) {
+        return send_map_update(c, current_tick);
+    }
+    return 0;
+}
+
+static void accept_clients(int worker_id) {
+    for (;;) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int new_fd = accept(g_server_fd, (struct sockaddr*)&client_addr, &addr_len);
+        
+        if (new_fd < 0) {
+            if (errno == EINTR) continue;
+            return; /* EAGAIN: another worker won the race, or backlog drained */
+        }
+        
+        if (g_epoll_fd < 0 && new_fd >= FD_SETSIZE) {
+            close(new_fd);
+            continue;
+        }
+        if (!conn_open(new_fd)) continue;
+        
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof(ip));
+        printf("[WORKER %d] New connection from %s (fd=%d)\n", 
+               worker_id, ip, new_fd);
+    }
+}
+
+/* ============================================================================
+ * Hot Restart (./server --takeover)
+ *
+ * The game state lives in named segments that outlast any one process, so a
+ * new server binary can take over a running one in place:
+ *
+ * 1. The new master calls the old one on its control socket (an abstract
+ *    unix socket named after the port) and gets the listening sockets.
+ * 2. It maps the live segments, checking STATE_VERSION and the layout, opens
+ *    one handoff socket per worker and forks its workers.
+ * 3. The old master sends SIGUSR2 to its game loops, which stop between two
+ *    ticks, and to its workers. Each old worker passes its UDP socket and
+ *    every connection, with what is still buffered either way, to the new
+ *    worker of the same number and exits without touching the players.
+ * 4. Once the old master reports all of them gone, the new master forks its
+ *    game loops, which go on from the next tick. Without that report it
+ *    exits instead, leaving the segments as they are.
+ *
+ * Clients see a pause of a few ticks and then a fresh snapshot. The worker
+ * count and the arenas carry over; relays cannot be taken over.
+ * ============================================================================ */
+
+#define HANDOFF_TIMEOUT_MS  5000
+
+typedef struct {
+    uint32_t magic;           /* STATE_MAGIC */
+    uint32_t version;         /* STATE_VERSION of the sender */
+    int32_t pid;
+    int32_t num_workers;      /* Reply: the listeners come attached, one per */
+    int32_t num_arenas;       /* worker or a single shared one */
+} TakeoverHello;
+
+/* Heads a connection on the handoff socket, the client's fd attached, and is
+ * followed by in_len then out_len bytes. The first message on the socket
+ * carries the worker's UDP socket instead and has player_slot -2. */
+typedef struct {
+    int32_t arena;
+    int32_t player_slot;
+    uint8_t spectator;
+    uint8_t feed;
+    uint8_t compression;
+    uint8_t udp_bound;
+    uint16_t view_size;       /* 0 without a view */
+    uint16_t pad;
+    uint64_t last_chat_idx;
+    uint32_t udp_token;
+    uint32_t udp_conn;
+    uint32_t input_seq;
+    struct sockaddr_in udp_addr;
+    uint32_t in_len;          /* Part of a packet received */
+    uint32_t out_len;         /* Bytes the socket had not taken yet */
+} HandoffClient;
+
+/* Where the master of `port` takes calls (worker < 0), or where the new
+ * worker `worker` waits for the clients of its predecessor */
+static socklen_t handoff_address(struct sockaddr_un *addr, int port, int worker) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = worker < 0 ? snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                                  "snake-server-%d", port)
+                       : snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                                  "snake-server-%d.%d", port, worker);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+/* Abstract sockets are open to every local user: only talk to our own */
+static bool peer_is_us(int fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+           (cred.uid == getuid() || cred.uid == 0);
+}
+
+static void set_recv_timeout(int fd, int ms) {
+    struct timeval tv = { ms / 1000, (ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Returns 0, or -1 on error, timeout or end of stream */
+static int read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Send `len` bytes with `nfds` descriptors attached */
+static int send_fds(int sock, const void *buf, size_t len, const int *fds, int nfds) {
+    char control[CMSG_SPACE(sizeof(int) * MAX_WORKERS)];
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    
+    if (nfds > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+    
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    return write_full(sock, (const uint8_t *)buf + n, len - n);
+}
+
+/* Receive `len` bytes and up to `max` descriptors (*nfds of them came).
+ * Returns 1, 0 at the end of the stream, or -1. */
+static int recv_fds(int sock, void *buf, size_t len, int *fds, int max, int *nfds) {
+    char control[CMSG_SPACE(sizeof(int) * MAX_WORKERS)];
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control, .msg_controllen = sizeof(control)
+    };
+    
+    *nfds = 0;
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return n;
+    
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *got = (const int *)CMSG_DATA(cm);
+        for (int i = 0; i < count; i++) {
+            if (*nfds < max) {
+                fds[(*nfds)++] = got[i];
+            } else {
+                close(got[i]);
+            }
+        }
+    }
+    return read_full(sock, (uint8_t *)buf + n, len - n) < 0 ? -1 : 1;
+}
+
+/* Hand one connection over. Returns -1 if the handoff socket broke. */
+static int handoff_client(int sock, ClientInfo *c) {
+    outbuf_flush(c->fd, &c->out);
+    
+    HandoffClient h;
+    memset(&h, 0, sizeof(h));
+    h.arena = c->arena;
+    h.player_slot = c->player_slot;
+    h.spectator = c->spectator;
+    h.feed = c->feed;
+    h.compression = c->compression;
+    h.udp_bound = c->udp_bound;
+    h.view_size = c->view ? c->view->view_size : 0;
+    h.last_chat_idx = c->last_chat_idx;
+    h.udp_token = c->udp_token;
+    h.udp_conn = c->udp_conn;
+    h.input_seq = c->input_seq;
+    h.udp_addr = c->udp_addr;
+    h.in_len = c->in_len;
+    h.out_len = outbuf_pending(&c->out);
+    
+    /* The queue is a ring: its bytes may wrap around */
+    size_t first = c->out.cap - c->out.head;
+    if (first > h.out_len) first = h.out_len;
+    if (send_fds(sock, &h, sizeof(h), &c->fd, 1) < 0 ||
+        write_full(sock, c->in_buf, h.in_len) < 0) return -1;
+    if (h.out_len > 0 &&
+        (write_full(sock, c->out.data + c->out.head, first) < 0 ||
+         write_full(sock, c->out.data, h.out_len - first) < 0)) return -1;
+    return 0;
+}
+
+/* Old worker, after SIGUSR2: pass everything on to the new worker of the
+ * same number. Clients it cannot take are disconnected as usual. */
+static void handoff_clients(void) {
+    struct sockaddr_un addr;
+    socklen_t addr_len = handoff_address(&addr, g_port, g_worker_id);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr *)&addr, addr_len) < 0) {
+        fprintf(stderr, "[WORKER %d] No new worker to hand over to: %s\n", g_worker_id,
+                strerror(errno));
+        close(sock);
+        sock = -1;
+    }
+    
+    HandoffClient hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.player_slot = -2;
+    if (sock >= 0 && send_fds(sock, &hello, sizeof(hello), &g_udp_fd, g_udp_fd >= 0) < 0) {
+        close(sock);
+        sock = -1;
+    }
+    
+    int handed = 0;
+    while (g_conn_count > 0) {
+        ClientInfo *c = &g_clients[g_conns[g_conn_count - 1]];
+        if (sock >= 0 && handoff_client(sock, c) == 0) {
+            conn_drop(c);
+            handed++;
+            continue;
+        }
+        if (sock >= 0) {
+            close(sock);
+            sock = -1;
+        }
+        conn_close(c);
+    }
+    if (sock >= 0) close(sock);
+    printf("[WORKER %d] Handed over %d connections.\n", g_worker_id, handed);
+}
+
+/* Adopted clients whose fd is not the conn id their datagrams carry, sorted
+ * by that id */
+typedef struct {
+    uint32_t conn;
+    int fd;
+} ConnAlias;
+
+static ConnAlias *g_aliases = NULL;
+static int g_alias_count = 0;
+
+static int alias_cmp(const void *a, const void *b) {
+    uint32_t x = ((const ConnAlias *)a)->conn, y = ((const ConnAlias *)b)->conn;
+    return x < y ? -1 : x > y;
+}
+
+/* The adopted client datagrams with `conn` and `token` come from, or NULL */
+static ClientInfo *conn_alias(uint32_t conn, uint32_t token) {
+    int lo = 0, hi = g_alias_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (g_aliases[mid].conn < conn) lo = mid + 1; else hi = mid;
+    }
+    
+    /* Two generations of adoption can leave the same id twice */
+    for (; lo < g_alias_count && g_aliases[lo].conn == conn; lo++) {
+        ClientInfo *c = &g_clients[g_aliases[lo].fd];
+        if (c->fd >= 0 && c->udp_conn == conn && c->udp_token == token) return c;
+    }
+    return NULL;
+}
+
+/* Read one handed-over connection. Returns false once the stream is over. */
+static bool adopt_client(int sock) {
+    HandoffClient h;
+    int fd, nfds;
+    if (recv_fds(sock, &h, sizeof(h), &fd, 1, &nfds) <= 0) return false;
+    if (nfds != 1 || h.in_len > CLIENT_INBUF_MAX || h.out_len > CLIENT_OUT_HIGH_WATER) {
+        if (nfds == 1) close(fd);
+        return false;
+    }
+    
+    uint8_t *bytes = malloc(h.in_len + h.out_len + 1);
+    if (!bytes || read_full(sock, bytes, h.in_len + h.out_len) < 0) {
+        free(bytes);
+        close(fd);
+        return false;
+    }
+    
+    bool valid = h.arena >= 0 && h.arena < g_num_arenas && h.player_slot >= -1 &&
+                 h.player_slot < g_cfg.max_players;
+    ClientInfo *c = valid ? conn_open(fd) : NULL;   /* Which closes what it refuses */
+    if (!c) {
+        if (!valid) close(fd);
+        free(bytes);
+        return true;
+    }
+    
+    c->arena = h.arena;
+    c->player_slot = h.player_slot;
+    c->spectator = h.spectator;
+    c->feed = h.feed;
+    c->compression = h.compression;
+    c->last_chat_idx = h.last_chat_idx;
+    if (c->spectator) g_wm->spectators++;
+    
+    if (h.in_len > c->in_cap) {
+        uint8_t *buf = realloc(c->in_buf, h.in_len);
+        if (buf) {
+            c->in_buf = buf;
+            c->in_cap = h.in_len;
+        }
+    }
+    if (h.in_len <= c->in_cap) {
+        memcpy(c->in_buf, bytes, h.in_len);
+        c->in_len = h.in_len;
+    }
+    
+    /* The rest of a packet the old worker began goes out before anything */
+    int ret = outbuf_write(c->fd, &c->out, bytes + h.in_len, h.out_len);
+    free(bytes);
+    
+    arena_bind(c->arena);
+    if (h.view_size > 0 && c->player_slot >= 0 &&
+        (g_mirrors[g_arena] || (g_mirrors[g_arena] = mirror_create()))) {
+        c->view = view_create(h.view_size);
+    }
+    
+    /* The UDP channel survives only if the socket came along */
+    if (g_udp_fd >= 0 && h.udp_token != 0) {
+        c->udp_token = h.udp_token;
+        c->udp_conn = h.udp_conn;
+        c->udp_bound = h.udp_bound;
+        c->udp_addr = h.udp_addr;
+        c->input_seq = h.input_seq;
+        if (h.udp_conn != (uint32_t)fd) {
+            ConnAlias *a = realloc(g_aliases, (g_alias_count + 1) * sizeof(ConnAlias));
+            if (a) {
+                g_aliases = a;
+                g_aliases[g_alias_count].conn = h.udp_conn;
+                g_aliases[g_alias_count].fd = fd;
+                g_alias_count++;
+            }
+        }
+    }
+    
+    if (ret < 0) conn_close(c);
+    return true;
+}
+
+/* New worker, before serving: take the clients of the old worker of the same
+ * number, with its UDP socket. Their last_map_tick is 0, so each gets a
+ * snapshot first. */
+static void adopt_clients(void) {
+    int lfd = g_handoff_fds[g_worker_id];
+    g_handoff_fds[g_worker_id] = -1;
+    
+    struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+    int sock = poll(&pfd, 1, HANDOFF_TIMEOUT_MS) > 0 ? accept(lfd, NULL, NULL) : -1;
+    close(lfd);
+    if (sock >= 0 && !peer_is_us(sock)) {
+        close(sock);
+        sock = -1;
+    }
+    if (sock < 0) {
+        fprintf(stderr, "[WORKER %d] The old worker handed nothing over\n", g_worker_id);
+        return;
+    }
+    set_recv_timeout(sock, HANDOFF_TIMEOUT_MS);
+    
+    HandoffClient hello;
+    int nfds;
+    if (recv_fds(sock, &hello, sizeof(hello), &g_udp_fd, 1, &nfds) <= 0 ||
+        hello.player_slot != -2) {
+        if (nfds == 1) close(g_udp_fd);
+        g_udp_fd = -1;
+        close(sock);
+        return;
+    }
+    if (nfds == 1) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (set_nonblocking(g_udp_fd) < 0 ||
+            getsockname(g_udp_fd, (struct sockaddr *)&addr, &len) < 0) {
+            close(g_udp_fd);
+            g_udp_fd = -1;
+        } else {
+            g_udp_port = ntohs(addr.sin_port);
+        }
+    }
+    
+    while (adopt_client(sock));
+    close(sock);
+    qsort(g_aliases, g_alias_count, sizeof(ConnAlias), alias_cmp);
+    printf("[WORKER %d] Adopted %d connections.\n", g_worker_id, g_conn_count);
+}
+
+/* ============================================================================
+ * Worker Process
+ * ============================================================================ */
+
+/* Sum of every arena's tick and chat count: changes whenever any arena has
+ * something new to push */
+static uint64_t arenas_version(void) {
+    uint64_t v = 0;
+    for (int a = 0; a < g_num_arenas; a++) {
+        v += g_arenas[a]->tick + __atomic_load_n(&g_arenas[a]->chat_count, __ATOMIC_ACQUIRE);
+    }
+    return v;
+}
+
+static void worker_loop_select(int worker_id) {
+    fd_set readfds, writefds;
+    int tick_fd = g_tick_fds[worker_id];
+    
+    while (g_state->running && !g_handoff) {
+        int max_fd = g_server_fd > tick_fd ? g_server_fd : tick_fd;
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        FD_SET(g_server_fd, &readfds);
+        FD_SET(tick_fd, &readfds);
+        if (g_udp_fd >= 0) {
+            FD_SET(g_udp_fd, &readfds);
+            if (g_udp_fd > max_fd) max_fd = g_udp_fd;
+        }
+        
+        for (int i = 0; i < g_conn_count; i++) {
+            int fd = g_conns[i];
+            FD_SET(fd, &readfds);
+            if (outbuf_pending(&g_clients[fd].out) > 0) FD_SET(fd, &writefds);
+            if (fd > max_fd) max_fd = fd;
+        }
+        
+        /* The tick eventfd wakes us for new frames; the timeout is a fallback */
+        struct timeval tv = { 1, 0 };
+        int activity = select(max_fd + 1, &readfds, &writefds, NULL, &tv);
+        
+        if (activity < 0 && errno != EINTR) {
+            break;
+        }
+        
+        if (activity > 0 && FD_ISSET(tick_fd, &readfds)) {
+            uint64_t count;
+            while (read(tick_fd, &count, sizeof(count)) > 0);
+        }
+        
+        update_clients();
+        
+        if (activity <= 0) continue;
+        
+        for (int i = g_conn_count - 1; i >= 0; i--) {
+            ClientInfo *c = &g_clients[g_conns[i]];
+            if ((FD_ISSET(c->fd, &readfds) && conn_read(c) < 0) ||
+                (FD_ISSET(c->fd, &writefds) && conn_writable(c) < 0)) {
+                conn_close(c);
+            }
+        }
+        
+        if (g_udp_fd >= 0 && FD_ISSET(g_udp_fd, &readfds)) {
+            udp_read();
+        }
+        
+        if (FD_ISSET(g_server_fd, &readfds)) {
+            accept_clients(worker_id);
+        }
+    }
+}
+
+static void worker_loop_epoll(int worker_id) {
+    struct epoll_event events[256];
+    int tick_fd = g_tick_fds[worker_id];
+    uint64_t last_version = 0;
+    
+    g_epoll_fd = epoll_create1(0);
+    if (g_epoll_fd < 0) {
+        perror("epoll_create1");
+        return;
+    }
+    
+    /* Only one worker is woken per incoming connection */
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.fd = g_server_fd };
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_server_fd, &ev);
+    
+    ev.events = EPOLLIN;
+    ev.data.fd = tick_fd;
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, tick_fd, &ev);
+    if (g_udp_fd >= 0) {
+        ev.data.fd = g_udp_fd;
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_udp_fd, &ev);
+    }
+    
+    /* Connections adopted in a takeover came before the epoll set */
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    for (int i = 0; i < g_conn_count; i++) {
+        ev.data.fd = g_conns[i];
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_conns[i], &ev);
+    }
+    
+    while (g_state->running && !g_handoff) {
+        int n = epoll_wait(g_epoll_fd, events, 256, 1000);
+        
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            uint32_t mask = events[i].events;
+            
+            if (fd == g_server_fd) {
+                accept_clients(worker_id);
+            } else if (fd == tick_fd) {
+                uint64_t count;
+                while (read(tick_fd, &count, sizeof(count)) > 0);
+            } else if (fd == g_udp_fd) {
+                udp_read();
+            } else {
+                ClientInfo *c = &g_clients[fd];
+                if (c->fd < 0) continue;
+                if ((mask & EPOLLIN) && conn_read(c) < 0) {
+                    conn_close(c);
+                } else if ((mask & EPOLLOUT) && conn_writable(c) < 0) {
+                    conn_close(c);
+                } else if (mask & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                    conn_close(c);
+                }
+            }
+        }
+        
+        /* Only walk the connection list when there is something to push */
+        uint64_t version = arenas_version();
+        if (version != last_version) {
+            last_version = version;
+            update_clients();
+        }
+    }
+    
+    close(g_epoll_fd);
+    g_epoll_fd = -1;
+}
+
+static void worker_process(int worker_id) {
+    printf("[WORKER %d] Started (PID: %d, %s)\n", worker_id, getpid(),
+           g_use_epoll ? "epoll" : "select");
+    
+    /* Keep only this worker's listener; with a shared one they all match */
+    g_worker_id = worker_id;
+    g_wm = &g_metrics->workers[worker_id];
+    g_server_fd = g_listen_fds[worker_id];
+    for (int i = 0; i < g_num_workers; i++) {
+        if (g_listen_fds[i] != g_server_fd) close(g_listen_fds[i]);
+        if (i != worker_id && g_handoff_fds[i] >= 0) close(g_handoff_fds[i]);
+    }
+    signal(SIGUSR2, handoff_handler);
+    
+    srand(time(NULL) ^ getpid());
+    
+    struct rlimit rl;
+    g_max_clients = FD_SETSIZE;
+    if (g_use_epoll && getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+        rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > (rlim_t)g_max_clients) {
+        g_max_clients = rl.rlim_cur;
+    }
+    
+    g_clients = calloc(g_max_clients, sizeof(ClientInfo));
+    g_conns = calloc(g_max_clients, sizeof(int));
+    g_delta_scratch = malloc(delta_frame_cap(&g_cfg));
+    if (!g_clients || !g_conns || !g_delta_scratch) {
+        perror("calloc");
+        return;
+    }
+    for (int a = 0; a < g_num_arenas; a++) {
+        g_frame_caches[a].snapshot = malloc(2 * snapshot_frame_cap(&g_cfg));
+        g_frame_caches[a].delta = malloc(delta_frame_cap(&g_cfg));
+        if (!g_frame_caches[a].snapshot || !g_frame_caches[a].delta) {
+            perror("malloc");
+            return;
+        }
+    }
+    for (int i = 0; i < g_max_clients; i++) {
+        g_clients[i].fd = -1;
+        g_clients[i].player_slot = -1;
+    }
+    if (g_cfg.grid_size > DEFAULT_GRID_SIZE && view_init() < 0) {
+        perror("calloc");
+        return;
+    }
+    
+    if (g_handoff_fds[worker_id] >= 0) {
+        adopt_clients();
+    }
+    if (g_udp_fd < 0) {
+        g_udp_fd = open_udp_socket();
+    }
+    if (g_udp_fd < 0) {
+        fprintf(stderr, "[WORKER %d] No UDP socket (%s), clients stay on TCP\n",
+                worker_id, strerror(errno));
+    } else {
+        printf("[WORKER %d] UDP channel on port %u\n", worker_id, g_udp_port);
+    }
+    
+    if (g_use_epoll) {
+        worker_loop_epoll(worker_id);
+    } else {
+        worker_loop_select(worker_id);
+    }
+    
+    if (g_handoff) {
+        handoff_clients();
+    }
+    if (g_udp_fd >= 0) close(g_udp_fd);
+    printf("[WORKER %d] Stopped.\n", worker_id);
+}
+
+/* ============================================================================
+ * Relay Feed (./server --relay)
+ *
+ * A relay runs no game. One connection spectates an arena upstream with
+ * SPECTATE_FEED, and the feed process stores what arrives in the relay's own
+ * arena segment exactly as it came, still encoded: deltas go into the delta
+ * ring and snapshots into the snapshot buffers. The workers then serve them as
+ * on a game server, so viewers get the upstream bytes unchanged and upstream
+ * sees a single connection however many watch. Only chat is decoded, into the
+ * relay's chat ring.
+ * ============================================================================ */
+
+/* Connect to HOST:PORT and spectate `arena` there. Returns the socket, with
+ * the upstream's reply in `resp`, or -1. */
+static int relay_connect(const char *endpoint, int arena, LoginResponse *resp) {
+    char host[256];
+    const char *colon = strrchr(endpoint, ':');
+    if (!colon || colon == endpoint || (size_t)(colon - endpoint) >= sizeof(host)) {
+        fprintf(stderr, "--relay wants HOST:PORT\n");
+        return -1;
+    }
+    memcpy(host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+    
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    int err = getaddrinfo(host, colon + 1, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "[RELAY] %s: %s\n", endpoint, gai_strerror(err));
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        fprintf(stderr, "[RELAY] %s: %s\n", endpoint, strerror(errno));
+        freeaddrinfo(res);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    freeaddrinfo(res);
+    
+    SpectateRequest req = {
+        .arena = arena,
+        .compression = COMPRESS_ZLIB,
+        .flags = SPECTATE_FEED
+    };
+    uint16_t opcode;
+    uint8_t payload[256];
+    uint32_t len;
+    
+    /* The reply comes before any frame */
+    if (send_packet(fd, OP_SPECTATE, &req, sizeof(req)) < 0 ||
+        recv_packet_into(fd, &opcode, payload, sizeof(payload), &len) < 0) {
+        fprintf(stderr, "[RELAY] %s: no reply\n", endpoint);
+        close(fd);
+        return -1;
+    }
+    if (opcode == OP_ERROR) {
+        fprintf(stderr, "[RELAY] %s: %.*s\n", endpoint, (int)len, (char *)payload);
+        close(fd);
+        return -1;
+    }
+    
+    memcpy(resp, payload, sizeof(*resp));
+    if (opcode != OP_LOGIN_RESP || len < sizeof(*resp) ||
+        resp->grid_width < MIN_GRID_SIZE || resp->grid_width > MAX_GRID_SIZE ||
+        resp->grid_width != resp->grid_height ||
+        resp->max_players == 0 || resp->max_players > MAX_PLAYERS_LIMIT) {
+        fprintf(stderr, "[RELAY] %s: unexpected reply\n", endpoint);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* What the feed has received but not stored yet */
+static struct {
+    uint8_t *in;            /* Raw bytes from upstream */
+    uint32_t in_len;
+    uint8_t *scratch;       /* Decoded copy of the packet at hand */
+    uint8_t *events;        /* Roster events waiting for their OP_MAP_DELTA */
+    uint32_t events_len;
+    uint8_t *snap;          /* Plain snapshot being gathered */
+    uint32_t snap_len;
+    int snap_joins;         /* OP_PLAYER_JOINs it still needs */
+    uint64_t snap_tick;
+} g_feed;
+
+/* Store a snapshot: `plain` holds the packets, `packed` the same in
+ * OP_COMPRESSED if that is how it came */
+static void relay_snapshot(uint64_t tick, const uint8_t *plain, uint32_t len,
+                           const uint8_t *packed, uint32_t zlen) {
+    if (tick <= g_state->snapshot_tick) return;
+    if (zlen > len) zlen = 0;    /* latest_snapshot() would refuse it */
+    
+    SnapshotFrame *snap = snapshot_slot(tick);
+    snap->tick = 0;
+    __sync_synchronize();
+    memcpy(snap->data, plain, len);
+    memcpy(snap->data + len, packed, zlen);
+    snap->len = len;
+    snap->zlen = zlen;
+    __sync_synchronize();
+    snap->tick = tick;
+    g_state->snapshot_tick = tick;
+    
+    /* The ring has nothing up to it: clients behind take this snapshot */
+    if (tick > g_state->tick) {
+        __sync_synchronize();
+        g_state->tick = tick;
+    }
+}
+
+/* Store the delta frame producing `tick` */
+static void relay_delta(uint64_t tick, const uint8_t *frame, uint32_t len) {
+    /* Nothing to apply it to yet, or a snapshot already covers it */
+    if (g_state->snapshot_tick == 0 || tick <= g_state->tick) return;
+    
+    MapDeltaFrame *delta = delta_slot(tick);
+    delta->tick = 0;
+    __sync_synchronize();
+    memcpy(delta->data, frame, len);
+    delta->overflow = false;
+    delta->len = len;
+    __sync_synchronize();
+    delta->tick = tick;
+    
+    __sync_synchronize();
+    g_state->tick = tick;
+}
+
+/* Decode the packet at `pkt` (`n` bytes) and store or gather it. Returns -1
+ * if the stream is not what a feed should carry. */
+static int relay_packet(const uint8_t *pkt, uint32_t n) {
+    ArenaMetrics *am = &g_metrics->arenas[0];
+    uint16_t opcode;
+    unsigned char *payload;
+    uint32_t len;
+    
+    memcpy(g_feed.scratch, pkt, n);
+    if (decode_packet(g_feed.scratch, n, &opcode, &payload, &len) != (int)n) return -1;
+    
+    /* A plain snapshot is its OP_MAP_UPDATE plus one join per player */
+    if (g_feed.snap_joins > 0) {
+        if (opcode != OP_PLAYER_JOIN || g_feed.snap_len + n > snapshot_frame_cap(&g_cfg)) {
+            return -1;
+        }
+        memcpy(g_feed.snap + g_feed.snap_len, pkt, n);
+        g_feed.snap_len += n;
+        if (--g_feed.snap_joins == 0) {
+            relay_snapshot(g_feed.snap_tick, g_feed.snap, g_feed.snap_len, NULL, 0);
+        }
+        return 0;
+    }
+    
+    switch (opcode) {
+        case OP_PLAYER_JOIN:
+        case OP_PLAYER_LEAVE: {
+            if (g_feed.events_len + n > delta_frame_cap(&g_cfg)) return -1;
+            memcpy(g_feed.events + g_feed.events_len, pkt, n);
+            g_feed.events_len += n;
+            break;
+        }
+        
+        case OP_MAP_DELTA: {
+            if (len < sizeof(MapDeltaHeader) || g_feed.events_len + n > delta_frame_cap(&g_cfg)) {
+                return -1;
+            }
+            const MapDeltaHeader *hdr = (const MapDeltaHeader *)payload;
+            memcpy(g_feed.events + g_feed.events_len, pkt, n);
+            relay_delta(hdr->tick, g_feed.events, g_feed.events_len + n);
+            g_feed.events_len = 0;
+            am->players = hdr->player_count;
+            break;
+        }
+        
+        case OP_MAP_UPDATE: {
+            if (len < sizeof(MapUpdateHeader) || n > snapshot_frame_cap(&g_cfg)) return -1;
+            const MapUpdateHeader *hdr = (const MapUpdateHeader *)payload;
+            g_feed.events_len = 0;    /* The snapshot's roster replaces them */
+            memcpy(g_feed.snap, pkt, n);
+            g_feed.snap_len = n;
+            g_feed.snap_tick = hdr->tick;
+            g_feed.snap_joins = hdr->player_count;
+            am->players = hdr->player_count;
+            if (g_feed.snap_joins == 0) {
+                relay_snapshot(g_feed.snap_tick, g_feed.snap, n, NULL, 0);
             }
-            close(client->fd);
-            client->fd = -1;
-            client->player_slot = -1;
             break;
         }
+        
+        case OP_COMPRESSED: {
+            /* Only snapshots come compressed: keep both forms */
+            if (len < sizeof(CompressedHeader)) return -1;
+            uLongf raw_len = ((const CompressedHeader *)payload)->raw_len;
+            if (raw_len > snapshot_frame_cap(&g_cfg) ||
+                uncompress(g_feed.snap, &raw_len, payload + sizeof(CompressedHeader),
+                           len - sizeof(CompressedHeader)) != Z_OK) return -1;
+            
+            /* Its first packet is the OP_MAP_UPDATE, which has the tick */
+            if (raw_len < sizeof(PacketHeader)) return -1;
+            uint32_t first = sizeof(PacketHeader) + ntohl(((PacketHeader *)g_feed.snap)->length);
+            if (first > raw_len) return -1;
+            memcpy(g_feed.scratch, g_feed.snap, first);
+            if (decode_packet(g_feed.scratch, first, &opcode, &payload, &len) != (int)first ||
+                opcode != OP_MAP_UPDATE || len < sizeof(MapUpdateHeader)) return -1;
+            
+            const MapUpdateHeader *hdr = (const MapUpdateHeader *)payload;
+            g_feed.events_len = 0;
+            am->players = hdr->player_count;
+            relay_snapshot(hdr->tick, g_feed.snap, raw_len, pkt, n);
+            break;
+        }
+        
+        case OP_CHAT_BATCH: {
+            if (len < sizeof(ChatBatchHeader)) return -1;
+            const ChatBatchHeader *hdr = (const ChatBatchHeader *)payload;
+            ChatRecv *msgs = (ChatRecv *)(payload + sizeof(*hdr));
+            if (len < sizeof(*hdr) + hdr->count * sizeof(ChatRecv)) return -1;
+            for (int i = 0; i < hdr->count; i++) {
+                msgs[i].sender_name[MAX_NAME_LEN - 1] = '\0';
+                msgs[i].text[MAX_CHAT_LEN - 1] = '\0';
+                add_chat_message(msgs[i].sender_id, msgs[i].sender_name, msgs[i].text);
+            }
+            break;
+        }
+        
+        case OP_ERROR: {
+            printf("[RELAY] Upstream error: %.*s\n", (int)len, (char *)payload);
+            return -1;
+        }
     }
-    
-    if (payload) free(payload);
+    return 0;
 }
 
-/* ============================================================================
- * Worker Process
- * ============================================================================ */
-
-static void worker_process(int worker_id) {
-    printf("[WORKER %d] Started (PID: %d)\n", worker_id, getpid());
-    
-    srand(time(NULL) ^ getpid());
+static void relay_process(void) {
+    printf("[RELAY] Feed process started (PID: %d)\n", getpid());
     
-    fd_set masterfds, readfds;
-    int max_fd = g_server_fd;
-    ClientInfo clients[FD_SETSIZE];
-    
-    for (int i = 0; i < FD_SETSIZE; i++) {
-        clients[i].fd = -1;
-        clients[i].player_slot = -1;
-        clients[i].last_chat_idx = 0;
-        clients[i].last_map_tick = 0;
+    g_feed.in = malloc(CLIENT_INBUF_MAX);
+    g_feed.scratch = malloc(CLIENT_INBUF_MAX);
+    g_feed.events = malloc(delta_frame_cap(&g_cfg));
+    g_feed.snap = malloc(snapshot_frame_cap(&g_cfg));
+    if (!g_feed.in || !g_feed.scratch || !g_feed.events || !g_feed.snap) {
+        perror("malloc");
+        return;
     }
     
-    FD_ZERO(&masterfds);
-    FD_SET(g_server_fd, &masterfds);
+    ArenaMetrics *am = &g_metrics->arenas[0];
+    GameLoopMetrics *lm = &g_metrics->loops[0];
     
     while (g_state->running) {
-        readfds = masterfds;
-        struct timeval tv = { 0, 50000 }; /* 50ms */
+        struct pollfd pfd = { .fd = g_upstream_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, 1000);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
         
-        int activity = select(max_fd + 1, &readfds, NULL, NULL, &tv);
-        
-        if (activity < 0 && errno != EINTR) {
+        ssize_t n = recv(g_upstream_fd, g_feed.in + g_feed.in_len,
+                         CLIENT_INBUF_MAX - g_feed.in_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            printf("[RELAY] Upstream closed the connection\n");
             break;
         }
+        g_feed.in_len += n;
         
-        uint64_t current_tick = g_state->tick;
-        
-        /* Send updates to all connected clients */
-        for (int i = 0; i <= max_fd; i++) {
-            if (i == g_server_fd || clients[i].fd <= 0 || clients[i].player_slot < 0)
-                continue;
-            
-            /* Send map update if tick changed */
-            if (clients[i].last_map_tick < current_tick) {
-                MapUpdate update;
-                
-                pthread_mutex_lock(&g_state->lock);
-                update.tick = g_state->tick;
-                memcpy(update.map, g_state->map, sizeof(update.map));
-                for (int j = 0; j < MAX_PLAYERS; j++) {
-                    update.scores[j] = g_state->players[j].score;
-                    update.alive[j] = g_state->players[j].snake.alive ? 1 : 0;
-                    update.active[j] = g_state->players[j].active ? 1 : 0;
-                    strncpy(update.names[j], g_state->players[j].name, MAX_NAME_LEN);
-                }
-                pthread_mutex_unlock(&g_state->lock);
-                
-                if (send_packet(clients[i].fd, OP_MAP_UPDATE, &update, sizeof(update)) == 0) {
-                    clients[i].last_map_tick = current_tick;
-                }
-            }
-            
-            /* Send new chat messages */
-            pthread_mutex_lock(&g_state->lock);
-            uint64_t current_chat = g_state->chat_count;
-            if (current_chat > clients[i].last_chat_idx) {
-                uint64_t num_new = current_chat - clients[i].last_chat_idx;
-                if (num_new > MAX_CHAT_HISTORY) num_new = MAX_CHAT_HISTORY;
-                
-                for (uint64_t c = 0; c < num_new; c++) {
-                    uint64_t msg_num = clients[i].last_chat_idx + c;
-                    int idx = msg_num % MAX_CHAT_HISTORY;
-                    
-                    ChatRecv chat_msg;
-                    chat_msg.sender_id = g_state->chat_history[idx].sender_id;
-                    strncpy(chat_msg.sender_name, g_state->chat_history[idx].sender_name, MAX_NAME_LEN);
-                    strncpy(chat_msg.text, g_state->chat_history[idx].text, MAX_CHAT_LEN);
-                    
-                    send_packet(clients[i].fd, OP_CHAT_RECV, &chat_msg, sizeof(chat_msg));
-                }
-                clients[i].last_chat_idx = current_chat;
+        uint64_t start = get_time_ns();
+        uint64_t tick = g_state->tick;
+        uint64_t chat = g_state->chat_count;
+        uint32_t off = 0;
+        bool bad = false;
+        while (g_feed.in_len - off >= sizeof(PacketHeader)) {
+            uint32_t plen = ntohl(((PacketHeader *)(g_feed.in + off))->length);
+            if (plen > MAX_PAYLOAD_SIZE) {
+                bad = true;
+                break;
             }
-            pthread_mutex_unlock(&g_state->lock);
-        }
-        
-        if (activity > 0) {
-            for (int i = 0; i <= max_fd; i++) {
-                if (FD_ISSET(i, &readfds)) {
-                    if (i == g_server_fd) {
-                        /* New connection */
-                        struct sockaddr_in client_addr;
-                        socklen_t addr_len = sizeof(client_addr);
-                        int new_fd = accept(g_server_fd, (struct sockaddr*)&client_addr, &addr_len);
-                        
-                        if (new_fd >= 0) {
-                            FD_SET(new_fd, &masterfds);
-                            if (new_fd > max_fd) max_fd = new_fd;
-                            
-                            clients[new_fd].fd = new_fd;
-                            clients[new_fd].player_slot = -1;
-                            clients[new_fd].last_chat_idx = g_state->chat_count;
-                            clients[new_fd].last_map_tick = 0;
-                            
-                            char ip[INET_ADDRSTRLEN];
-                            inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof(ip));
-                            printf("[WORKER %d] New connection from %s (fd=%d)\n", 
-                                   worker_id, ip, new_fd);
-                        }
-                    } else {
-                        /* Client data */
-                        handle_client_message(&clients[i]);
-                        
-                        if (clients[i].fd < 0) {
-                            FD_CLR(i, &masterfds);
-                        }
-                    }
-                }
+            uint32_t total = sizeof(PacketHeader) + plen;
+            if (g_feed.in_len - off < total) break;
+            if (relay_packet(g_feed.in + off, total) < 0) {
+                bad = true;
+                break;
             }
+            off += total;
+        }
+        if (bad) {
+            printf("[RELAY] Unexpected data from upstream\n");
+            break;
+        }
+        memmove(g_feed.in, g_feed.in + off, g_feed.in_len - off);
+        g_feed.in_len -= off;
+        
+        if (g_state->tick != tick) {
+            hist_add(&am->tick_ns, get_time_ns() - start);
+            am->ticks += g_state->tick - tick;
+            lm->ticks++;
+        }
+        if (g_state->tick != tick || g_state->chat_count != chat) {
+            wake_workers();
         }
     }
     
-    printf("[WORKER %d] Stopped.\n", worker_id);
+    /* Without upstream there is nothing to relay: take the server down */
+    if (g_state->running) {
+        kill(getppid(), SIGTERM);
+    }
+    printf("[RELAY] Feed process stopped.\n");
 }
 
 /* ============================================================================
@@ -658,7 +3004,9 @@ static void signal_handler(int sig) {
     (void)sig;
     printf("\n[SERVER] Shutting down...\n");
     g_running = 0;
-    if (g_state) g_state->running = 0;
+    for (int a = 0; a < g_num_arenas; a++) {
+        if (g_arenas[a]) g_arenas[a]->running = 0;
+    }
 }
 
 /* ============================================================================
@@ -668,84 +3016,254 @@ static void signal_handler(int sig) {
 static void cleanup(void) {
     printf("[SERVER] Cleaning up...\n");
     
-    for (int i = 0; i < NUM_WORKERS; i++) {
+    /* A takeover that failed half way leaves the segments to the server that
+     * is still running them: SIGTERM would stop their games */
+    int sig = g_segments_ours ? SIGTERM : SIGKILL;
+    for (int i = 0; i < g_num_workers; i++) {
         if (g_workers[i] > 0) {
-            kill(g_workers[i], SIGTERM);
+            kill(g_workers[i], sig);
         }
     }
     
-    if (g_game_loop_pid > 0) {
-        kill(g_game_loop_pid, SIGTERM);
+    for (int i = 0; i < g_num_loops; i++) {
+        if (g_game_loops[i] > 0) {
+            kill(g_game_loops[i], sig);
+        }
     }
     
     while (wait(NULL) > 0);
     
-    if (g_state) {
-        pthread_mutex_destroy(&g_state->lock);
-        pthread_mutexattr_destroy(&g_state->lock_attr);
-        shmdt(g_state);
+    if (g_arenas[0] && g_segments_ours) {
+        printf("[SERVER] Clients per worker at exit:");
+        for (int i = 0; i < g_num_workers; i++) {
+            printf(" %d", g_arenas[0]->worker_clients[i]);
+        }
+        printf("\n");
+    }
+    char name[48];
+    for (int a = 0; a < g_num_arenas; a++) {
+        GameState *st = g_arenas[a];
+        if (st && !g_segments_ours) {
+            munmap(st, g_seg_sizes[a]);
+        } else if (st) {
+            snprintf(name, sizeof(name), "state");
+            if (g_num_arenas > 1) snprintf(name, sizeof(name), "arena %d state", a);
+            print_lock_stats(name, &st->lock.stats);
+            pthread_mutex_destroy(&st->lock.mutex);
+            pthread_mutexattr_destroy(&st->lock_attr);
+            munmap(st, g_seg_sizes[a]);
+        }
+        if (g_seg_ids[a] >= 0 && g_segments_ours) {
+            segment_name(name, sizeof(name), g_seg_ids[a]);
+            shm_unlink(name);
+        }
     }
     
-    if (g_shmid >= 0) {
-        shmctl(g_shmid, IPC_RMID, NULL);
+    if (g_metrics) {
+        if (g_segments_ours) g_metrics->magic = 0;
+        munmap(g_metrics, sizeof(*g_metrics));
+    }
+    if (g_metrics_id >= 0 && g_segments_ours) {
+        segment_name(name, sizeof(name), g_metrics_id);
+        shm_unlink(name);
+    }
+    if (g_control_fd >= 0) {
+        close(g_control_fd);
     }
     
-    if (g_server_fd >= 0) {
-        close(g_server_fd);
+    for (int i = 0; i < g_num_workers; i++) {
+        if (g_listen_fds[i] >= 0 && (i == 0 || g_listen_fds[i] != g_listen_fds[0])) {
+            close(g_listen_fds[i]);
+        }
+        if (g_tick_fds[i] >= 0) {
+            close(g_tick_fds[i]);
+        }
+        if (g_handoff_fds[i] >= 0) {
+            close(g_handoff_fds[i]);
+        }
     }
     
     printf("[SERVER] Cleanup complete.\n");
 }
 
 /* ============================================================================
- * Main
+ * Stats Reader (./server --stats)
  * ============================================================================ */
 
-int main(int argc, char *argv[]) {
-    int port = SERVER_PORT;
-    
-    if (argc > 1) {
-        port = atoi(argv[1]);
+static const char *opcode_name(int op) {
+    switch (op) {
+        case OP_LOGIN_REQ:     return "LOGIN_REQ";
+        case OP_LOGIN_RESP:    return "LOGIN_RESP";
+        case OP_MOVE:          return "MOVE";
+        case OP_MAP_UPDATE:    return "MAP_UPDATE";
+        case OP_CHAT_SEND:     return "CHAT_SEND";
+        case OP_CHAT_RECV:     return "CHAT_RECV";
+        case OP_PLAYER_JOIN:   return "PLAYER_JOIN";
+        case OP_PLAYER_LEAVE:  return "PLAYER_LEAVE";
+        case OP_PLAYER_DIE:    return "PLAYER_DIE";
+        case OP_LOGOUT:        return "LOGOUT";
+        case OP_HEARTBEAT:     return "HEARTBEAT";
+        case OP_HEARTBEAT_ACK: return "HEARTBEAT_ACK";
+        case OP_MAP_DELTA:     return "MAP_DELTA";
+        case OP_MAP_RESYNC:    return "MAP_RESYNC";
+        case OP_COMPRESSED:    return "COMPRESSED";
+        case OP_CHAT_BATCH:    return "CHAT_BATCH";
+        case OP_UDP_REQUEST:   return "UDP_REQUEST";
+        case OP_UDP_OFFER:     return "UDP_OFFER";
+        case OP_UDP_INPUT:     return "UDP_INPUT";
+        case OP_UDP_FRAME:     return "UDP_FRAME";
+        case OP_VIEW_DELTA:    return "VIEW_DELTA";
+        case OP_MINIMAP:       return "MINIMAP";
+        case OP_SPECTATE:      return "SPECTATE";
+        case OP_INPUT_ACK:     return "INPUT_ACK";
+        default:               return "other";
     }
-    
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGPIPE, SIG_IGN);
-    
-    srand(time(NULL));
-    
-    /* Create shared memory */
-    key_t key = ftok(SHM_KEY_FILE, SHM_KEY_ID);
-    if (key == -1) {
-        perror("ftok");
+}
+
+/* One line of avg/p50/p99/max, in microseconds */
+static void print_hist_us(const char *name, const Histogram *h) {
+    printf("  %-10s %10llu samples   avg %8.1f  p50 <%8.1f  p99 <%8.1f  max %8.1f us\n",
+           name, (unsigned long long)h->count,
+           h->count ? h->sum / 1000.0 / h->count : 0.0,
+           hist_percentile(h, 50) / 1000.0, hist_percentile(h, 99) / 1000.0,
+           h->max / 1000.0);
+}
+
+/* Dump the metrics in segment `id` (a running server's or relay's). Two
+ * copies a second apart give the rates; the state lock is never touched. */
+static int run_stats(int id) {
+    char name[48];
+    segment_name(name, sizeof(name), id);
+    int fd = shm_open(name, O_RDONLY, 0);
+    struct stat st;
+    const ServerMetrics *live = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ServerMetrics)) {
+        live = mmap(NULL, sizeof(ServerMetrics), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) close(fd);
+    if (live == MAP_FAILED || live->magic != METRICS_MAGIC) {
+        fprintf(stderr, "No running server found on port %d\n", g_port);
         return 1;
     }
     
-    g_shmid = shmget(key, sizeof(GameState), IPC_CREAT | 0666);
-    if (g_shmid < 0) {
-        perror("shmget");
+    ServerMetrics *a = malloc(sizeof(*a));
+    ServerMetrics *b = malloc(sizeof(*b));
+    if (!a || !b) {
+        perror("malloc");
         return 1;
     }
+    memcpy(a, live, sizeof(*a));
+    sleep(1);
+    memcpy(b, live, sizeof(*b));
+    munmap((void *)live, sizeof(*live));
     
-    g_state = (GameState *)shmat(g_shmid, NULL, 0);
-    if (g_state == (void *)-1) {
-        perror("shmat");
-        return 1;
+    printf("Server up %llu s, %d workers, %d arena%s on %d game loop%s\n\n",
+           (unsigned long long)(time(NULL) - b->start_time), b->num_workers,
+           b->num_arenas, b->num_arenas == 1 ? "" : "s",
+           b->num_loops, b->num_loops == 1 ? "" : "s");
+    
+    for (int l = 0; l < b->num_loops && l < MAX_ARENAS; l++) {
+        const GameLoopMetrics *la = &a->loops[l], *lb = &b->loops[l];
+        printf("Game loop %d: %llu ticks (%llu/s), %llu overruns\n", l,
+               (unsigned long long)lb->ticks, (unsigned long long)(lb->ticks - la->ticks),
+               (unsigned long long)lb->overruns);
     }
     
-    /* Initialize game state */
-    init_game_state();
+    /* One arena in detail, or a line for each */
+    if (b->num_arenas == 1) {
+        const LockStats *ls = &b->arenas[0].state_lock;
+        print_hist_us("tick", &b->arenas[0].tick_ns);
+        if (b->arenas[0].bots > 0) {
+            printf("Players: %d, of them %d bots\n", b->arenas[0].players, b->arenas[0].bots);
+            print_hist_us("bots", &b->arenas[0].bot_ns);
+        }
+        printf("State lock: %llu acquisitions (%llu/s), %llu contended\n",
+               (unsigned long long)ls->acquisitions,
+               (unsigned long long)(ls->acquisitions - a->arenas[0].state_lock.acquisitions),
+               (unsigned long long)ls->contended);
+        print_hist_us("wait", &ls->wait_hist);
+        print_hist_us("hold", &ls->hold_hist);
+    } else {
+        printf("\n%6s %7s %5s %7s %10s %10s %8s %9s %10s %10s\n", "arena", "players", "bots",
+               "ticks/s", "tick_avg", "tick_p99", "locks/s", "contended", "wait_p99", "hold_p99");
+        for (int n = 0; n < b->num_arenas && n < MAX_ARENAS; n++) {
+            const ArenaMetrics *aa = &a->arenas[n], *ab = &b->arenas[n];
+            const LockStats *ls = &ab->state_lock;
+            printf("%6d %7d %5d %7llu %8.1fus %8.1fus %8llu %9llu %8.1fus %8.1fus\n", n,
+                   ab->players, ab->bots, (unsigned long long)(ab->ticks - aa->ticks),
+                   ab->tick_ns.count ? ab->tick_ns.sum / 1000.0 / ab->tick_ns.count : 0.0,
+                   hist_percentile(&ab->tick_ns, 99) / 1000.0,
+                   (unsigned long long)(ls->acquisitions - aa->state_lock.acquisitions),
+                   (unsigned long long)ls->contended,
+                   hist_percentile(&ls->wait_hist, 99) / 1000.0,
+                   hist_percentile(&ls->hold_hist, 99) / 1000.0);
+        }
+    }
+    printf("\n%6s %7s %7s %8s %8s %9s %9s %10s %9s %8s %10s %10s\n", "worker", "clients",
+           "viewers", "accepts", "accept/s", "pkts_in/s", "KB_in/s", "pkts_out/s", "KB_out/s",
+           "skipped", "queue_p99", "update_p99");
+    WorkerMetrics total;
+    memset(&total, 0, sizeof(total));
+    for (int w = 0; w < b->num_workers && w < MAX_WORKERS; w++) {
+        const WorkerMetrics *wa = &a->workers[w], *wb = &b->workers[w];
+        printf("%6d %7llu %7d %8llu %8llu %9llu %9.1f %10llu %9.1f %8llu %9lluB %8.1fus\n", w,
+               (unsigned long long)(wb->accepts - wb->disconnects), wb->spectators,
+               (unsigned long long)wb->accepts,
+               (unsigned long long)(wb->accepts - wa->accepts),
+               (unsigned long long)(wb->packets_in - wa->packets_in),
+               (wb->bytes_in - wa->bytes_in) / 1024.0,
+               (unsigned long long)(wb->packets_out - wa->packets_out),
+               (wb->bytes_out - wa->bytes_out) / 1024.0,
+               (unsigned long long)wb->frames_skipped,
+               (unsigned long long)hist_percentile(&wb->send_queue, 99),
+               hist_percentile(&wb->update_ns, 99) / 1000.0);
+        for (int op = 0; op < METRIC_OPCODES; op++) {
+            total.ops_in[op] += wb->ops_in[op];
+            total.ops_out[op] += wb->ops_out[op];
+        }
+    }
     
-    /* Create server socket */
-    g_server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (g_server_fd < 0) {
-        perror("socket");
-        cleanup();
-        return 1;
+    printf("\n%-20s %12s %12s\n", "opcode", "received", "sent");
+    for (int op = 0; op < METRIC_OPCODES; op++) {
+        if (!total.ops_in[op] && !total.ops_out[op]) continue;
+        printf("0x%04X %-13s %12llu %12llu\n", op, opcode_name(op),
+               (unsigned long long)total.ops_in[op], (unsigned long long)total.ops_out[op]);
     }
     
+    free(a);
+    free(b);
+    return 0;
+}
+
+/* ============================================================================
+ * Main
+ * ============================================================================ */
+
+/* Value of a numeric option, or -1 if it is missing */
+static int option_value(int argc, char *argv[], int *i) {
+    if (*i + 1 >= argc) return -1;
+    return atoi(argv[++*i]);
+}
+
+static bool check_range(const char *what, int value, int lo, int hi) {
+    if (value >= lo && value <= hi) return true;
+    fprintf(stderr, "%s must be between %d and %d\n", what, lo, hi);
+    return false;
+}
+
+/* Bound, listening, non-blocking TCP socket on `port`, or -1. With
+ * `reuseport` several of them can share the port and the kernel spreads
+ * incoming connections across them by address hash. */
+static int open_listener(int port, bool reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    
     int opt = 1;
-    setsockopt(g_server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(fd);
+        return -1;
+    }
     
     struct sockaddr_in addr = {
         .sin_family = AF_INET,
@@ -753,54 +3271,544 @@ int main(int argc, char *argv[]) {
         .sin_port = htons(port)
     };
     
-    if (bind(g_server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        cleanup();
+    /* Workers race to accept on a shared listener: losers must get EAGAIN */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 128) < 0 || set_nonblocking(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* One SO_REUSEPORT listener per worker, or one shared by all of them */
+static bool open_listeners(int port) {
+    bool reuseport = true;
+    for (int i = 0; i < g_num_workers; i++) {
+        g_listen_fds[i] = open_listener(port, true);
+        if (g_listen_fds[i] < 0) {
+            reuseport = false;
+            break;
+        }
+    }
+    if (reuseport) return true;
+    
+    for (int i = 0; i < g_num_workers; i++) {
+        if (g_listen_fds[i] >= 0) close(g_listen_fds[i]);
+        g_listen_fds[i] = -1;
+    }
+    int fd = open_listener(port, false);
+    if (fd < 0) return false;
+    
+    fprintf(stderr, "[SERVER] SO_REUSEPORT unavailable, workers share one listener\n");
+    for (int i = 0; i < g_num_workers; i++) {
+        g_listen_fds[i] = fd;
+    }
+    return true;
+}
+
+/* Segment id of arena `a` */
+static int arena_segment_id(int a) {
+    return g_relay ? SHM_RELAY_ID : a == 0 ? SHM_KEY_ID : SHM_ARENA_ID + a;
+}
+
+/* New master: map the running server's segments. False unless all of them
+ * are laid out as this build would lay them out. */
+static bool attach_segments(void) {
+    size_t size;
+    g_metrics = map_segment(SHM_METRICS_ID, &size, true);
+    if (!g_metrics || size < sizeof(ServerMetrics) || g_metrics->magic != METRICS_MAGIC) {
+        if (g_metrics) munmap(g_metrics, size);
+        g_metrics = NULL;
+        return false;
+    }
+    g_metrics_id = SHM_METRICS_ID;
+    
+    for (int a = 0; a < g_num_arenas; a++) {
+        g_arenas[a] = map_segment(arena_segment_id(a), &g_seg_sizes[a], true);
+        if (!g_arenas[a]) return false;
+        g_seg_ids[a] = arena_segment_id(a);
+        if (!state_compatible(a, &g_arenas[0]->cfg)) return false;
+    }
+    return true;
+}
+
+/* Listening unix socket for handoff_address(port, worker), or -1 */
+static int listen_unix(int port, int worker) {
+    struct sockaddr_un addr;
+    socklen_t len = handoff_address(&addr, port, worker);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&addr, len) < 0 || listen(fd, 4) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Plain start: take the control socket of `port` (where the next --takeover
+ * calls; a relay only holds it) before touching the port's segments. Fails if a server answers
+ * there already: its segments are live, and with SO_REUSEPORT the two would
+ * split the clients. Children inherit the socket, so the port stays taken
+ * while any of them lives. */
+static bool claim_port(int port) {
+    g_control_fd = listen_unix(port, -1);
+    if (g_control_fd >= 0) return true;
+    int err = errno;
+    
+    struct sockaddr_un addr;
+    socklen_t len = handoff_address(&addr, port, -1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = fd >= 0 && connect(fd, (struct sockaddr *)&addr, len) == 0;
+    if (fd >= 0) close(fd);
+    if (live) {
+        fprintf(stderr, "A server is already running on port %d%s\n", port,
+                g_relay ? "" : " (--takeover replaces it)");
+        return false;
+    }
+    fprintf(stderr, "[SERVER] No control socket (%s), --takeover will not work\n",
+            strerror(err));
+    return true;
+}
+
+/* New master: call the server running on `port` and take its listeners.
+ * Returns the control connection, or -1. */
+static int takeover_begin(int port, TakeoverHello *old) {
+    struct sockaddr_un addr;
+    socklen_t len = handoff_address(&addr, port, -1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, len) < 0) {
+        fprintf(stderr, "No server to take over on port %d\n", port);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    set_recv_timeout(fd, HANDOFF_TIMEOUT_MS);
+    
+    TakeoverHello req = { .magic = STATE_MAGIC, .version = STATE_VERSION, .pid = getpid() };
+    int fds[MAX_WORKERS], nfds = 0;
+    memset(old, 0, sizeof(*old));
+    if (write_full(fd, &req, sizeof(req)) < 0 ||
+        recv_fds(fd, old, sizeof(*old), fds, MAX_WORKERS, &nfds) <= 0 ||
+        old->magic != STATE_MAGIC || old->version != STATE_VERSION ||
+        old->num_workers < 1 || old->num_workers > MAX_WORKERS ||
+        old->num_arenas < 1 || old->num_arenas > MAX_ARENAS ||
+        (nfds != 1 && nfds != old->num_workers)) {
+        if (old->magic != STATE_MAGIC) {
+            fprintf(stderr, "The server on port %d refused the takeover (a relay?)\n", port);
+        } else {
+            fprintf(stderr, "The server on port %d cannot be taken over (state version %u, "
+                    "this build has %d)\n", port, old->version, STATE_VERSION);
+        }
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        close(fd);
+        return -1;
+    }
+    
+    g_num_workers = old->num_workers;
+    g_num_arenas = old->num_arenas;
+    for (int i = 0; i < g_num_workers; i++) {
+        g_listen_fds[i] = fds[nfds == 1 ? 0 : i];
+    }
+    return fd;
+}
+
+/* New master, workers forked: let the old server go and wait until its game
+ * loops and workers are gone. False if that was never confirmed: its game
+ * loops may still be ticking the arenas. */
+static bool takeover_finish(int fd) {
+    char done = 0;
+    set_recv_timeout(fd, 0);
+    bool ok = write_full(fd, "R", 1) == 0 && read_full(fd, &done, 1) == 0 && done == 'D';
+    close(fd);
+    return ok;
+}
+
+/* Old master: a --takeover server called. Give it the listeners, then stop
+ * the game loops and workers, which hand their clients over. Returns true
+ * once they are gone, false if the caller gave up before that. */
+static bool serve_takeover(void) {
+    int fd = accept(g_control_fd, NULL, NULL);
+    if (fd < 0) return false;
+    if (g_relay || !peer_is_us(fd)) {
+        close(fd);
+        return false;
+    }
+    set_recv_timeout(fd, HANDOFF_TIMEOUT_MS);
+    
+    TakeoverHello req, resp = {
+        .magic = STATE_MAGIC,
+        .version = STATE_VERSION,
+        .pid = getpid(),
+        .num_workers = g_num_workers,
+        .num_arenas = g_num_arenas
+    };
+    bool shared = g_num_workers > 1 && g_listen_fds[0] == g_listen_fds[1];
+    char ready;
+    if (read_full(fd, &req, sizeof(req)) < 0) {
+        close(fd);
+        return false;
+    }
+    if (req.magic != STATE_MAGIC || req.version != STATE_VERSION) {
+        fprintf(stderr, "[SERVER] Refused a takeover by state version %u (ours is %d)\n",
+                req.version, STATE_VERSION);
+        write_full(fd, &resp, sizeof(resp));
+        close(fd);
+        return false;
+    }
+    if (send_fds(fd, &resp, sizeof(resp), g_listen_fds, shared ? 1 : g_num_workers) < 0 ||
+        read_full(fd, &ready, 1) < 0) {
+        close(fd);
+        return false;
+    }
+    
+    printf("[SERVER] Handing over to PID %d...\n", req.pid);
+    fflush(stdout);
+    for (int i = 0; i < g_num_loops; i++) {
+        kill(g_game_loops[i], SIGUSR2);
+    }
+    for (int i = 0; i < g_num_workers; i++) {
+        kill(g_workers[i], SIGUSR2);
+    }
+    while (wait(NULL) > 0 || errno == EINTR);
+    
+    close(g_control_fd);
+    g_control_fd = -1;
+    write_full(fd, "D", 1);
+    close(fd);
+    return true;
+}
+
+/* Fork the game loop processes (the feed process on a relay) */
+static bool fork_game_loops(void) {
+    for (int i = 0; i < g_num_loops; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (g_relay) {
+                relay_process();
+            } else {
+                game_loop_process(i);
+            }
+            exit(0);
+        } else if (pid > 0) {
+            g_game_loops[i] = pid;
+        } else {
+            perror("fork game loop");
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool fork_workers(void) {
+    for (int i = 0; i < g_num_workers; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            worker_process(i);
+            exit(0);
+        } else if (pid > 0) {
+            g_workers[i] = pid;
+        } else {
+            perror("fork worker");
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int port = -1;
+    const char *relay_from = NULL;
+    bool takeover = false;
+    int stats_id = -1;
+    GameConfig cfg = {
+        .grid_size = DEFAULT_GRID_SIZE,
+        .max_players = DEFAULT_MAX_PLAYERS,
+        .max_snake_len = DEFAULT_MAX_SNAKE_LEN
+    };
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--select") == 0) {
+            g_use_epoll = 0;
+        } else if (strcmp(argv[i], "--epoll") == 0) {
+            g_use_epoll = 1;
+        } else if (strcmp(argv[i], "--grid") == 0) {
+            cfg.grid_size = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--players") == 0) {
+            cfg.max_players = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--snake-len") == 0) {
+            cfg.max_snake_len = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--tick-threads") == 0) {
+            g_tick_threads = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            g_num_workers = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--arenas") == 0) {
+            g_num_arenas = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--game-loops") == 0) {
+            g_num_loops = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--relay") == 0 && i + 1 < argc) {
+            relay_from = argv[++i];
+        } else if (strcmp(argv[i], "--relay-arena") == 0) {
+            g_upstream_arena = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--bots") == 0) {
+            g_bot_target = option_value(argc, argv, &i);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            g_record_path = argv[++i];
+        } else if (strcmp(argv[i], "--hugepages") == 0) {
+            g_hugepages = true;
+        } else if (strcmp(argv[i], "--mlock") == 0) {
+            g_mlock = true;
+        } else if (strcmp(argv[i], "--takeover") == 0) {
+            takeover = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_id = SHM_METRICS_ID;
+        } else if (strcmp(argv[i], "--relay-stats") == 0) {
+            stats_id = SHM_RELAY_METRICS_ID;
+        } else {
+            port = atoi(argv[i]);
+        }
+    }
+    
+    if (stats_id >= 0) {
+        g_port = port >= 0 ? port : stats_id == SHM_RELAY_METRICS_ID ? RELAY_PORT : SERVER_PORT;
+        return run_stats(stats_id);
+    }
+    
+    if (!check_range("--grid", cfg.grid_size, MIN_GRID_SIZE, MAX_GRID_SIZE) ||
+        !check_range("--players", cfg.max_players, 1, MAX_PLAYERS_LIMIT) ||
+        !check_range("--snake-len", cfg.max_snake_len, MIN_SNAKE_LEN, MAX_SNAKE_LEN_LIMIT) ||
+        !check_range("--tick-threads", g_tick_threads, 1, MAX_TICK_THREADS) ||
+        (g_num_workers != 0 && !check_range("--workers", g_num_workers, 1, MAX_WORKERS)) ||
+        !check_range("--arenas", g_num_arenas, 1, MAX_ARENAS) ||
+        (g_num_loops != 0 && !check_range("--game-loops", g_num_loops, 1,
+                                          takeover ? MAX_ARENAS : g_num_arenas)) ||
+        !check_range("--relay-arena", g_upstream_arena, 0, MAX_ARENAS - 1) ||
+        !check_range("--bots", g_bot_target, 0, MAX_PLAYERS_LIMIT)) {
+        return 1;
+    }
+    
+    if (relay_from && (g_record_path || g_bot_target > 0 || takeover)) {
+        fprintf(stderr, "--record, --bots and --takeover need a game server, not a relay\n");
         return 1;
     }
     
-    if (listen(g_server_fd, 128) < 0) {
+    /* A relay carries one upstream arena, sized as it is there */
+    if (relay_from) {
+        LoginResponse resp;
+        g_upstream_fd = relay_connect(relay_from, g_upstream_arena, &resp);
+        if (g_upstream_fd < 0) return 1;
+        g_relay = true;
+        g_upstream_arena = resp.arena;
+        g_num_arenas = g_num_loops = 1;
+        cfg.grid_size = resp.grid_width;
+        cfg.max_players = resp.max_players;
+        cfg.max_snake_len = MIN_SNAKE_LEN;    /* No snakes are simulated */
+    }
+    if (port < 0) {
+        port = g_relay ? RELAY_PORT : SERVER_PORT;
+    }
+    
+    g_port = port;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        g_listen_fds[i] = -1;
+        g_tick_fds[i] = -1;
+        g_handoff_fds[i] = -1;
+    }
+    for (int a = 0; a < MAX_ARENAS; a++) {
+        g_seg_ids[a] = -1;
+    }
+    
+    /* Taking over: the worker count and the arenas are the running server's */
+    TakeoverHello old;
+    int control = -1;
+    if (takeover) {
+        control = takeover_begin(port, &old);
+        if (control < 0) return 1;
+        g_segments_ours = false;
+    }
+    
+    /* One worker per core by default, and as many game loops as fit */
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    if (g_num_workers == 0) {
+        g_num_workers = cores > MAX_WORKERS ? MAX_WORKERS : (int)cores;
+    }
+    if (g_num_loops == 0 || g_num_loops > g_num_arenas) {
+        g_num_loops = cores > g_num_arenas ? g_num_arenas : (int)cores;
+    }
+    cfg.max_delta_cells = 4 * cfg.max_players > MAX_DELTA_CELLS ?
+                          4 * cfg.max_players : MAX_DELTA_CELLS;
+    
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+    
+    srand(time(NULL));
+    
+    GameState layout;
+    memset(&layout, 0, sizeof(layout));
+    size_t shm_size;
+    if (takeover) {
+        if (!attach_segments()) {
+            fprintf(stderr, "The running server's shared memory does not match this build\n");
+            cleanup();
+            return 1;
+        }
+        arena_bind(0);
+        shm_size = g_state->shm_size;
+    } else {
+        if (!claim_port(port)) return 1;
+        shm_size = state_layout(&layout, &cfg);
+        
+        /* Create shared memory: a segment per arena */
+        for (int a = 0; a < g_num_arenas; a++) {
+            g_seg_sizes[a] = shm_size;
+            g_arenas[a] = map_segment(arena_segment_id(a), &g_seg_sizes[a], false);
+            if (!g_arenas[a]) {
+                cleanup();
+                return 1;
+            }
+            g_seg_ids[a] = arena_segment_id(a);
+        }
+        
+        size_t metrics_size = sizeof(ServerMetrics);
+        g_metrics_id = g_relay ? SHM_RELAY_METRICS_ID : SHM_METRICS_ID;
+        g_metrics = map_segment(g_metrics_id, &metrics_size, false);
+        if (!g_metrics) {
+            g_metrics_id = -1;
+            cleanup();
+            return 1;
+        }
+        memset(g_metrics, 0, sizeof(*g_metrics));
+        g_metrics->num_workers = g_num_workers;
+        g_metrics->num_arenas = g_num_arenas;
+        g_metrics->start_time = time(NULL);
+        g_metrics->magic = METRICS_MAGIC;
+        
+        /* Initialize game state, leaving the first arena bound */
+        for (int a = g_num_arenas - 1; a >= 0; a--) {
+            init_game_state(a, &layout);
+        }
+    }
+    
+    /* The master's lock keeps the pages resident; each game loop locks its
+     * arenas again for its own page tables */
+    if (g_mlock) {
+        for (int a = 0; a < g_num_arenas; a++) {
+            lock_segment(g_arenas[a], g_seg_sizes[a]);
+        }
+    }
+    
+    /* Create listen sockets, or keep the ones handed over */
+    if (!takeover && !open_listeners(port)) {
         perror("listen");
         cleanup();
         return 1;
     }
+    bool shared_listener = g_num_workers > 1 && g_listen_fds[0] == g_listen_fds[1];
+    
+    for (int i = 0; i < g_num_workers; i++) {
+        g_tick_fds[i] = eventfd(0, EFD_NONBLOCK);
+        if (g_tick_fds[i] < 0) {
+            perror("eventfd");
+            cleanup();
+            return 1;
+        }
+        g_handoff_fds[i] = takeover ? listen_unix(port, i) : -1;
+        if (takeover && g_handoff_fds[i] < 0) {
+            perror("handoff socket");
+            cleanup();
+            return 1;
+        }
+    }
     
     printf("================================================\n");
     printf("  Snake Game + Chatroom Server\n");
     printf("  (Multi-Process + Shared Memory IPC)\n");
     printf("================================================\n");
     printf("  Port:        %d\n", port);
-    printf("  Grid:        %dx%d\n", GRID_SIZE, GRID_SIZE);
-    printf("  Max Players: %d\n", MAX_PLAYERS);
-    printf("  Workers:     %d (prefork)\n", NUM_WORKERS);
-    printf("  IPC:         System V Shared Memory\n");
-    printf("  SHM ID:      %d\n", g_shmid);
+    printf("  Grid:        %dx%d\n", g_cfg.grid_size, g_cfg.grid_size);
+    if (g_relay) {
+        printf("  Max Players: %d\n", g_cfg.max_players);
+        printf("  Relay of:    %s (arena %d, spectators only)\n", relay_from, g_upstream_arena);
+    } else {
+        printf("  Max Players: %d (snake length up to %d)\n", g_cfg.max_players,
+               g_cfg.max_snake_len);
+        printf("  Arenas:      %d (%d game loop%s)\n", g_num_arenas, g_num_loops,
+               g_num_loops == 1 ? "" : "s");
+        if (g_bot_target > 0) {
+            printf("  Bots:        up to %d snakes per arena\n", g_bot_target);
+        }
+        if (g_record_path) {
+            printf("  Recording:   %s%s\n", g_record_path, g_num_arenas == 1 ? "" : ".N");
+        }
+    }
+    printf("  Workers:     %d (prefork, %s, %s)\n", g_num_workers,
+           g_use_epoll ? "epoll" : "select",
+           shared_listener ? "shared listener" : "SO_REUSEPORT");
+    printf("  IPC:         POSIX Shared Memory%s%s\n", g_hugepages ? ", huge pages" : "",
+           g_mlock ? ", locked" : "");
+    char name[48];
+    segment_name(name, sizeof(name), g_seg_ids[0]);
+    if (g_num_arenas == 1) {
+        printf("  SHM:         %s (%zu KB)\n", name, shm_size / 1024);
+    } else {
+        printf("  SHM:         %s, ... (%d segments of %zu KB)\n", name, g_num_arenas,
+               shm_size / 1024);
+    }
+    if (takeover) {
+        printf("  Taking over: PID %d\n", old.pid);
+    }
     printf("================================================\n");
     fflush(stdout);
     
-    /* Fork game loop process */
-    pid_t pid = fork();
-    if (pid == 0) {
-        game_loop_process();
-        exit(0);
-    } else if (pid > 0) {
-        g_game_loop_pid = pid;
+    /* A takeover needs the new workers waiting before the old ones hand over,
+     * and the old game loops gone before the new ones tick */
+    if (takeover) {
+        bool forked = fork_workers();
+        for (int i = 0; i < g_num_workers; i++) {
+            close(g_handoff_fds[i]);
+            g_handoff_fds[i] = -1;
+        }
+        if (!forked) {
+            close(control);
+            cleanup();
+            return 1;
+        }
+        /* Two game loops must never tick one arena: without the old
+         * server's word, leave the segments to it */
+        if (!takeover_finish(control)) {
+            fprintf(stderr, "[SERVER] Lost the old server during the handover, "
+                    "its game loops may still be running\n");
+            cleanup();
+            return 1;
+        }
+        g_segments_ours = true;
+        g_metrics->num_loops = g_num_loops;
+        if (!fork_game_loops()) {
+            cleanup();
+            return 1;
+        }
+        printf("[SERVER] Took over from PID %d.\n", old.pid);
+        
+        /* Where the next --takeover calls */
+        g_control_fd = listen_unix(port, -1);
+        if (g_control_fd < 0) {
+            fprintf(stderr, "[SERVER] No control socket (%s), --takeover will not work\n",
+                    strerror(errno));
+        }
     } else {
-        perror("fork game loop");
-        cleanup();
-        return 1;
-    }
-    
-    /* Prefork workers */
-    for (int i = 0; i < NUM_WORKERS; i++) {
-        pid = fork();
-        if (pid == 0) {
-            worker_process(i);
-            exit(0);
-        } else if (pid > 0) {
-            g_workers[i] = pid;
-        } else {
-            perror("fork worker");
+        g_metrics->num_loops = g_num_loops;
+        if (!fork_game_loops()) {
+            cleanup();
+            return 1;
+        }
+        
+        /* Only the feed process talks to upstream */
+        if (g_upstream_fd >= 0) {
+            close(g_upstream_fd);
+            g_upstream_fd = -1;
+        }
+        
+        if (!fork_workers()) {
             cleanup();
             return 1;
         }
@@ -809,7 +3817,11 @@ int main(int argc, char *argv[]) {
     printf("[SERVER] All processes started. Press Ctrl+C to stop.\n");
     
     while (g_running) {
-        pause();
+        struct pollfd pfd = { .fd = g_control_fd, .events = POLLIN };
+        if (poll(&pfd, 1, -1) > 0 && serve_takeover()) {
+            printf("[SERVER] Handed over, exiting.\n");
+            return 0;
+        }
     }
     
     cleanup();